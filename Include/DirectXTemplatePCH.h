@@ -1,11 +1,17 @@
 #pragma once
 
 // System includes
+// the solver and the benchmark only need DirectXMath, so they also build outside
+// Windows with GCC or Clang, the application needs Windows and Direct3D 11
+#ifdef _WIN32
+// winsock2.h has to come before windows.h, which would include the old winsock.h
+#include <winsock2.h>
 #include <windows.h>
 
 // DirectX includes
 #include <d3d11.h>
 #include <d3dcompiler.h>
+#endif
 #include <DirectXMath.h>
 #include <DirectXColors.h>
 
@@ -15,17 +21,31 @@
 #include <algorithm>
 #include <fstream>
 #include <list>
+#include <vector>
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cfloat>
+#include <cassert>
 
+#ifdef _WIN32
 // Link library dependencies
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
 #pragma comment(lib, "d3dcompiler.lib")
 #pragma comment(lib, "winmm.lib")
+#pragma comment(lib, "ws2_32.lib")
+#endif
 
 using namespace DirectX;
 
+#ifdef _WIN32
 // Safely release a COM object.
 template<typename T>
 inline void SafeRelease(T& ptr)
@@ -36,52 +56,4 @@ inline void SafeRelease(T& ptr)
         ptr = NULL;
     }
 }
-struct Vertex
-{
-    XMFLOAT3 position;
-    XMFLOAT3 normal;
-    XMFLOAT3 color;
-};
-
-struct Face
-{
-    int vertex_indices[4];
-    int normal_index;
-};
-
-struct OBJ_Model
-{
-    Vertex* vertices;
-    int vertex_count;
-    Face* faces;
-    int face_count;
-};
-
-struct Patch
-{
-    XMFLOAT3 vertex_pos[4];
-    XMFLOAT3 centroid;
-    XMFLOAT3 normal;
-    XMFLOAT3 radiosity;
-    XMFLOAT3 irradiance;
-    XMFLOAT3 reflectance;
-    float area;
-
-    // rendering relevant members
-    ID3D11InputLayout* input_layout;
-    ID3D11Buffer* vertex_buffer;
-    ID3D11Buffer* index_buffer;
-
-    // hierarchical radiosity relevant members
-    int influencing_partner_count;
-    std::list<Patch*> influencing_partners;
-    std::list<double> influencing_partner_formfactors;
-
-    bool has_parent;
-    bool has_children;
-    Patch* parent;
-    Patch** children;
-
-    XMVECTOR gathered_brightness;
-    XMVECTOR brightness;
-};
\ No newline at end of file
+#endif
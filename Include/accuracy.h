@@ -0,0 +1,6 @@
+#pragma once
+
+// Reference accuracy harness: solves a scene to tight convergence and compares
+// the solver configurations against it (see accuracy.cpp). It is started as the
+// "accuracy" command of the benchmark, argv[0] being the command name.
+int AccuracyMain(int argc, char* argv[]);
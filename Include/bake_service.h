@@ -0,0 +1,8 @@
+#pragma once
+
+// Bake service: a long-running process that reads bake jobs from stdin, one per line,
+// and writes one JSON result line per job to stdout as soon as it is done. The scenes
+// stay resident between jobs with their formfactors or links in an LRU cache, so a
+// job on a cached scene only pays for its lighting and iterations (see bake_service.cpp).
+// It is started as the "bake" command of the benchmark, argv[0] being the command name.
+int BakeMain(int argc, char* argv[]);
@@ -0,0 +1,56 @@
+#pragma once
+
+// Checkpoints of long solves. The state of an iteration (the radiosities of the
+// matrix method, or the patch hierarchies with their links and brightness) is
+// written to a compact binary file every few iterations, so a solve that dies can
+// resume from the last one instead of starting over. The formfactor matrix isn't
+// part of it, it is estimated again for the scene. Writing a checkpoint copies the
+// state into memory on the solver thread and leaves the file to a writer thread,
+// which replaces the previous checkpoint only once the new one is complete.
+
+struct CheckpointOptions
+{
+    // the checkpoint file, the new checkpoint is written next to it and renamed over it
+    std::string path;
+
+    // iterations between two checkpoints, 0 writes none
+    int interval;
+};
+
+CheckpointOptions DefaultCheckpointOptions();
+
+enum CheckpointKind
+{
+    CK_Matrix,
+    CK_Hierarchical
+};
+
+// the writer thread of the checkpoints of one solve and what it has written so far.
+struct CheckpointWriter
+{
+    std::string path;
+    std::thread thread;
+    std::atomic<bool> failed;
+
+    int count;
+    size_t bytes;
+    // the time the solver spent copying its state, and waiting for the previous
+    // checkpoint because the next one was due before it was written
+    double snapshot_seconds;
+    double stall_seconds;
+};
+
+void StartCheckpoints(CheckpointWriter& writer, const CheckpointOptions& options);
+
+// copies the state of the current scene after the given number of iterations and
+// writes it in the background.
+void WriteCheckpoint(CheckpointWriter& writer, CheckpointKind kind, int iterations);
+
+// waits for the last checkpoint. returns false if any of them couldn't be written.
+bool FinishCheckpoints(CheckpointWriter& writer);
+
+// restores the state of a checkpoint into the current scene, which has to be the one
+// it was written for, and returns the number of iterations it was written after.
+// a hierarchical checkpoint replaces the hierarchies and links of the patches.
+// returns false if the file is missing, damaged or was written for another scene.
+bool LoadCheckpoint(const std::string& path, CheckpointKind kind, int& iterations);
@@ -0,0 +1,68 @@
+#pragma once
+
+// Distributed matrix method. The rows of the formfactor matrix are split into contiguous
+// blocks over workers, which build the same scene, estimate only their own rows and keep
+// them as floats, so every worker holds 1 / n of the matrix. Every iteration the
+// coordinator sends the colors of all patches to the workers and gets back the radiosity
+// of their rows, only these vectors cross the transport. The transport is an interface:
+// the workers are processes started from the same executable and connected over
+// localhost sockets, or threads with their own Scene connected over in-memory queues.
+
+// an ordered, reliable byte stream between the coordinator and one worker. both calls
+// block until all bytes are through and return false once the other side is gone.
+class DistributedTransport
+{
+public:
+    virtual ~DistributedTransport() {}
+    virtual bool Send(const void* data, size_t bytes) = 0;
+    virtual bool Receive(void* data, size_t bytes) = 0;
+};
+
+enum DistributedTransportKind
+{
+    DT_Sockets,
+    DT_Threads
+};
+
+struct DistributedOptions
+{
+    int worker_count;
+    int iterations;
+    DistributedTransportKind transport;
+};
+
+DistributedOptions DefaultDistributedOptions();
+
+// how the workers rebuild the current scene: the .obj-model at obj_path, or the generated
+// room for patch_count and occluder_count if it is empty.
+struct DistributedScene
+{
+    std::string obj_path;
+    int patch_count;
+    int occluder_count;
+};
+
+struct DistributedStats
+{
+    // until all workers are connected, until all of them have estimated their rows, and
+    // the iterations
+    double start_seconds;
+    double form_factor_seconds;
+    double iterate_seconds;
+
+    // the bytes sent both ways during the iterations, and the formfactor bytes of the
+    // largest worker
+    size_t exchanged_bytes;
+    size_t worker_matrix_bytes;
+};
+
+const char* GetDistributedTransportName(DistributedTransportKind transport);
+
+// iterates the matrix method for the current scene on the workers, like IterateRadiosity()
+// from zero radiosity, and stores the radiosity in the patches. returns false if a
+// worker couldn't be started or failed.
+bool IterateRadiosityDistributed(const DistributedScene& scene, const DistributedOptions& options, DistributedStats& stats);
+
+// a worker process. it is started as the "distributed-worker" command of the benchmark
+// with the port of the coordinator, argv[0] being the command name.
+int DistributedWorkerMain(int argc, char* argv[]);
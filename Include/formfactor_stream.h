@@ -0,0 +1,36 @@
+#pragma once
+
+// Out-of-core formfactor matrix. For scenes whose matrix doesn't fit into memory
+// the rows are written to a file in blocks while they are estimated, and every
+// iteration streams the blocks back in. An i/o thread writes and reads the blocks
+// ahead of the solver, so the disk works while the rows are computed or multiplied.
+// Only the row sums and a few blocks are resident; g_scene->formfactors stays empty.
+// The rows are stored in the formfactor storage of the scene, like the packed matrix.
+
+struct StreamOptions
+{
+    // the file the matrix is written to, it is overwritten
+    std::string path;
+
+    // rows are grouped into blocks of at most this size, one block per read or write
+    size_t max_block_bytes;
+
+    // blocks in flight besides the one the solver works on
+    int read_ahead;
+
+    // workers estimating the rows of a block, 0 means one per hardware thread
+    int thread_count;
+};
+
+StreamOptions DefaultStreamOptions();
+
+// estimates the formfactors like EstimateFormFactors() into the file and keeps only
+// g_scene->formfactor_row_sums in memory. returns false if the file couldn't be written.
+bool EstimateFormFactorsStreamed(const StreamOptions& options);
+
+// iterates like IterateRadiosity() over the matrix in the file. returns false if the
+// file is missing or was written for another scene.
+bool IterateRadiosityStreamed(int iterations, const StreamOptions& options);
+
+// the memory held by the block buffers of the current scene.
+size_t StreamResidentBytes(const StreamOptions& options);
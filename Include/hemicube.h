@@ -0,0 +1,21 @@
+#pragma once
+
+// Hemicube formfactors on the CPU. For every patch all other patches are rasterised
+// onto the five z-buffered faces of a hemicube around its centroid, and the delta
+// formfactors of the pixels are summed up per visible patch. This yields a whole
+// row of the formfactor matrix per pass, including the occlusion, which the
+// pairwise EstimateFormFactor() ignores.
+
+struct HemicubeOptions
+{
+    // pixels along an edge of the top face, the side faces have half the height
+    int resolution;
+
+    // each worker thread renders its own hemicube, 0 means one per hardware thread
+    int thread_count;
+};
+
+HemicubeOptions DefaultHemicubeOptions();
+
+// fills g_scene->formfactors and g_scene->formfactor_row_sums like EstimateFormFactors().
+void EstimateFormFactorsHemicube(const HemicubeOptions& options);
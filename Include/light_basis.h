@@ -0,0 +1,44 @@
+#pragma once
+
+// Light basis for relighting. The radiosity is linear in the irradiance of the
+// emitters, so the scene is solved once per emitter group with only that group
+// emitting, and any mix of group intensities and colors is the weighted sum of these
+// solutions, without another solve. The groups are solved in batches over the current
+// formfactor matrix: every row is read once per iteration for all groups of a batch,
+// whose colors lie next to each other per patch and are summed by WeightedSumBands().
+
+struct LightBasisOptions
+{
+    int iterations;
+
+    // groups solved together, up to 8 fill the specialised kernels of WeightedSumBands()
+    int batch_size;
+
+    // stores the solutions as half floats instead of floats
+    bool half_storage;
+};
+
+LightBasisOptions DefaultLightBasisOptions();
+
+// the displayed colors of all patches for every group with its irradiance as in
+// g_scene->patches, patch-major: the colors of patch i are at [i * group_count, (i + 1) * group_count).
+struct LightBasis
+{
+    int group_count;
+    int patch_count;
+    bool half_storage;
+    std::vector<XMFLOAT3> colors;
+    std::vector<unsigned short> colors_half;
+};
+
+// one group per patch with irradiance, in the order of g_scene->patches.
+std::vector<std::vector<int>> EmitterGroups();
+
+// solves the current formfactor matrix once per group of patch indices, each time with
+// only the patches of the group emitting.
+void SolveLightBasis(const std::vector<std::vector<int>>& groups, const LightBasisOptions& options, LightBasis& basis);
+
+// the displayed colors with every group emitting its irradiance times its weight.
+void CombineLightBasis(const LightBasis& basis, const std::vector<XMFLOAT3>& weights, std::vector<XMFLOAT3>& colors);
+
+size_t LightBasisBytes(const LightBasis& basis);
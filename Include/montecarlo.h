@@ -0,0 +1,60 @@
+#pragma once
+
+// Monte Carlo methods of the radiosity solver.
+//
+// The formfactor of a patch pair is estimated from stratified pairs of sample
+// points on both patches. Pairs whose estimate still has a high variance get
+// more samples, up to a limit. Every pair draws its samples from its own seed,
+// so the matrix is the same for every thread count and row order.
+
+struct MonteCarloOptions
+{
+    // samples of the first round per pair, rounded up to a square number of strata
+    int min_samples;
+    int max_samples;
+
+    // the knob between time and accuracy: a pair gets more samples while the standard
+    // error of its estimate is above this fraction of the estimate
+    double relative_error;
+
+    unsigned int seed;
+
+    // 0 means one worker per hardware thread
+    int thread_count;
+};
+
+MonteCarloOptions DefaultMonteCarloOptions();
+
+// estimates the formfactor from patch i to patch j and returns the samples it took.
+double MonteCarloFormFactor(int i, int j, const MonteCarloOptions& options, int& samples);
+
+// fills g_scene->formfactors and g_scene->formfactor_row_sums like EstimateFormFactors(), parallel over rows.
+void EstimateFormFactorsMonteCarlo(const MonteCarloOptions& options);
+
+// The stochastic radiosity solver shoots the unshot power of the patches along rays
+// (stochastic Jacobi iteration). The rays of an iteration are distributed over the
+// patches in proportion to their unshot power, start at a uniform point of their patch
+// in a cosine-distributed direction and hand their power to the first patch they hit.
+// It needs O(n) memory: the patches, a bounding volume hierarchy over them and one
+// accumulation buffer per worker thread, which are merged after every iteration.
+
+struct StochasticOptions
+{
+    // rays of an iteration per patch
+    int rays_per_patch;
+    int max_iterations;
+
+    // stops once the unshot power is below this fraction of the emitted power
+    double unshot_tolerance;
+
+    unsigned int seed;
+
+    // 0 means one worker per hardware thread, each with its own random stream
+    int thread_count;
+};
+
+StochasticOptions DefaultStochasticOptions();
+
+// solves the scene into the radiosity of the patches, which GetRadiosity() shows like
+// the result of IterateRadiosity(). returns the number of iterations.
+int SolveStochasticRadiosity(const StochasticOptions& options);
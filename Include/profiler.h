@@ -0,0 +1,65 @@
+#pragma once
+
+// Lightweight profiler of the radiosity solver. Scoped timers and counters are
+// recorded into per-thread ring buffers and can be written as Chrome trace-event
+// JSON (chrome://tracing, Perfetto). While the profiler is disabled every
+// PROFILE_SCOPE/PROFILE_COUNT costs a relaxed load of g_profiler_enabled and a branch.
+
+enum ProfileCounter
+{
+    PC_LinksCreated,
+    PC_Subdivisions,
+    PC_FormFactorEvaluations,
+    PC_GatherOperations,
+    PC_FormFactorSamples,
+    PC_RaysCast,
+    PC_ActiveSources,
+    NumProfileCounters
+};
+
+extern std::atomic<bool> g_profiler_enabled;
+
+void EnableProfiler(bool enable);
+
+// clears all recorded events and counters of all threads.
+void ResetProfiler();
+
+// the sum of a counter over all threads.
+unsigned long long GetProfileCounter(ProfileCounter counter);
+const char* GetProfileCounterName(ProfileCounter counter);
+
+// the summed duration of all recorded scopes with the given name in seconds.
+double GetProfileSeconds(const char* name);
+
+bool WriteChromeTrace(const std::string& path);
+
+void ProfilerCount(ProfileCounter counter, unsigned long long amount);
+void ProfilerRecord(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+
+// records the lifetime of a scope as one event. name has to be a string literal.
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name)
+        : m_name(name), m_active(g_profiler_enabled.load(std::memory_order_relaxed))
+    {
+        if (m_active)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileScope()
+    {
+        if (m_active)
+            ProfilerRecord(m_name, m_start, std::chrono::steady_clock::now());
+    }
+
+private:
+    const char* m_name;
+    bool m_active;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, amount) do { if (g_profiler_enabled.load(std::memory_order_relaxed)) ProfilerCount(counter, amount); } while (0)
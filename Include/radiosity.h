@@ -0,0 +1,411 @@
+#pragma once
+
+// Radiosity solver of the hierarchical radiosity demo. It holds the patches of
+// the scene, the normal formfactor-matrix solution and the hierarchical one,
+// and doesn't depend on any rendering state, so it is shared with the benchmark.
+
+#include <simd_math.h>
+
+// the buffers the application draws a patch with. they are only declared here, so the
+// solver builds without d3d11.h.
+struct ID3D11InputLayout;
+struct ID3D11Buffer;
+
+struct Vertex
+{
+    XMFLOAT3 position;
+    XMFLOAT3 normal;
+    XMFLOAT3 color;
+};
+
+struct Face
+{
+    int vertex_indices[4];
+    int normal_index;
+};
+
+struct OBJ_Model
+{
+    Vertex* vertices;
+    int vertex_count;
+    Face* faces;
+    int face_count;
+};
+
+struct Patch
+{
+    XMFLOAT3 vertex_pos[4];
+    XMFLOAT3 centroid;
+    XMFLOAT3 normal;
+    XMFLOAT3 radiosity;
+    XMFLOAT3 irradiance;
+    XMFLOAT3 reflectance;
+    float area;
+
+    // the axis of the normal if the patch is an axis-aligned rectangle, -1 otherwise
+    int normal_axis;
+    XMFLOAT3 box_min;
+    XMFLOAT3 box_max;
+
+    // rendering relevant members
+    ID3D11InputLayout* input_layout;
+    ID3D11Buffer* vertex_buffer;
+    ID3D11Buffer* index_buffer;
+
+    // hierarchical radiosity relevant members
+    int influencing_partner_count;
+    // the links the patch gathers from: the ids of the source patches (see PatchFromId)
+    // and the formfactors from the patch to the sources, as floats or, with
+    // solver_options.half_link_formfactors, as half floats
+    std::vector<unsigned int> link_sources;
+    std::vector<float> link_formfactors;
+    std::vector<unsigned short> link_formfactors_half;
+
+    // index of the patch in the table of all patches and subpatches
+    unsigned int id;
+
+    bool has_parent;
+    bool has_children;
+    Patch* parent;
+    Patch** children;
+
+    float4 gathered_brightness;
+    float4 brightness;
+
+    // brightness gathered over the patch's own links, without its parents
+    float4 link_brightness;
+
+    // importance per area: how much the brightness of the patch contributes to the image
+    // of the view, directly or reflected (see IterateImportance)
+    float importance;
+    float gathered_importance;
+
+    // incremental update relevant members
+    bool dirty;
+};
+
+// how the formfactor matrix is stored after its estimation (see PackFormFactors) and
+// in which precision IterateRadiosity() sums up the rows. the estimators always fill
+// the double matrix, the smaller storages only pay off in the bandwidth-bound iteration.
+enum FormFactorStorage
+{
+    FS_Double,
+    FS_Float,
+    FS_Half
+};
+
+enum AccumulatePrecision
+{
+    AP_Float,
+    AP_Double
+};
+
+// which estimator filled the formfactors. only the unoccluded patch-pair estimates of
+// EstimateFormFactor() can be redone row by row when a patch changes (see
+// UpdateDirtyPatches()): the hemicube and the ray casting include occlusion, which a
+// moved patch changes for other pairs as well, and the streamed matrix isn't in memory.
+enum FormFactorEstimator
+{
+    FE_PatchPairs,
+    FE_Hemicube,
+    FE_MonteCarlo,
+    FE_Streamed
+};
+
+// the settings every scene is solved with (see Scene::solver_options). they are set
+// before the formfactors and the links are built and not changed afterwards.
+struct SolverOptions
+{
+    FormFactorStorage formfactor_storage;
+    AccumulatePrecision accumulate_precision;
+
+    // EstimateFormFactors() estimates every unordered patch pair once and stores only the
+    // upper triangle of the area-weighted matrix A_i F_ij.
+    bool symmetric_formfactors;
+
+    // axis-aligned rectangles get exact formfactors instead of the centroid estimate.
+    bool analytic_formfactors;
+
+    // GatherAll(), PushAll() and PullAll() sweep the hierarchies stored breadth-first in
+    // per-level arrays, in quadrant-recursive order within every level, instead of recursing
+    // through the children of the patches. the arrays are rebuilt after the hierarchy has changed.
+    bool hierarchy_level_arrays;
+
+    // the links store the formfactors as half floats instead of floats.
+    bool half_link_formfactors;
+};
+
+SolverOptions DefaultSolverOptions();
+
+// how the refine-algorithm decides whether an interaction is linked or refined.
+enum RefineOracle
+{
+    RO_FormFactor,              // both formfactors below F_eps
+    RO_BrightnessFormFactor,    // both formfactors times the source brightness below BF_eps
+    RO_ImportanceBrightness     // both formfactors times the source brightness times the
+                                // importance of the receiver below IBF_eps
+};
+
+// the camera the importance of the patches is computed for, with a vertical field of
+// view in radians and the width / height ratio of the image.
+struct ImportanceView
+{
+    XMFLOAT3 eye;
+    XMFLOAT3 focus;
+    XMFLOAT3 up;
+    float fov_y;
+    float aspect;
+};
+
+struct RefineOptions
+{
+    RefineOracle oracle;
+    double F_eps;
+    double BF_eps;
+    double IBF_eps;
+
+    // the camera of the importance oracle
+    ImportanceView view;
+
+    // patches are only subdivided while their area is above min_area and above
+    // min_area_fraction times the summed area of the top-level patches.
+    float min_area;
+    float min_area_fraction;
+    int max_depth;
+
+    // once a budget is used up, interactions are linked without subdividing further.
+    // 0 means unlimited.
+    int max_links;
+    size_t max_bytes;
+
+    // every unordered pair of patches is refined once and linked in both directions
+    // from the same decision, otherwise both ordered pairs are refined on their own.
+    bool unordered_pairs;
+};
+
+RefineOptions DefaultRefineOptions();
+
+// options of the active-set iterations, which only propagate the sources whose color has
+// changed by more than the tolerance times the brightest patch since they were last
+// propagated. the gathers run on thread_count threads, 0 means all hardware threads.
+struct ActiveSetOptions
+{
+    float tolerance;
+    int thread_count;
+};
+
+// per iteration of an active-set iteration: the propagated sources, the patches that
+// gathered and the seconds the iteration took.
+struct ActiveSetStats
+{
+    std::vector<int> active_sources;
+    std::vector<int> gathered_patches;
+    std::vector<double> seconds;
+};
+
+// the patch hierarchies stored breadth-first, one set of arrays per subdivision level.
+// level 0 holds the top-level patches in the order of the scene's patches, every further
+// level the subpatches of the previous one, the four of a patch next to each other in the
+// order of its children. so every level of a quadtree lies in a quadrant-recursive order
+// like the morton order, only that the subpatches follow nw, ne, se, sw instead of the z,
+// so consecutive ones are always neighbours, which keeps the gather as fast as the
+// recursive one (in z-order it is about 10% slower). the subpatches of a patch are found
+// by their index in the next level, so the push and pull run as linear sweeps over the
+// arrays instead of recursing through the children.
+struct HierarchyLevel
+{
+    std::vector<Patch*> patches;
+    // the index of the first subpatch in the next level, -1 for leaves
+    std::vector<int> first_child;
+    // the patches of the tree below patches[t] of the scene are [tree_start[t], tree_start[t + 1])
+    std::vector<int> tree_start;
+    // the index of the first patch of the level when all levels are numbered in a row
+    int offset;
+
+    // the brightness gathered over the own links, with the brightness pushed down from
+    // the parents, and the pulled brightness
+    std::vector<float4> link_brightness;
+    std::vector<float4> gathered_brightness;
+    std::vector<float4> brightness;
+};
+
+// everything the solver knows about one scene: the model, the patches with their
+// hierarchies and links, the formfactors and the solutions. all solver functions work
+// on the scene bound to the calling thread (g_scene, see SceneScope), so several scenes
+// can be solved at the same time on different threads. a scene owns its memory and
+// releases it when it is destroyed.
+struct Scene
+{
+    Scene() = default;
+    ~Scene();
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+
+    // the room as an .obj-model
+    OBJ_Model room_model = {};
+
+    // the settings the scene is solved with, kept when the scene is released
+    SolverOptions solver_options = DefaultSolverOptions();
+
+    // the scene is solved with the formfactor matrix instead of the hierarchies
+    bool without_hierarch_radiosity = true;
+
+    Patch* patches = nullptr;
+    int patch_count = 0;
+    // number of patches the array (and the rows of the formfactors) have room for,
+    // so that single patches can be added without rebuilding everything.
+    int patch_capacity = 0;
+
+    // the formfactors are stored unnormalised with a row length of patch_capacity, the
+    // row sums are applied while iterating. the packed matrix replaces formfactors if the
+    // storage isn't FS_Double.
+    double* formfactors = nullptr;
+    double* formfactor_row_sums = nullptr;
+    float* formfactors_float = nullptr;
+    unsigned short* formfactors_half = nullptr;
+
+    // the symmetric mode of EstimateFormFactors() stores only G_ij = A_i F_ij = A_j F_ji for
+    // i < j, in rows of patch_capacity - 1 - i entries, in double or (for the float and
+    // half storage) float. the solver derives both formfactors of a pair from it.
+    double* upper_formfactors = nullptr;
+    float* upper_formfactors_float = nullptr;
+
+    // set by the formfactor estimation if its rows have to be normalised, see FormFactorRowScale().
+    bool normalise_formfactor_rows = false;
+    FormFactorEstimator formfactor_estimator = FE_PatchPairs;
+
+    // options of the refine-algorithm, set by SetRefineOptions(), and the area below which
+    // patches are not subdivided, derived from them and the scene.
+    RefineOptions refine_options = DefaultRefineOptions();
+    float min_subdiv_area = 0.3f;
+
+    // size of the current hierarchy, checked against the budgets of refine_options, and
+    // the subdivisions of the refinements since the last RefineAll().
+    int link_count = 0;
+    int subpatch_count = 0;
+    int refine_subdivisions = 0;
+
+    // every patch and subpatch by its id, so that a link only needs 32 bits for its source.
+    // the ids of deleted subpatches are reused.
+    std::vector<Patch*> patches_by_id;
+    std::vector<unsigned int> free_patch_ids;
+
+    std::vector<HierarchyLevel> hierarchy_levels;
+    // set whenever a patch is added or removed, the levels are rebuilt before the next sweep.
+    bool hierarchy_levels_stale = true;
+    int hierarchy_node_count = 0;
+
+    // the patches linked to every source, see IterateHierarchicalActive(). stale whenever
+    // links or the levels change.
+    bool source_receivers_stale = true;
+    std::vector<int> receiver_start;
+    std::vector<int> receivers;
+};
+
+// the scene of the calling thread. it is the default scene of the process unless another
+// one is bound with a SceneScope.
+extern thread_local Scene* g_scene;
+
+// binds a scene to the calling thread for the lifetime of the object. the threads the
+// solver starts bind the scene of the thread that started them.
+class SceneScope
+{
+public:
+    explicit SceneScope(Scene* scene)
+        : m_previous(g_scene)
+    {
+        g_scene = scene;
+    }
+
+    ~SceneScope()
+    {
+        g_scene = m_previous;
+    }
+
+    SceneScope(const SceneScope&) = delete;
+    SceneScope& operator=(const SceneScope&) = delete;
+
+private:
+    Scene* m_previous;
+};
+
+// scene setup
+void LoadModel(std::string path);
+Patch InitPatch(XMFLOAT3 pos[4], XMFLOAT3 irradiance);
+void CreatePatches(int emitter_face);
+void SplitPatches(int factor);
+void SetIrradiance(Patch& p, XMFLOAT3 irradiance);
+void ReleaseScene();
+
+// normal radiosity method
+double EstimateFormFactor(Patch& p, Patch& q);
+void EstimateFormFactors();
+void PackFormFactors();
+void ReleaseFormFactors();
+bool HasFormFactors();
+double GetFormFactor(int i, int j);
+void SetFormFactor(int i, int j, double ff);
+const float* GetFormFactorRow(int i, float* buffer);
+const char* GetFormFactorStorageName(FormFactorStorage storage);
+const char* GetAccumulatePrecisionName(AccumulatePrecision precision);
+void GetRadiosity(int patch_index, XMFLOAT3& color);
+double FormFactorRowScale(int i);
+void IterateRadiosity(int iterations);
+ActiveSetOptions DefaultActiveSetOptions();
+void IterateRadiosityActive(int iterations, const ActiveSetOptions& options, ActiveSetStats& stats);
+
+// this sums up a row of formfactors times the colors in the precision of Accumulator.
+// the rows come from the matrix in memory or, streamed, from the file.
+template<typename Stored, typename Accumulator>
+void MultiplyRow(const Stored* row, const Accumulator* red, const Accumulator* green, const Accumulator* blue, Accumulator sum[3])
+{
+    Accumulator r = 0, g = 0, b = 0;
+    for (int j = 0; j < g_scene->patch_count; j++)
+    {
+        Accumulator ff = (Accumulator)row[j];
+        r += ff * red[j];
+        g += ff * green[j];
+        b += ff * blue[j];
+    }
+    sum[0] = r;
+    sum[1] = g;
+    sum[2] = b;
+}
+
+// hierarchical radiosity method
+void SetRefineOptions(const RefineOptions& options);
+int Refine(Patch& p, Patch& q);
+int RefinePair(Patch& p, Patch& q);
+void Subdivide(Patch& p);
+void Link(Patch& p, Patch& q, double ff_ptoq);
+int RefineAll(const RefineOptions& options);
+int RefineLinks(const RefineOptions& options);
+ImportanceView DefaultImportanceView();
+float DirectImportance(Patch& p, const ImportanceView& view);
+void IterateImportance(int iterations);
+float4 GetBrightness(Patch& p);
+void GetBrightness(Patch& p, XMFLOAT3& color);
+void GatherAll();
+void PushAll();
+void PullAll();
+void IterateHierarchicalRadiosity(int iterations);
+void IterateHierarchicalActive(int iterations, const ActiveSetOptions& options, ActiveSetStats& stats);
+void IterateLevelOrderedRadiosity(int cycles);
+void ResetHierarchicalSolution();
+void DeleteChildren(Patch& p);
+Patch& PatchFromId(unsigned int id);
+void CompactLinks();
+
+// results and statistics
+void GetPatchColor(int patch_index, XMFLOAT3& color);
+void CountHierarchy(Patch& p, int& subpatches, int& links);
+size_t EstimateSolverMemory();
+size_t LinkBytes();
+size_t LinkStoreBytes();
+
+// incremental updates
+void MarkPatchDirty(int patch_index);
+void MovePatch(int patch_index, XMFLOAT3 pos[4]);
+int AddPatch(XMFLOAT3 pos[4], XMFLOAT3 irradiance);
+bool UpdateDirtyPatches();
+bool ResolveDirtyPatches(int iterations);
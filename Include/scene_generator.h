@@ -0,0 +1,29 @@
+#pragma once
+
+// Generator for synthetic test scenes. It fills g_scene->room_model with a tiled,
+// axis-aligned room, so that generated scenes go through the same pipeline
+// as the loaded .obj-model.
+
+struct RoomDescription
+{
+    float width;
+    float height;
+    float depth;
+
+    // every wall is split into tiles x tiles faces
+    int tiles;
+
+    // boxes standing on the floor, each side split into occluder_tiles x occluder_tiles faces
+    int occluder_count;
+    int occluder_tiles;
+
+    // places the boxes
+    unsigned int seed;
+};
+
+// returns a room of roughly patch_count faces with occluder_count boxes in it.
+RoomDescription RoomForPatchCount(int patch_count, int occluder_count);
+
+// fills g_scene->room_model with the described room and returns the index of the
+// emitting face, which is the center tile of the ceiling.
+int GenerateRoom(const RoomDescription& room);
@@ -0,0 +1,226 @@
+#pragma once
+
+// Small float4 math layer of the solver. Colors stay in one SSE2 register while
+// they are gathered, pushed and pulled, instead of being split into scalar floats
+// through XMVECTOR::m128_f32, which only MSVC has. Without SSE2 the same functions
+// fall back to plain floats. Loops over many colors go through the dispatched
+// kernels at the end of the file, which use 8-wide AVX2 registers when the CPU
+// supports them.
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define RADIOSITY_SSE2
+#include <emmintrin.h>
+#endif
+
+struct float4
+{
+#ifdef RADIOSITY_SSE2
+    __m128 v;
+#else
+    float v[4];
+#endif
+};
+
+inline float4 Float4Set(float x, float y, float z, float w)
+{
+    float4 r;
+#ifdef RADIOSITY_SSE2
+    r.v = _mm_set_ps(w, z, y, x);
+#else
+    r.v[0] = x; r.v[1] = y; r.v[2] = z; r.v[3] = w;
+#endif
+    return r;
+}
+
+inline float4 Float4Zero()
+{
+    float4 r;
+#ifdef RADIOSITY_SSE2
+    r.v = _mm_setzero_ps();
+#else
+    r.v[0] = r.v[1] = r.v[2] = r.v[3] = 0.0f;
+#endif
+    return r;
+}
+
+inline float4 Float4Replicate(float s)
+{
+    float4 r;
+#ifdef RADIOSITY_SSE2
+    r.v = _mm_set1_ps(s);
+#else
+    r.v[0] = r.v[1] = r.v[2] = r.v[3] = s;
+#endif
+    return r;
+}
+
+// loads in[0..3].
+inline float4 Float4Load(const float* in)
+{
+    float4 r;
+#ifdef RADIOSITY_SSE2
+    r.v = _mm_loadu_ps(in);
+#else
+    r.v[0] = in[0]; r.v[1] = in[1]; r.v[2] = in[2]; r.v[3] = in[3];
+#endif
+    return r;
+}
+
+inline float4 Float4Load3(const DirectX::XMFLOAT3& f)
+{
+    return Float4Set(f.x, f.y, f.z, 0.0f);
+}
+
+// stores the four components into out[0..3].
+inline void Float4Store(float* out, float4 a)
+{
+#ifdef RADIOSITY_SSE2
+    _mm_storeu_ps(out, a.v);
+#else
+    out[0] = a.v[0]; out[1] = a.v[1]; out[2] = a.v[2]; out[3] = a.v[3];
+#endif
+}
+
+inline void Float4Store3(DirectX::XMFLOAT3& f, float4 a)
+{
+    float components[4];
+    Float4Store(components, a);
+    f = { components[0], components[1], components[2] };
+}
+
+inline float4 Float4Add(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    a.v = _mm_add_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) a.v[i] += b.v[i];
+#endif
+    return a;
+}
+
+inline float4 Float4Subtract(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    a.v = _mm_sub_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) a.v[i] -= b.v[i];
+#endif
+    return a;
+}
+
+// the componentwise product.
+inline float4 Float4Multiply(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    a.v = _mm_mul_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) a.v[i] *= b.v[i];
+#endif
+    return a;
+}
+
+inline float4 Float4Divide(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    a.v = _mm_div_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) a.v[i] /= b.v[i];
+#endif
+    return a;
+}
+
+// a * b + c, componentwise.
+inline float4 Float4MultiplyAdd(float4 a, float4 b, float4 c)
+{
+    return Float4Add(Float4Multiply(a, b), c);
+}
+
+inline float4 Float4Scale(float4 a, float s)
+{
+    return Float4Multiply(a, Float4Replicate(s));
+}
+
+inline float4 Float4Max(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    a.v = _mm_max_ps(a.v, b.v);
+#else
+    for (int i = 0; i < 4; i++) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+#endif
+    return a;
+}
+
+// returns a bit per component, set where a >= b, like _mm_movemask_ps.
+inline int Float4GreaterOrEqualMask(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    return _mm_movemask_ps(_mm_cmpge_ps(a.v, b.v));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] >= b.v[i]) << i;
+    return mask;
+#endif
+}
+
+// returns a bit per component, set where a > b.
+inline int Float4GreaterMask(float4 a, float4 b)
+{
+#ifdef RADIOSITY_SSE2
+    return _mm_movemask_ps(_mm_cmpgt_ps(a.v, b.v));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) mask |= (a.v[i] > b.v[i]) << i;
+    return mask;
+#endif
+}
+
+// the sum of all four components.
+inline float Float4Sum(float4 a)
+{
+    float components[4];
+    Float4Store(components, a);
+    return (components[0] + components[1]) + (components[2] + components[3]);
+}
+
+inline float Float4GetX(float4 a)
+{
+#ifdef RADIOSITY_SSE2
+    return _mm_cvtss_f32(a.v);
+#else
+    return a.v[0];
+#endif
+}
+
+// the largest of the first three components.
+inline float Float4MaxComponent3(float4 a)
+{
+    float components[4];
+    Float4Store(components, a);
+    float m = components[0] > components[1] ? components[0] : components[1];
+    return m > components[2] ? m : components[2];
+}
+
+// runtime dispatched kernels over arrays of colors.
+enum SimdLevel
+{
+    SIMD_Scalar,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+// the best level the CPU and the build support, and the level the kernels use.
+SimdLevel GetSupportedSimdLevel();
+SimdLevel GetSimdLevel();
+// selects the kernels of a level, limited to the supported one. returns the selected level.
+SimdLevel SetSimdLevel(SimdLevel level);
+const char* GetSimdLevelName(SimdLevel level);
+
+// returns the sum of weights[i] * colors[i] over count colors.
+float4 WeightedSum(const float4* colors, const float* weights, int count);
+
+// sums weights[i] times the i-th of count spectra of stride floats each into sum[0..stride).
+// the stride has to be a multiple of 4, up to 32 floats have specialised kernels.
+void WeightedSumBands(float* sum, const float* spectra, const float* weights, int count, int stride);
+
+// converts count half floats (like PackedVector::HALF) into floats.
+void HalfToFloat(float* out, const unsigned short* in, int count);
@@ -0,0 +1,52 @@
+#pragma once
+
+// Spectral radiosity. The formfactors only depend on the geometry, so the matrix of
+// the normal radiosity method solves any number of color channels. Here the channels
+// are Bands spectral bands spread evenly over 400-700 nm, a compile-time parameter
+// which is instantiated for 3, 4, 8 and 16 bands. The spectra are padded to a multiple
+// of 4 floats and the rows are summed up by WeightedSumBands(), so 8 bands fill an
+// AVX2 register and 16 bands two.
+
+template<int Bands>
+struct Spectrum
+{
+    static const int Stride = (Bands + 3) / 4 * 4;
+    float band[Stride];
+};
+
+// the spectra of all patches, indexed like g_scene->patches.
+template<int Bands>
+struct SpectralScene
+{
+    std::vector<Spectrum<Bands>> irradiance;
+    std::vector<Spectrum<Bands>> reflectance;
+
+    // the incoming radiosity like Patch::radiosity
+    std::vector<Spectrum<Bands>> radiosity;
+};
+
+// the rgb channel (0 red, 1 green, 2 blue) a band is shown in, by its center wavelength.
+int BandChannel(int band, int bands);
+
+// creates the spectra of the patches from their rgb colors, each band taking the value
+// of its channel. scenes with measured spectra can overwrite them afterwards.
+template<int Bands>
+void InitSpectralScene(SpectralScene<Bands>& scene);
+
+// iterates like IterateRadiosity() over the current formfactor matrix.
+template<int Bands>
+void IterateSpectralRadiosity(SpectralScene<Bands>& scene, int iterations);
+
+// the displayed color of a patch like GetRadiosity(), the bands averaged per channel.
+template<int Bands>
+void GetSpectralColor(const SpectralScene<Bands>& scene, int patch_index, XMFLOAT3& color);
+
+#define DECLARE_SPECTRAL_BANDS(Bands) \
+    extern template void InitSpectralScene<Bands>(SpectralScene<Bands>& scene); \
+    extern template void IterateSpectralRadiosity<Bands>(SpectralScene<Bands>& scene, int iterations); \
+    extern template void GetSpectralColor<Bands>(const SpectralScene<Bands>& scene, int patch_index, XMFLOAT3& color);
+
+DECLARE_SPECTRAL_BANDS(3)
+DECLARE_SPECTRAL_BANDS(4)
+DECLARE_SPECTRAL_BANDS(8)
+DECLARE_SPECTRAL_BANDS(16)
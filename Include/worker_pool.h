@@ -0,0 +1,44 @@
+#pragma once
+
+// A fixed set of worker threads for the solvers which split every iteration over
+// threads. The threads are started once per solve and wait between the iterations, so
+// an iteration doesn't pay for creating and joining them. Every run binds the scene of
+// the calling thread on the workers (see SceneScope).
+
+#include <condition_variable>
+#include <functional>
+
+struct Scene;
+
+class WorkerPool
+{
+public:
+    // 0 means one thread per hardware thread. the calling thread counts as the first one.
+    explicit WorkerPool(int thread_count);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    int GetThreadCount() const { return m_thread_count; }
+
+    // runs work(thread) once for every thread index, 0 on the calling thread, and
+    // returns when all of them are done.
+    void Run(const std::function<void(int)>& work);
+
+private:
+    void WorkerLoop(int thread);
+
+    int m_thread_count;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+
+    // the current run: its work, the scene of the caller, a generation counting the
+    // runs and the workers still busy with it
+    const std::function<void(int)>* m_work;
+    Scene* m_scene;
+    unsigned long long m_generation;
+    int m_running;
+    bool m_closed;
+};
@@ -0,0 +1,481 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <scene_generator.h>
+#include <accuracy.h>
+#include <montecarlo.h>
+
+using namespace DirectX;
+
+// Reference accuracy harness. The scene is first solved with the formfactor matrix on
+// a finer grid, every patch split into --reference-split x --reference-split patches,
+// until no patch color changes by more than the reference tolerance relative to itself,
+// and the fine colors are averaged over the area of every patch. So the reference
+// doesn't share the discretisation error of the patches with the matrix runs. Then
+// every requested solver configuration solves the same scene from scratch and its
+// displayed patch colors are compared against the reference:
+//
+//   RadiosityBenchmark.exe accuracy --patches 2000 --iterations 1,5,20
+//                                   --hierarchical-iterations 1,2,4 --F-eps 0.2,0.1,0.05
+//
+// Per configuration the runtime, the estimated solver memory, the area-weighted RMS
+// error (absolute and relative to the reference) and the largest patch error are
+// written as JSON, with --per-patch the error of every patch as well.
+// --precisions repeats the matrix runs for every storage/accumulate pair of the
+// formfactor matrix, e.g. double/double,float/float,half/float. the reference is
+// always stored and accumulated in double. --symmetric runs the matrix in the
+// symmetric mode, against a full reference matrix.
+// --IBF-eps adds hierarchical runs with the importance oracle for the camera of the
+// application, which re-refine the links --importance-passes times with the solved
+// importance. every run also reports its error weighted with the share of the image
+// the patches cover (view_rms_error), i.e. the error of that still.
+// --ordered-pairs refines the hierarchical runs over both ordered pairs of patches.
+// --stochastic-rays adds runs of the stochastic solver with the given rays per patch.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct AccuracyOptions
+{
+    int patch_count = 2000;
+    int occluder_count = 0;
+    std::string obj_path;
+    double reference_tolerance = 1.0e-6;
+    int reference_split = 2;
+    int reference_max_iterations = 10000;
+    std::vector<int> matrix_iterations = { 1, 2, 5, 10, 20 };
+    std::vector<int> hierarchical_iterations = { 1, 2, 4 };
+    std::vector<double> F_eps = { 0.4, 0.2, 0.1, 0.05 };
+    std::vector<double> IBF_eps = {};
+    int importance_passes = 2;
+    std::vector<int> stochastic_rays = {};
+    std::vector<std::string> precisions = {};
+    bool per_patch = false;
+    bool ordered_pairs = false;
+    SolverOptions solver_options = DefaultSolverOptions();
+    std::string out_path;
+};
+
+struct AccuracyRun
+{
+    std::string mode;
+    std::string precision;
+    double F_eps;
+    int iterations;
+    int rays_per_patch;
+    double seconds;
+    size_t memory_bytes;
+    double rms_error;
+    double relative_rms_error;
+    double view_rms_error;
+    double max_error;
+    std::vector<double> patch_errors;
+};
+
+// loads or generates the scene and creates its patches.
+void LoadAccuracyScene(const AccuracyOptions& options, const SolverOptions& solver_options)
+{
+    g_scene->solver_options = solver_options;
+    if (!options.obj_path.empty())
+    {
+        LoadModel(options.obj_path);
+        CreatePatches(1001);
+    }
+    else
+    {
+        CreatePatches(GenerateRoom(RoomForPatchCount(options.patch_count, options.occluder_count)));
+    }
+}
+
+// returns the displayed colors of all patches.
+std::vector<XMFLOAT3> GetPatchColors()
+{
+    std::vector<XMFLOAT3> colors(g_scene->patch_count);
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        GetPatchColor(i, colors[i]);
+    }
+    return colors;
+}
+
+// returns the length of the difference of two colors.
+double ColorDistance(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+    double dx = (double)a.x - b.x;
+    double dy = (double)a.y - b.y;
+    double dz = (double)a.z - b.z;
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// solves the scene split into a finer grid with the formfactor matrix until it has
+// converged and returns the area-averaged colors of the patches of the scene.
+std::vector<XMFLOAT3> SolveReference(const AccuracyOptions& options, int& iterations, double& seconds)
+{
+    // the reference is always stored and summed up in double precision
+    SolverOptions solver_options = options.solver_options;
+    solver_options.formfactor_storage = FS_Double;
+    solver_options.accumulate_precision = AP_Double;
+    solver_options.symmetric_formfactors = false;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadAccuracyScene(options, solver_options);
+    int patch_count = g_scene->patch_count;
+    int split_count = options.reference_split * options.reference_split;
+    SplitPatches(options.reference_split);
+
+    Clock::time_point start = Clock::now();
+    EstimateFormFactors();
+
+    std::vector<XMFLOAT3> colors = GetPatchColors();
+    for (iterations = 1; iterations <= options.reference_max_iterations; iterations++)
+    {
+        IterateRadiosity(1);
+        std::vector<XMFLOAT3> next_colors = GetPatchColors();
+
+        // the change of an iteration is its residual. it is measured relative to the
+        // color of every patch, so dim patches converge as tightly as bright ones, and
+        // patches no light reaches are left out.
+        double residual = 0.0;
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            double length = ColorDistance(next_colors[i], XMFLOAT3(0.0f, 0.0f, 0.0f));
+            if (length > 0.0)
+                residual = std::max<double>(residual, ColorDistance(colors[i], next_colors[i]) / length);
+        }
+        colors = next_colors;
+
+        if (residual <= options.reference_tolerance)
+            break;
+    }
+
+    std::vector<XMFLOAT3> reference(patch_count);
+    for (int i = 0; i < patch_count; i++)
+    {
+        XMVECTOR sum = XMVectorZero();
+        double area = 0.0;
+        for (int k = i * split_count; k < (i + 1) * split_count; k++)
+        {
+            sum = XMVectorAdd(sum, XMVectorScale(XMLoadFloat3(&colors[k]), g_scene->patches[k].area));
+            area += g_scene->patches[k].area;
+        }
+        XMStoreFloat3(&reference[i], XMVectorScale(sum, (float)(1.0 / area)));
+    }
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    ReleaseScene();
+    return reference;
+}
+
+// compares the current solution against the reference.
+void MeasureError(AccuracyRun& run, const std::vector<XMFLOAT3>& reference, bool per_patch)
+{
+    double weighted_error = 0.0;
+    double weighted_reference = 0.0;
+    double area = 0.0;
+    double view_error = 0.0;
+    double view_reference = 0.0;
+    ImportanceView view = DefaultImportanceView();
+    run.max_error = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        XMFLOAT3 color;
+        GetPatchColor(i, color);
+
+        double error = ColorDistance(color, reference[i]);
+        double reference_length = ColorDistance(reference[i], XMFLOAT3(0.0f, 0.0f, 0.0f));
+        weighted_error += g_scene->patches[i].area * error * error;
+        weighted_reference += g_scene->patches[i].area * reference_length * reference_length;
+        area += g_scene->patches[i].area;
+        double visible = DirectImportance(g_scene->patches[i], view);
+        view_error += visible * error * error;
+        view_reference += visible * reference_length * reference_length;
+        run.max_error = std::max<double>(run.max_error, error);
+
+        if (per_patch)
+            run.patch_errors.push_back(error);
+    }
+
+    run.rms_error = std::sqrt(weighted_error / area);
+    run.relative_rms_error = weighted_reference > 0.0 ? std::sqrt(weighted_error / weighted_reference) : 0.0;
+    run.view_rms_error = view_reference > 0.0 ? std::sqrt(view_error / view_reference) : 0.0;
+}
+
+AccuracyRun RunMatrixAccuracy(const AccuracyOptions& options, const SolverOptions& solver_options, const std::vector<XMFLOAT3>& reference, int iterations)
+{
+    AccuracyRun run = {};
+    run.mode = "matrix";
+    run.precision = std::string(GetFormFactorStorageName(solver_options.formfactor_storage)) + "/" + GetAccumulatePrecisionName(solver_options.accumulate_precision);
+    if (solver_options.symmetric_formfactors)
+        run.precision += " symmetric";
+    run.iterations = iterations;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadAccuracyScene(options, solver_options);
+
+    Clock::time_point start = Clock::now();
+    EstimateFormFactors();
+    IterateRadiosity(iterations);
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    run.memory_bytes = EstimateSolverMemory();
+
+    MeasureError(run, reference, options.per_patch);
+    ReleaseScene();
+    return run;
+}
+
+AccuracyRun RunHierarchicalAccuracy(const AccuracyOptions& options, const std::vector<XMFLOAT3>& reference, double F_eps, int iterations)
+{
+    AccuracyRun run = {};
+    run.mode = "hierarchical";
+    run.F_eps = F_eps;
+    run.iterations = iterations;
+
+    g_scene->without_hierarch_radiosity = false;
+    LoadAccuracyScene(options, options.solver_options);
+
+    Clock::time_point start = Clock::now();
+    RefineOptions refine_options = DefaultRefineOptions();
+    refine_options.F_eps = F_eps;
+    refine_options.unordered_pairs = !options.ordered_pairs;
+    RefineAll(refine_options);
+    IterateHierarchicalRadiosity(iterations);
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    run.memory_bytes = EstimateSolverMemory();
+
+    MeasureError(run, reference, options.per_patch);
+    ReleaseScene();
+    return run;
+}
+
+AccuracyRun RunImportanceAccuracy(const AccuracyOptions& options, const std::vector<XMFLOAT3>& reference, double IBF_eps, int iterations)
+{
+    AccuracyRun run = {};
+    run.mode = "importance";
+    run.F_eps = IBF_eps;
+    run.iterations = iterations;
+
+    g_scene->without_hierarch_radiosity = false;
+    LoadAccuracyScene(options, options.solver_options);
+
+    Clock::time_point start = Clock::now();
+    RefineOptions refine_options = DefaultRefineOptions();
+    refine_options.oracle = RO_ImportanceBrightness;
+    refine_options.IBF_eps = IBF_eps;
+    refine_options.unordered_pairs = !options.ordered_pairs;
+    RefineAll(refine_options);
+    IterateHierarchicalRadiosity(iterations);
+    for (int pass = 0; pass < options.importance_passes; pass++)
+    {
+        IterateImportance(4);
+        RefineLinks(refine_options);
+        IterateHierarchicalRadiosity(iterations);
+    }
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    run.memory_bytes = EstimateSolverMemory();
+
+    MeasureError(run, reference, options.per_patch);
+    ReleaseScene();
+    return run;
+}
+
+AccuracyRun RunStochasticAccuracy(const AccuracyOptions& options, const std::vector<XMFLOAT3>& reference, int rays_per_patch)
+{
+    AccuracyRun run = {};
+    run.mode = "stochastic";
+    run.rays_per_patch = rays_per_patch;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadAccuracyScene(options, options.solver_options);
+
+    Clock::time_point start = Clock::now();
+    StochasticOptions stochastic_options = DefaultStochasticOptions();
+    stochastic_options.rays_per_patch = rays_per_patch;
+    run.iterations = SolveStochasticRadiosity(stochastic_options);
+    run.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    run.memory_bytes = EstimateSolverMemory();
+
+    MeasureError(run, reference, options.per_patch);
+    ReleaseScene();
+    return run;
+}
+
+void WriteAccuracyJSON(std::ostream& out, const AccuracyOptions& options, int patch_count, int reference_iterations, double reference_seconds, const std::vector<AccuracyRun>& runs)
+{
+    out << std::setprecision(9);
+    out << "{\n  \"harness\": \"accuracy\",\n";
+    out << "  \"patches\": " << patch_count << ",\n";
+    out << "  \"reference\": { \"mode\": \"matrix\", \"split\": " << options.reference_split << ", \"tolerance\": " << options.reference_tolerance
+        << ", \"iterations\": " << reference_iterations << ", \"seconds\": " << reference_seconds << " },\n";
+    out << "  \"runs\": [\n";
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        const AccuracyRun& run = runs[r];
+        out << "    { \"mode\": \"" << run.mode << "\"";
+        if (run.mode == "matrix")
+            out << ", \"precision\": \"" << run.precision << "\"";
+        if (run.mode == "hierarchical")
+            out << ", \"F_eps\": " << run.F_eps;
+        if (run.mode == "importance")
+            out << ", \"IBF_eps\": " << run.F_eps;
+        if (run.mode == "stochastic")
+            out << ", \"rays_per_patch\": " << run.rays_per_patch;
+        out << ", \"iterations\": " << run.iterations
+            << ", \"seconds\": " << run.seconds
+            << ", \"memory_bytes\": " << run.memory_bytes
+            << ", \"rms_error\": " << run.rms_error
+            << ", \"relative_rms_error\": " << run.relative_rms_error
+            << ", \"view_rms_error\": " << run.view_rms_error
+            << ", \"max_error\": " << run.max_error;
+        if (options.per_patch)
+        {
+            out << ",\n      \"patch_errors\": [";
+            for (size_t i = 0; i < run.patch_errors.size(); i++)
+            {
+                out << (i == 0 ? "" : ", ") << run.patch_errors[i];
+            }
+            out << "]";
+        }
+        out << " }" << (r + 1 < runs.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// parses a comma separated list of numbers.
+template<typename T>
+std::vector<T> ParseList(const std::string& list)
+{
+    std::vector<T> values;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        values.push_back((T)std::atof(item.c_str()));
+    }
+    return values;
+}
+
+int AccuracyMain(int argc, char* argv[])
+{
+    AccuracyOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--patches" && has_value)
+            options.patch_count = std::atoi(argv[++i]);
+        else if (arg == "--occluders" && has_value)
+            options.occluder_count = std::atoi(argv[++i]);
+        else if (arg == "--obj" && has_value)
+            options.obj_path = argv[++i];
+        else if (arg == "--reference-tolerance" && has_value)
+            options.reference_tolerance = std::atof(argv[++i]);
+        else if (arg == "--reference-split" && has_value)
+            options.reference_split = std::max<int>(1, std::atoi(argv[++i]));
+        else if (arg == "--iterations" && has_value)
+            options.matrix_iterations = ParseList<int>(argv[++i]);
+        else if (arg == "--hierarchical-iterations" && has_value)
+            options.hierarchical_iterations = ParseList<int>(argv[++i]);
+        else if (arg == "--F-eps" && has_value)
+            options.F_eps = ParseList<double>(argv[++i]);
+        else if (arg == "--IBF-eps" && has_value)
+            options.IBF_eps = ParseList<double>(argv[++i]);
+        else if (arg == "--importance-passes" && has_value)
+            options.importance_passes = std::atoi(argv[++i]);
+        else if (arg == "--stochastic-rays" && has_value)
+            options.stochastic_rays = ParseList<int>(argv[++i]);
+        else if (arg == "--precisions" && has_value)
+        {
+            std::stringstream stream(argv[++i]);
+            std::string item;
+            while (std::getline(stream, item, ','))
+            {
+                options.precisions.push_back(item);
+            }
+        }
+        else if (arg == "--per-patch")
+            options.per_patch = true;
+        else if (arg == "--symmetric")
+            options.solver_options.symmetric_formfactors = true;
+        else if (arg == "--half-links")
+            options.solver_options.half_link_formfactors = true;
+        else if (arg == "--ordered-pairs")
+            options.ordered_pairs = true;
+        else if (arg == "--centroid-formfactors")
+            options.solver_options.analytic_formfactors = false;
+        else if (arg == "--out" && has_value)
+            options.out_path = argv[++i];
+        else
+        {
+            std::cerr << "usage: RadiosityBenchmark accuracy [--patches n] [--occluders n] [--obj path]\n"
+                         "                                   [--reference-tolerance t] [--reference-split n]\n"
+                         "                                   [--iterations n1,n2,...]\n"
+                         "                                   [--hierarchical-iterations n1,n2,...] [--F-eps e1,e2,...]\n"
+                         "                                   [--IBF-eps e1,e2,...] [--importance-passes n]\n"
+                         "                                   [--stochastic-rays n1,n2,...] [--per-patch]\n"
+                         "                                   [--precisions storage/accumulate,...]\n"
+                         "                                   [--centroid-formfactors] [--half-links] [--symmetric]\n"
+                         "                                   [--ordered-pairs] [--out file]\n";
+            return -1;
+        }
+    }
+
+    int reference_iterations;
+    double reference_seconds;
+    std::vector<XMFLOAT3> reference = SolveReference(options, reference_iterations, reference_seconds);
+    std::cerr << "reference converged after " << reference_iterations << " iterations.\n";
+
+    std::vector<AccuracyRun> runs;
+    std::vector<std::string> precisions = options.precisions;
+    if (precisions.empty())
+        precisions.push_back("");
+    for (const std::string& precision : precisions)
+    {
+        SolverOptions solver_options = options.solver_options;
+        if (!precision.empty())
+        {
+            std::string storage = precision.substr(0, precision.find('/'));
+            solver_options.formfactor_storage = storage == "half" ? FS_Half : storage == "float" ? FS_Float : FS_Double;
+            solver_options.accumulate_precision = precision.find("/double") != std::string::npos ? AP_Double : AP_Float;
+        }
+        for (int iterations : options.matrix_iterations)
+        {
+            runs.push_back(RunMatrixAccuracy(options, solver_options, reference, iterations));
+        }
+    }
+    for (double F_eps : options.F_eps)
+    {
+        for (int iterations : options.hierarchical_iterations)
+        {
+            runs.push_back(RunHierarchicalAccuracy(options, reference, F_eps, iterations));
+            std::cerr << "hierarchical F_eps " << F_eps << ", " << iterations << " iterations done.\n";
+        }
+    }
+    for (double IBF_eps : options.IBF_eps)
+    {
+        for (int iterations : options.hierarchical_iterations)
+        {
+            runs.push_back(RunImportanceAccuracy(options, reference, IBF_eps, iterations));
+            std::cerr << "importance IBF_eps " << IBF_eps << ", " << iterations << " iterations done.\n";
+        }
+    }
+    for (int rays_per_patch : options.stochastic_rays)
+    {
+        runs.push_back(RunStochasticAccuracy(options, reference, rays_per_patch));
+        std::cerr << "stochastic " << rays_per_patch << " rays per patch done.\n";
+    }
+
+    if (options.out_path.empty())
+    {
+        WriteAccuracyJSON(std::cout, options, (int)reference.size(), reference_iterations, reference_seconds, runs);
+    }
+    else
+    {
+        std::ofstream out(options.out_path);
+        if (!out.is_open())
+        {
+            std::cerr << "could not open " << options.out_path << "\n";
+            return -1;
+        }
+        WriteAccuracyJSON(out, options, (int)reference.size(), reference_iterations, reference_seconds, runs);
+    }
+
+    return 0;
+}
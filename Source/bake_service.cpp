@@ -0,0 +1,563 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <scene_generator.h>
+#include <bake_service.h>
+#include <profiler.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+
+using namespace DirectX;
+
+// Bake service. Every line of stdin is one command:
+//
+//   bake id=hall scene=room:2000:4 method=hierarchical F_eps=0.1 iterations=10
+//        light=12:200,170,150 light=40:0,0,80
+//   stats
+//   quit
+//
+// scene is room:patches[:occluders] for a generated room or obj:path for a model, whose
+// face 1001 emits like in the application. method is matrix (the formfactor matrix) or
+// hierarchical (links refined with the formfactor oracle and F_eps, which don't depend on
+// the lighting either). without light= the emitters of the scene keep their irradiance,
+// otherwise only the listed patches emit. the result carries the displayed color of
+// every patch unless colors=0, whether the scene came from the cache and the seconds
+// the job waited for its scene, built it and solved it.
+//
+// the jobs are run by --threads workers in the order they arrive. a scene is used by one
+// job at a time, the jobs on the same scene wait for each other. the cache keeps up to
+// --cache-scenes scenes and --cache-mb megabytes of solver memory and evicts the least
+// recently used scene beyond that, the one used last always stays. matrix scenes with
+// more than --max-pairs patch pairs are rejected, and a job that fails with an exception
+// gets an error line and drops its scene. the whole service can be tested with a pipe:
+//
+//   printf 'bake id=a scene=room:2000\nbake id=b scene=room:2000 light=5:90,90,90\n' |
+//       RadiosityBenchmark.exe bake --threads 4
+
+typedef std::chrono::steady_clock Clock;
+
+struct BakeOptions
+{
+    int thread_count = 0;
+    int cache_scenes = 8;
+    size_t cache_bytes = (size_t)1024 << 20;
+
+    // matrix scenes with more patch pairs than this are rejected instead of allocating
+    // their formfactor matrix
+    double max_pairs = 4.0e8;
+
+    // the settings every scene is solved with
+    SolverOptions solver_options = DefaultSolverOptions();
+};
+
+struct BakeLight
+{
+    int patch_index;
+    XMFLOAT3 irradiance;
+};
+
+struct BakeJob
+{
+    std::string id;
+    std::string scene;
+    bool hierarchical = false;
+    double F_eps = 0.1;
+    int iterations = 10;
+    std::vector<BakeLight> lights;
+    bool colors = true;
+};
+
+// a resident scene with its formfactors or links, and the irradiance it was created with.
+// a missed scene is added while it is built, busy, so that jobs on it wait for it.
+struct CachedScene
+{
+    std::string key;
+    std::unique_ptr<Scene> scene;
+    std::vector<XMFLOAT3> irradiance;
+    bool busy;
+    size_t bytes;
+};
+
+struct BakeCache
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    // the most recently used scene first
+    std::list<CachedScene> scenes;
+    size_t bytes = 0;
+    int hits = 0;
+    int misses = 0;
+    int evictions = 0;
+};
+
+struct BakeQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<BakeJob> jobs;
+    bool closed = false;
+};
+
+// the results are written by all workers, one line at a time.
+std::mutex g_bake_output_mutex;
+
+// the cache key of a job: jobs with the same key share their formfactors or links.
+std::string SceneKey(const BakeJob& job)
+{
+    std::ostringstream key;
+    key << job.scene << (job.hierarchical ? " hierarchical " : " matrix");
+    if (job.hierarchical)
+        key << job.F_eps;
+    return key.str();
+}
+
+// splits a string at a separator.
+std::vector<std::string> SplitBakeField(const std::string& text, char separator)
+{
+    std::vector<std::string> fields;
+    std::stringstream stream(text);
+    std::string field;
+    while (std::getline(stream, field, separator))
+    {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// parses the key=value pairs after "bake". returns false with a message for unknown keys
+// and malformed values.
+bool ParseBakeJob(std::istringstream& line, BakeJob& job, std::string& error)
+{
+    std::string token;
+    while (line >> token)
+    {
+        size_t equals = token.find('=');
+        std::string key = token.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : token.substr(equals + 1);
+        if (key == "id")
+            job.id = value;
+        else if (key == "scene")
+            job.scene = value;
+        else if (key == "method" && (value == "matrix" || value == "hierarchical"))
+            job.hierarchical = value == "hierarchical";
+        else if (key == "F_eps")
+            job.F_eps = std::atof(value.c_str());
+        else if (key == "iterations")
+            job.iterations = std::max<int>(0, std::atoi(value.c_str()));
+        else if (key == "colors")
+            job.colors = value != "0";
+        else if (key == "light")
+        {
+            std::vector<std::string> fields = SplitBakeField(value, ':');
+            std::vector<std::string> color = fields.size() == 2 ? SplitBakeField(fields[1], ',') : std::vector<std::string>();
+            if (color.size() != 3)
+            {
+                error = "light has to be patch:r,g,b";
+                return false;
+            }
+            BakeLight light;
+            light.patch_index = std::atoi(fields[0].c_str());
+            light.irradiance = XMFLOAT3((float)std::atof(color[0].c_str()), (float)std::atof(color[1].c_str()), (float)std::atof(color[2].c_str()));
+            job.lights.push_back(light);
+        }
+        else
+        {
+            error = "unknown argument " + token;
+            return false;
+        }
+    }
+    if (job.scene.empty())
+    {
+        error = "no scene";
+        return false;
+    }
+    return true;
+}
+
+// loads or generates the scene of a job into the bound scene and estimates the
+// formfactors or refines the links all jobs on it share.
+bool BuildBakeScene(const BakeJob& job, const BakeOptions& options, std::string& error)
+{
+    g_scene->solver_options = options.solver_options;
+    int emitter_face;
+    if (job.scene.compare(0, 4, "obj:") == 0)
+    {
+        std::string path = job.scene.substr(4);
+        if (!std::ifstream(path).is_open())
+        {
+            error = "can't open " + path;
+            return false;
+        }
+        LoadModel(path);
+        emitter_face = 1001;
+    }
+    else if (job.scene.compare(0, 5, "room:") == 0)
+    {
+        std::vector<std::string> fields = SplitBakeField(job.scene.substr(5), ':');
+        int patch_count = fields.empty() ? 0 : std::atoi(fields[0].c_str());
+        int occluder_count = fields.size() > 1 ? std::atoi(fields[1].c_str()) : 0;
+        if (patch_count <= 0)
+        {
+            error = "room needs a patch count";
+            return false;
+        }
+        emitter_face = GenerateRoom(RoomForPatchCount(patch_count, occluder_count));
+    }
+    else
+    {
+        error = "unknown scene " + job.scene;
+        return false;
+    }
+
+    g_scene->without_hierarch_radiosity = !job.hierarchical;
+    CreatePatches(emitter_face);
+    if (!job.hierarchical && (double)g_scene->patch_capacity * g_scene->patch_capacity > options.max_pairs)
+    {
+        error = "the formfactor matrix of " + std::to_string(g_scene->patch_capacity) + " patches exceeds --max-pairs";
+        return false;
+    }
+
+    if (job.hierarchical)
+    {
+        RefineOptions refine_options = DefaultRefineOptions();
+        refine_options.F_eps = job.F_eps;
+        RefineAll(refine_options);
+    }
+    else
+        EstimateFormFactors();
+    return true;
+}
+
+// takes the cached scene of a key, waiting while another job uses it. a scene that
+// isn't cached is added empty and busy and has to be built by the caller.
+std::list<CachedScene>::iterator AcquireScene(BakeCache& cache, const std::string& key, bool& miss)
+{
+    std::unique_lock<std::mutex> lock(cache.mutex);
+    for (;;)
+    {
+        std::list<CachedScene>::iterator cached = cache.scenes.begin();
+        while (cached != cache.scenes.end() && cached->key != key)
+        {
+            ++cached;
+        }
+
+        if (cached == cache.scenes.end())
+        {
+            CachedScene added;
+            added.key = key;
+            added.scene.reset(new Scene());
+            added.busy = true;
+            added.bytes = 0;
+            cache.scenes.push_front(std::move(added));
+            cache.misses++;
+            miss = true;
+            return cache.scenes.begin();
+        }
+        if (!cached->busy)
+        {
+            cached->busy = true;
+            cache.scenes.splice(cache.scenes.begin(), cache.scenes, cached);
+            cache.hits++;
+            miss = false;
+            return cached;
+        }
+        cache.changed.wait(lock);
+    }
+}
+
+// hands a scene back to the cache with its solver memory, or drops it if it couldn't be
+// built, and evicts the least recently used scenes which aren't in use beyond the limits.
+void ReturnScene(BakeCache& cache, std::list<CachedScene>::iterator cached, bool keep, size_t bytes, const BakeOptions& options)
+{
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cached->busy = false;
+    cached->bytes = bytes;
+    if (!keep)
+        cache.scenes.erase(cached);
+
+    cache.bytes = 0;
+    for (const CachedScene& scene : cache.scenes)
+    {
+        cache.bytes += scene.bytes;
+    }
+
+    while ((int)cache.scenes.size() > options.cache_scenes || cache.bytes > options.cache_bytes)
+    {
+        std::list<CachedScene>::iterator victim = cache.scenes.end();
+        for (std::list<CachedScene>::iterator it = std::next(cache.scenes.begin()); it != cache.scenes.end(); ++it)
+        {
+            if (!it->busy)
+                victim = it;
+        }
+        if (victim == cache.scenes.end())
+            break;
+
+        cache.bytes -= victim->bytes;
+        cache.scenes.erase(victim);
+        cache.evictions++;
+    }
+    cache.changed.notify_all();
+}
+
+// lights the bound scene like the job, solves it and returns the displayed colors.
+bool SolveBakeJob(const BakeJob& job, const CachedScene& cached, std::vector<XMFLOAT3>& colors, std::string& error)
+{
+    for (const BakeLight& light : job.lights)
+    {
+        if (light.patch_index < 0 || light.patch_index >= g_scene->patch_count)
+        {
+            error = "no patch " + std::to_string(light.patch_index);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        SetIrradiance(g_scene->patches[i], job.lights.empty() ? cached.irradiance[i] : XMFLOAT3(0.0f, 0.0f, 0.0f));
+    }
+    for (const BakeLight& light : job.lights)
+    {
+        SetIrradiance(g_scene->patches[light.patch_index], light.irradiance);
+    }
+
+    if (job.hierarchical)
+    {
+        ResetHierarchicalSolution();
+        IterateHierarchicalRadiosity(job.iterations);
+    }
+    else
+    {
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            g_scene->patches[i].radiosity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        }
+        IterateRadiosity(job.iterations);
+    }
+
+    colors.resize(g_scene->patch_count);
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        GetPatchColor(i, colors[i]);
+    }
+    return true;
+}
+
+// writes a string as a JSON string literal.
+void WriteBakeString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if ((unsigned char)c < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+// writes one line to stdout, whole.
+void WriteBakeLine(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(g_bake_output_mutex);
+    std::cout << line << std::endl;
+}
+
+void WriteBakeError(const std::string& id, const std::string& error)
+{
+    std::ostringstream out;
+    out << "{ \"id\": ";
+    WriteBakeString(out, id);
+    out << ", \"status\": \"error\", \"message\": ";
+    WriteBakeString(out, error);
+    out << " }";
+    WriteBakeLine(out.str());
+}
+
+// runs a job on its cached scene, building the scene first if it isn't cached.
+void RunBakeJob(const BakeJob& job, BakeCache& cache, const BakeOptions& options)
+{
+    PROFILE_SCOPE("bake_job");
+
+    Clock::time_point start = Clock::now();
+    bool miss;
+    std::list<CachedScene>::iterator cached = AcquireScene(cache, SceneKey(job), miss);
+    double wait_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    SceneScope scope(cached->scene.get());
+    std::string error;
+    std::vector<XMFLOAT3> colors;
+    double build_seconds;
+    double solve_seconds;
+    bool solved;
+    // a job that throws, like a scene that runs out of memory, fails alone. its scene
+    // may be half built or half solved, so it is dropped from the cache.
+    try
+    {
+        start = Clock::now();
+        if (miss)
+        {
+            if (!BuildBakeScene(job, options, error))
+            {
+                ReturnScene(cache, cached, false, 0, options);
+                WriteBakeError(job.id, error);
+                return;
+            }
+            cached->irradiance.resize(g_scene->patch_count);
+            for (int i = 0; i < g_scene->patch_count; i++)
+            {
+                cached->irradiance[i] = g_scene->patches[i].irradiance;
+            }
+        }
+        build_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        start = Clock::now();
+        solved = SolveBakeJob(job, *cached, colors, error);
+        solve_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    catch (const std::exception& exception)
+    {
+        ReturnScene(cache, cached, false, 0, options);
+        WriteBakeError(job.id, std::string("failed: ") + exception.what());
+        return;
+    }
+    int patch_count = g_scene->patch_count;
+    ReturnScene(cache, cached, true, EstimateSolverMemory(), options);
+    if (!solved)
+    {
+        WriteBakeError(job.id, error);
+        return;
+    }
+
+    std::ostringstream out;
+    out << std::setprecision(7) << "{ \"id\": ";
+    WriteBakeString(out, job.id);
+    out << ", \"status\": \"ok\", \"scene\": ";
+    WriteBakeString(out, job.scene);
+    out << ", \"method\": \"" << (job.hierarchical ? "hierarchical" : "matrix") << "\""
+        << ", \"cache\": \"" << (miss ? "miss" : "hit") << "\""
+        << ", \"patches\": " << patch_count
+        << ", \"seconds\": { \"wait\": " << wait_seconds << ", \"build\": " << build_seconds << ", \"solve\": " << solve_seconds << " }";
+    if (job.colors)
+    {
+        out << ", \"colors\": [";
+        for (size_t i = 0; i < colors.size(); i++)
+        {
+            out << (i == 0 ? "" : ", ") << colors[i].x << ", " << colors[i].y << ", " << colors[i].z;
+        }
+        out << "]";
+    }
+    out << " }";
+    WriteBakeLine(out.str());
+}
+
+void WriteBakeStats(BakeCache& cache)
+{
+    std::ostringstream out;
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        out << "{ \"stats\": { \"hits\": " << cache.hits << ", \"misses\": " << cache.misses
+            << ", \"evictions\": " << cache.evictions << ", \"cached_scenes\": " << cache.scenes.size()
+            << ", \"cached_bytes\": " << cache.bytes << " } }";
+    }
+    WriteBakeLine(out.str());
+}
+
+int BakeMain(int argc, char* argv[])
+{
+    BakeOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--threads" && has_value)
+            options.thread_count = std::atoi(argv[++i]);
+        else if (arg == "--cache-scenes" && has_value)
+            options.cache_scenes = std::max<int>(1, std::atoi(argv[++i]));
+        else if (arg == "--cache-mb" && has_value)
+            options.cache_bytes = (size_t)std::max<int>(0, std::atoi(argv[++i])) << 20;
+        else if (arg == "--max-pairs" && has_value)
+            options.max_pairs = std::atof(argv[++i]);
+        else if (arg == "--half-links")
+            options.solver_options.half_link_formfactors = true;
+        else if (arg == "--centroid-formfactors")
+            options.solver_options.analytic_formfactors = false;
+        else
+        {
+            std::cerr << "usage: RadiosityBenchmark bake [--threads n] [--cache-scenes n] [--cache-mb n]\n"
+                         "                               [--max-pairs n] [--half-links] [--centroid-formfactors] < jobs\n";
+            return -1;
+        }
+    }
+
+    BakeCache cache;
+    BakeQueue queue;
+    auto worker = [&]()
+    {
+        for (;;)
+        {
+            BakeJob job;
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                queue.changed.wait(lock, [&]() { return queue.closed || !queue.jobs.empty(); });
+                if (queue.jobs.empty())
+                    return;
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            }
+            RunBakeJob(job, cache, options);
+        }
+    };
+
+    int thread_count = options.thread_count > 0 ? options.thread_count : (int)std::thread::hardware_concurrency();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < std::max<int>(1, thread_count); t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+
+    // the commands are read until quit or the end of the input, the queued jobs are
+    // finished before the service exits
+    std::string text;
+    while (std::getline(std::cin, text))
+    {
+        std::istringstream line(text);
+        std::string command;
+        if (!(line >> command) || command[0] == '#')
+            continue;
+
+        if (command == "quit")
+            break;
+        if (command == "stats")
+        {
+            WriteBakeStats(cache);
+            continue;
+        }
+
+        BakeJob job;
+        std::string error;
+        if (command != "bake")
+            WriteBakeError("", "unknown command " + command);
+        else if (!ParseBakeJob(line, job, error))
+            WriteBakeError(job.id, error);
+        else
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+            queue.changed.notify_one();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.closed = true;
+    }
+    queue.changed.notify_all();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    return 0;
+}
@@ -0,0 +1,1313 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <scene_generator.h>
+#include <profiler.h>
+#include <accuracy.h>
+#include <hemicube.h>
+#include <montecarlo.h>
+#include <formfactor_stream.h>
+#include <spectral.h>
+#include <light_basis.h>
+#include <checkpoint.h>
+#include <bake_service.h>
+#include <distributed.h>
+
+using namespace DirectX;
+
+// Headless benchmark of the radiosity solver. It generates tiled rooms of the
+// requested sizes (or loads an .obj-model), times every phase of the normal and
+// the hierarchical radiosity method and writes the timings as JSON:
+//
+//   RadiosityBenchmark.exe --patches 1000,4000,16000 --occluders 4 --out bench.json
+//
+// The solver counters of the profiler are reported per run, and --trace writes
+// all recorded phases as Chrome trace-event JSON.
+//
+// "RadiosityBenchmark.exe accuracy ..." runs the reference accuracy harness instead,
+// "RadiosityBenchmark.exe bake ..." the bake service, which reads its jobs from stdin.
+// "RadiosityBenchmark.exe distributed-worker ..." is a worker process of --distributed.
+//
+// With --tolerance the refined hierarchy is additionally solved until it has converged,
+// once with gather/push/pull sweeps and once level by level, and the iterations
+// and gather operations of both are reported.
+//
+// --mode stochastic runs the stochastic solver, which stores no formfactors.
+//
+// --hemicube computes the formfactor matrix with occlusion on hemicubes and
+// --monte-carlo with adaptive stratified sampling, the formfactor rows per second
+// are reported for every matrix run.
+//
+// --stream file writes the (pairwise) formfactor matrix to a file in row blocks and
+// iterates over it from there, so only a few blocks are resident.
+//
+// --storage double|float|half chooses how the matrix is stored for the iteration and
+// --accumulate float|double in which precision its rows are summed up.
+//
+// --symmetric estimates every pair of patches once and stores the upper triangle of the
+// area-weighted matrix, which the iteration reads for both directions.
+//
+// --bands 3|4|8|16 additionally iterates the matrix with that many spectral bands and
+// reports the largest difference of the displayed colors to the rgb solution.
+//
+// --light-groups n lights n ceiling patches, solves the matrix once per light into a light
+// basis and reports its size, the time to mix the lights with random colors from it and
+// the largest difference of that mix to a solve with the mixed lights.
+//
+// --half-links stores the formfactors of the hierarchical links as half floats. the
+// bytes per link and the rate the gathers stream through the links are reported.
+//
+// --oracle ibf refines by formfactor, source brightness and the importance of the receiver
+// for the camera of the application. before every refine pass the importance is solved
+// over the current links, which is timed as its own phase.
+//
+// --active-set t iterates both methods with active sets: after the first iteration only
+// the sources whose color has changed by more than t times the brightest patch are
+// propagated again. the active sources, gathered patches and seconds of every
+// iteration are reported.
+//
+// --checkpoint file writes a checkpoint of the iterations every --checkpoint-interval n
+// iterations, one file per run named file.<mode>.<patches>, and --resume continues the
+// runs from their checkpoints. the hierarchical runs then skip the refinement.
+//
+// --scenes n solves every run on n scenes at once, each on its own thread, and reports
+// the seconds for all of them and the scenes solved per second. the other results are
+// those of the first scene, only the counters count all of them. it can't be combined
+// with --stream or --checkpoint, whose files would be shared.
+//
+// --recursive-sweeps gathers, pushes and pulls by recursing through the patch quadtrees
+// instead of sweeping their breadth-first level arrays.
+//
+// --edit move|add additionally solves the matrix and the hierarchical method, then moves
+// the middle patch by half an edge within its plane or adds a copy of it one edge in
+// front of it, and updates the solution incrementally. the same edit is also solved on a
+// rebuilt scene with as many iterations as the incremental solution has had in total,
+// and the times of both and the largest difference between them are reported.
+//
+// --distributed 1,2,4,8 additionally solves the matrix method with the formfactor rows
+// split over that many workers, each a process connected over localhost sockets or with
+// --distributed-transport threads a thread. the bytes exchanged in the iterations and
+// the formfactor bytes of the largest worker are reported.
+//
+// --ordered-pairs refines both ordered pairs of patches on their own instead of every
+// unordered pair once for both directions.
+//
+// Phases that would need more than --max-pairs patch pairs (the formfactor matrix
+// and the refinement of all pairs are quadratic) are skipped and marked as such.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct BenchmarkOptions
+{
+    std::vector<int> patch_counts = { 1000, 4000, 16000 };
+    int occluder_count = 0;
+    std::string obj_path;
+    bool run_matrix = true;
+    bool run_hierarchical = true;
+    bool run_stochastic = false;
+    StochasticOptions stochastic_options = DefaultStochasticOptions();
+    int matrix_iterations = 20;
+    int hierarchical_iterations = 2;
+    double max_pairs = 4.0e8;
+    SolverOptions solver_options = DefaultSolverOptions();
+    RefineOptions refine_options = DefaultRefineOptions();
+    int refine_passes = 0;
+    int importance_iterations = 4;
+    bool hemicube = false;
+    HemicubeOptions hemicube_options = DefaultHemicubeOptions();
+    bool monte_carlo = false;
+    MonteCarloOptions monte_carlo_options = DefaultMonteCarloOptions();
+    int spectral_bands = 0;
+    int light_groups = 0;
+    LightBasisOptions light_basis_options = DefaultLightBasisOptions();
+    bool active_set = false;
+    ActiveSetOptions active_set_options = DefaultActiveSetOptions();
+    bool checkpoint = false;
+    CheckpointOptions checkpoint_options = DefaultCheckpointOptions();
+    bool resume = false;
+    int concurrent_scenes = 1;
+    std::string edit;
+    std::vector<int> distributed_workers;
+    DistributedOptions distributed_options = DefaultDistributedOptions();
+    bool stream = false;
+    StreamOptions stream_options = DefaultStreamOptions();
+    double convergence_tolerance = 0.0;
+    int max_convergence_iterations = 1000;
+    std::string out_path;
+    std::string trace_path;
+};
+
+struct Phase
+{
+    std::string name;
+    double seconds;
+};
+
+struct BenchmarkRun
+{
+    std::string scene;
+    std::string mode;
+    int requested_patches;
+    int patches;
+    int occluders;
+    int iterations;
+    bool skipped;
+    std::vector<Phase> phases;
+    int subpatches;
+    int links;
+    unsigned long long counters[NumProfileCounters];
+    double form_factor_rows_per_second;
+
+    // the largest difference between the spectral and the rgb colors, relative to the brightest
+    // patch. the bands are initialised from the rgb colors, so it only shows rounding
+    double spectral_difference;
+
+    // the light basis: its bytes, the seconds one mix of all lights takes and the largest
+    // difference of the mix to a full solve, relative to the brightest patch
+    size_t light_basis_bytes;
+    double light_combine_seconds;
+    double light_basis_difference;
+
+    // the iterations of the active-set iteration, of its last call for the hierarchical run
+    ActiveSetStats active_stats;
+
+    // the scenes solved at once and the seconds for all of them
+    int concurrent_scenes;
+    double concurrent_seconds;
+
+    // the patch an edit run has moved or added, and the largest difference of the
+    // incremental solution to the rebuilt one, relative to the brightest patch
+    int edit_patch;
+    double edit_difference;
+
+    // the workers of a distributed run and what they exchanged
+    int distributed_workers;
+    DistributedStats distributed_stats;
+
+    // the iterations restored from a checkpoint, and the checkpoints written: their number,
+    // the size of the last one and the seconds the solver spent on them
+    int resumed_iterations;
+    int checkpoints;
+    size_t checkpoint_bytes;
+    double checkpoint_snapshot_seconds;
+    double checkpoint_stall_seconds;
+
+    // the bytes the link arrays have allocated and the rate the gathers read them with
+    size_t link_store_bytes;
+    double gather_bytes_per_second;
+
+    // the memory of the solver after the run, including the resident blocks of a streamed matrix
+    size_t memory_bytes;
+
+    // iterations until the hierarchical solution has converged, 0 if not measured
+    int sweep_iterations;
+    int level_iterations;
+    unsigned long long sweep_gather_operations;
+    unsigned long long level_gather_operations;
+};
+
+// returns the seconds passed since start.
+double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// loads or generates the scene of a run and creates its patches.
+void LoadScene(const BenchmarkOptions& options, BenchmarkRun& run)
+{
+    g_scene->solver_options = options.solver_options;
+
+    Clock::time_point start = Clock::now();
+    int emitter_face;
+    if (!options.obj_path.empty())
+    {
+        LoadModel(options.obj_path);
+        emitter_face = 1001;
+        run.scene = options.obj_path;
+    }
+    else
+    {
+        emitter_face = GenerateRoom(RoomForPatchCount(run.requested_patches, options.occluder_count));
+        run.scene = "generated_room";
+    }
+    run.phases.push_back({ "load", SecondsSince(start) });
+
+    start = Clock::now();
+    CreatePatches(emitter_face);
+    run.phases.push_back({ "init_patches", SecondsSince(start) });
+
+    run.patches = g_scene->patch_count;
+}
+
+// stores how much the profiler counters have grown since the start of a run.
+void StoreCounters(BenchmarkRun& run, const unsigned long long start[NumProfileCounters])
+{
+    for (int counter = 0; counter < NumProfileCounters; counter++)
+    {
+        run.counters[counter] = GetProfileCounter((ProfileCounter)counter) - start[counter];
+    }
+}
+
+// returns the current state of the profiler counters.
+void ReadCounters(unsigned long long counters[NumProfileCounters])
+{
+    for (int counter = 0; counter < NumProfileCounters; counter++)
+    {
+        counters[counter] = GetProfileCounter((ProfileCounter)counter);
+    }
+}
+
+// solves the matrix with spectral bands from scratch and compares the colors with
+// the current rgb solution.
+template<int Bands>
+double RunSpectralBands(int iterations)
+{
+    SpectralScene<Bands> scene;
+    InitSpectralScene(scene);
+    IterateSpectralRadiosity(scene, iterations);
+
+    double difference = 0.0;
+    double scale = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        XMFLOAT3 rgb, spectral;
+        GetRadiosity(i, rgb);
+        GetSpectralColor(scene, i, spectral);
+        difference = std::max<double>(difference, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&rgb), XMLoadFloat3(&spectral)))));
+        scale = std::max<double>(scale, XMVectorGetX(XMVector3Length(XMLoadFloat3(&rgb))));
+    }
+    return scale > 0.0 ? difference / scale : 0.0;
+}
+
+// lights count ceiling patches, spread over the ceiling, with the irradiance of the
+// emitter of the scene and returns them as one group each.
+std::vector<std::vector<int>> LightCeiling(int count)
+{
+    XMFLOAT3 light(1.0f, 1.0f, 1.0f);
+    std::vector<std::vector<int>> emitters = EmitterGroups();
+    if (!emitters.empty())
+        light = g_scene->patches[emitters[0][0]].irradiance;
+
+    std::vector<int> ceiling;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches[i].irradiance = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        if (g_scene->patches[i].normal.y < -0.5f)
+            ceiling.push_back(i);
+    }
+
+    std::vector<std::vector<int>> groups;
+    for (int k = 0; k < count && !ceiling.empty(); k++)
+    {
+        int i = ceiling[(size_t)k * ceiling.size() / count];
+        g_scene->patches[i].irradiance = light;
+        groups.push_back({ i });
+    }
+    return groups;
+}
+
+// solves a light basis for the given number of ceiling lights, mixes it with random
+// colors and compares the mix with a solve of the mixed lights.
+void RunLightBasis(const BenchmarkOptions& options, BenchmarkRun& run)
+{
+    std::vector<std::vector<int>> groups = LightCeiling(options.light_groups);
+    LightBasisOptions basis_options = options.light_basis_options;
+    basis_options.iterations = options.matrix_iterations;
+
+    Clock::time_point start = Clock::now();
+    LightBasis basis;
+    SolveLightBasis(groups, basis_options, basis);
+    run.phases.push_back({ "light_basis", SecondsSince(start) });
+    run.light_basis_bytes = LightBasisBytes(basis);
+
+    std::mt19937 random(options.monte_carlo_options.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<XMFLOAT3> weights(groups.size());
+    for (XMFLOAT3& weight : weights)
+    {
+        weight = XMFLOAT3(unit(random), unit(random), unit(random));
+    }
+
+    std::vector<XMFLOAT3> mixed;
+    start = Clock::now();
+    CombineLightBasis(basis, weights, mixed);
+    run.light_combine_seconds = SecondsSince(start);
+
+    // the same lights solved directly, from zero radiosity
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        for (int i : groups[g])
+        {
+            XMStoreFloat3(&g_scene->patches[i].irradiance, XMVectorMultiply(XMLoadFloat3(&g_scene->patches[i].irradiance), XMLoadFloat3(&weights[g])));
+        }
+    }
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches[i].radiosity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    }
+    start = Clock::now();
+    IterateRadiosity(options.matrix_iterations);
+    run.phases.push_back({ "iterate_mixed_lights", SecondsSince(start) });
+
+    double difference = 0.0;
+    double scale = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        XMFLOAT3 solved;
+        GetRadiosity(i, solved);
+        difference = std::max<double>(difference, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&solved), XMLoadFloat3(&mixed[i])))));
+        scale = std::max<double>(scale, XMVectorGetX(XMVector3Length(XMLoadFloat3(&solved))));
+    }
+    run.light_basis_difference = scale > 0.0 ? difference / scale : 0.0;
+}
+
+double RunSpectral(int bands, int iterations)
+{
+    switch (bands)
+    {
+    case 3: return RunSpectralBands<3>(iterations);
+    case 4: return RunSpectralBands<4>(iterations);
+    case 8: return RunSpectralBands<8>(iterations);
+    default: return RunSpectralBands<16>(iterations);
+    }
+}
+
+// the checkpoint of a run, every mode and scene size has its own.
+CheckpointOptions RunCheckpointOptions(const BenchmarkOptions& options, const BenchmarkRun& run)
+{
+    CheckpointOptions checkpoint_options = options.checkpoint_options;
+    checkpoint_options.path += "." + run.mode + "." + std::to_string(run.patches);
+    return checkpoint_options;
+}
+
+void StoreCheckpointStats(CheckpointWriter& writer, BenchmarkRun& run)
+{
+    if (!FinishCheckpoints(writer))
+        std::cerr << "can't write " << writer.path << ".\n";
+    run.checkpoints = writer.count;
+    run.checkpoint_bytes = writer.bytes;
+    run.checkpoint_snapshot_seconds = writer.snapshot_seconds;
+    run.checkpoint_stall_seconds = writer.stall_seconds;
+}
+
+BenchmarkRun RunMatrix(const BenchmarkOptions& options, int requested_patches)
+{
+    BenchmarkRun run = {};
+    unsigned long long counters_start[NumProfileCounters];
+    ReadCounters(counters_start);
+
+    run.mode = "matrix";
+    run.requested_patches = requested_patches;
+    run.occluders = options.occluder_count;
+    run.iterations = options.matrix_iterations;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadScene(options, run);
+
+    if ((double)run.patches * run.patches > options.max_pairs)
+    {
+        run.skipped = true;
+    }
+    else
+    {
+        Clock::time_point start = Clock::now();
+        if (options.stream)
+        {
+            if (!EstimateFormFactorsStreamed(options.stream_options))
+                std::cerr << "can't write " << options.stream_options.path << ".\n";
+        }
+        else if (options.hemicube)
+            EstimateFormFactorsHemicube(options.hemicube_options);
+        else if (options.monte_carlo)
+            EstimateFormFactorsMonteCarlo(options.monte_carlo_options);
+        else
+            EstimateFormFactors();
+        double form_factor_seconds = SecondsSince(start);
+        run.phases.push_back({ "form_factors", form_factor_seconds });
+        run.form_factor_rows_per_second = form_factor_seconds > 0.0 ? run.patches / form_factor_seconds : 0.0;
+
+        start = Clock::now();
+        if (options.stream)
+        {
+            if (!IterateRadiosityStreamed(options.matrix_iterations, options.stream_options))
+                std::cerr << "can't read " << options.stream_options.path << ".\n";
+        }
+        else if (options.active_set)
+            IterateRadiosityActive(options.matrix_iterations, options.active_set_options, run.active_stats);
+        else if (options.checkpoint)
+        {
+            // the iterations run from one checkpoint to the next
+            CheckpointOptions checkpoint_options = RunCheckpointOptions(options, run);
+            if (options.resume && !LoadCheckpoint(checkpoint_options.path, CK_Matrix, run.resumed_iterations))
+                std::cerr << "no checkpoint " << checkpoint_options.path << " of this scene, starting over.\n";
+
+            CheckpointWriter writer;
+            StartCheckpoints(writer, checkpoint_options);
+            for (int iteration = run.resumed_iterations; iteration < options.matrix_iterations;)
+            {
+                int iterations = std::min<int>(std::max<int>(1, checkpoint_options.interval), options.matrix_iterations - iteration);
+                IterateRadiosity(iterations);
+                iteration += iterations;
+                if (checkpoint_options.interval > 0)
+                    WriteCheckpoint(writer, CK_Matrix, iteration);
+            }
+            StoreCheckpointStats(writer, run);
+        }
+        else
+            IterateRadiosity(options.matrix_iterations);
+        run.phases.push_back({ "iterate", SecondsSince(start) });
+
+        if (options.spectral_bands > 0 && !options.stream)
+        {
+            start = Clock::now();
+            run.spectral_difference = RunSpectral(options.spectral_bands, options.matrix_iterations);
+            run.phases.push_back({ "iterate_spectral", SecondsSince(start) });
+        }
+
+        if (options.light_groups > 0 && !options.stream)
+            RunLightBasis(options, run);
+
+        run.memory_bytes = EstimateSolverMemory();
+        if (options.stream)
+            run.memory_bytes += StreamResidentBytes(options.stream_options);
+    }
+
+    StoreCounters(run, counters_start);
+    ReleaseScene();
+    return run;
+}
+
+// applies the edit of --edit to the current scene and returns the moved or added patch.
+int ApplyEdit(const BenchmarkOptions& options)
+{
+    int source = g_scene->patch_count / 2;
+    const Patch& p = g_scene->patches[source];
+    XMVECTOR edge = XMVectorSubtract(XMLoadFloat3(&p.vertex_pos[1]), XMLoadFloat3(&p.vertex_pos[0]));
+    XMVECTOR offset = options.edit == "add" ? XMVectorScale(XMLoadFloat3(&p.normal), XMVectorGetX(XMVector3Length(edge))) : XMVectorScale(edge, 0.5f);
+    XMFLOAT3 pos[4];
+    for (int corner = 0; corner < 4; corner++)
+    {
+        XMStoreFloat3(&pos[corner], XMVectorAdd(XMLoadFloat3(&p.vertex_pos[corner]), offset));
+    }
+
+    if (options.edit == "add")
+        return AddPatch(pos, XMFLOAT3(0.0f, 0.0f, 0.0f));
+    MovePatch(source, pos);
+    return source;
+}
+
+// estimates the formfactors or refines the links of the current scene.
+void BuildSolver(const BenchmarkOptions& options, bool hierarchical)
+{
+    if (hierarchical)
+        RefineAll(options.refine_options);
+    else
+        EstimateFormFactors();
+}
+
+void IterateSolver(bool hierarchical, int iterations)
+{
+    if (hierarchical)
+        IterateHierarchicalRadiosity(iterations);
+    else
+        IterateRadiosity(iterations);
+}
+
+// solves a scene, edits it and updates the solution incrementally, then solves the edited
+// scene from scratch on a second scene to compare with.
+BenchmarkRun RunEdit(const BenchmarkOptions& options, int requested_patches, bool hierarchical)
+{
+    BenchmarkRun run = {};
+    unsigned long long counters_start[NumProfileCounters];
+    ReadCounters(counters_start);
+
+    run.mode = hierarchical ? "hierarchical_edit" : "matrix_edit";
+    run.requested_patches = requested_patches;
+    run.occluders = options.occluder_count;
+    run.iterations = hierarchical ? options.hierarchical_iterations : options.matrix_iterations;
+
+    g_scene->without_hierarch_radiosity = !hierarchical;
+    LoadScene(options, run);
+
+    if ((double)run.patches * run.patches > options.max_pairs)
+    {
+        run.skipped = true;
+    }
+    else
+    {
+        const char* build_phase = hierarchical ? "refine" : "form_factors";
+        Clock::time_point start = Clock::now();
+        BuildSolver(options, hierarchical);
+        run.phases.push_back({ build_phase, SecondsSince(start) });
+
+        start = Clock::now();
+        IterateSolver(hierarchical, run.iterations);
+        run.phases.push_back({ "iterate", SecondsSince(start) });
+
+        run.edit_patch = ApplyEdit(options);
+        start = Clock::now();
+        UpdateDirtyPatches();
+        run.phases.push_back({ "edit_update", SecondsSince(start) });
+
+        start = Clock::now();
+        IterateSolver(hierarchical, run.iterations);
+        double edit_iterate = SecondsSince(start);
+        run.phases.push_back({ "edit_iterate", edit_iterate });
+
+        std::vector<XMFLOAT3> incremental(g_scene->patch_count);
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            GetPatchColor(i, incremental[i]);
+        }
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            CountHierarchy(g_scene->patches[i], run.subpatches, run.links);
+        }
+        run.memory_bytes = EstimateSolverMemory();
+        if (hierarchical)
+        {
+            // the links of the edited scene, read once per gather of the iterations after the edit
+            run.link_store_bytes = LinkStoreBytes();
+            if (edit_iterate > 0.0)
+                run.gather_bytes_per_second = (double)run.links * run.iterations * LinkBytes() / edit_iterate;
+        }
+
+        {
+            Scene scene;
+            SceneScope scope(&scene);
+            g_scene->without_hierarch_radiosity = !hierarchical;
+            BenchmarkRun rebuild = {};
+            rebuild.requested_patches = requested_patches;
+            LoadScene(options, rebuild);
+            ApplyEdit(options);
+            // the rebuild doesn't update anything incrementally
+            for (int i = 0; i < g_scene->patch_count; i++)
+            {
+                g_scene->patches[i].dirty = false;
+            }
+
+            start = Clock::now();
+            BuildSolver(options, hierarchical);
+            run.phases.push_back({ std::string("rebuild_") + build_phase, SecondsSince(start) });
+
+            start = Clock::now();
+            IterateSolver(hierarchical, 2 * run.iterations);
+            run.phases.push_back({ "rebuild_iterate", SecondsSince(start) });
+
+            double difference = 0.0;
+            double scale = 0.0;
+            for (int i = 0; i < g_scene->patch_count; i++)
+            {
+                XMFLOAT3 rebuilt;
+                GetPatchColor(i, rebuilt);
+                difference = std::max<double>(difference, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&rebuilt), XMLoadFloat3(&incremental[i])))));
+                scale = std::max<double>(scale, XMVectorGetX(XMVector3Length(XMLoadFloat3(&rebuilt))));
+            }
+            run.edit_difference = scale > 0.0 ? difference / scale : 0.0;
+        }
+    }
+
+    StoreCounters(run, counters_start);
+    ReleaseScene();
+    return run;
+}
+
+// the matrix method on options.distributed_options.worker_count workers, which each
+// estimate and iterate a block of the formfactor rows. the quadratic phase is skipped
+// like in RunMatrix(), even though every worker only holds part of it.
+BenchmarkRun RunDistributed(const BenchmarkOptions& options, int requested_patches, int workers)
+{
+    BenchmarkRun run = {};
+    unsigned long long counters_start[NumProfileCounters];
+    ReadCounters(counters_start);
+
+    run.mode = "distributed";
+    run.requested_patches = requested_patches;
+    run.occluders = options.occluder_count;
+    run.iterations = options.matrix_iterations;
+    run.distributed_workers = workers;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadScene(options, run);
+
+    if ((double)run.patches * run.patches > options.max_pairs)
+    {
+        run.skipped = true;
+    }
+    else
+    {
+        DistributedScene scene;
+        scene.obj_path = options.obj_path;
+        scene.patch_count = requested_patches;
+        scene.occluder_count = options.occluder_count;
+        DistributedOptions distributed_options = options.distributed_options;
+        distributed_options.worker_count = workers;
+        distributed_options.iterations = options.matrix_iterations;
+        if (!IterateRadiosityDistributed(scene, distributed_options, run.distributed_stats))
+            std::cerr << "distributed solve on " << workers << " workers failed.\n";
+        run.phases.push_back({ "start_workers", run.distributed_stats.start_seconds });
+        run.phases.push_back({ "form_factors", run.distributed_stats.form_factor_seconds });
+        run.phases.push_back({ "iterate", run.distributed_stats.iterate_seconds });
+        if (run.distributed_stats.form_factor_seconds > 0.0)
+            run.form_factor_rows_per_second = run.patches / run.distributed_stats.form_factor_seconds;
+    }
+
+    StoreCounters(run, counters_start);
+    ReleaseScene();
+    return run;
+}
+
+// the stochastic solver has no quadratic phase, so it is never skipped.
+BenchmarkRun RunStochastic(const BenchmarkOptions& options, int requested_patches)
+{
+    BenchmarkRun run = {};
+    unsigned long long counters_start[NumProfileCounters];
+    ReadCounters(counters_start);
+
+    run.mode = "stochastic";
+    run.requested_patches = requested_patches;
+    run.occluders = options.occluder_count;
+
+    g_scene->without_hierarch_radiosity = true;
+    LoadScene(options, run);
+
+    Clock::time_point start = Clock::now();
+    run.iterations = SolveStochasticRadiosity(options.stochastic_options);
+    run.phases.push_back({ "solve", SecondsSince(start) });
+
+    StoreCounters(run, counters_start);
+    ReleaseScene();
+    return run;
+}
+
+// returns the largest change of a top-level patch color relative to the brightest patch.
+double RelativeChange(std::vector<XMFLOAT3>& colors)
+{
+    double change = 0.0;
+    double scale = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        XMFLOAT3 color;
+        GetPatchColor(i, color);
+        double dx = (double)color.x - colors[i].x;
+        double dy = (double)color.y - colors[i].y;
+        double dz = (double)color.z - colors[i].z;
+        change = std::max<double>(change, std::sqrt(dx * dx + dy * dy + dz * dz));
+        scale = std::max<double>(scale, std::sqrt((double)color.x * color.x + (double)color.y * color.y + (double)color.z * color.z));
+        colors[i] = color;
+    }
+    return scale > 0.0 ? change / scale : 0.0;
+}
+
+// solves the refined hierarchy from zero brightness with plain gather/push/pull sweeps
+// or level by level until the relative change drops below the tolerance and returns
+// the number of iterations.
+int IterateUntilConverged(const BenchmarkOptions& options, bool level_ordered, unsigned long long& gather_operations)
+{
+    ResetHierarchicalSolution();
+    std::vector<XMFLOAT3> colors(g_scene->patch_count);
+    RelativeChange(colors);
+
+    unsigned long long gather_start = GetProfileCounter(PC_GatherOperations);
+    int iterations;
+    for (iterations = 1; iterations <= options.max_convergence_iterations; iterations++)
+    {
+        if (level_ordered)
+            IterateLevelOrderedRadiosity(1);
+        else
+            IterateHierarchicalRadiosity(1);
+
+        if (RelativeChange(colors) <= options.convergence_tolerance)
+            break;
+    }
+    gather_operations = GetProfileCounter(PC_GatherOperations) - gather_start;
+    return iterations;
+}
+
+BenchmarkRun RunHierarchical(const BenchmarkOptions& options, int requested_patches)
+{
+    BenchmarkRun run = {};
+    unsigned long long counters_start[NumProfileCounters];
+    ReadCounters(counters_start);
+
+    run.mode = "hierarchical";
+    run.requested_patches = requested_patches;
+    run.occluders = options.occluder_count;
+    run.iterations = options.hierarchical_iterations;
+
+    g_scene->without_hierarch_radiosity = false;
+    LoadScene(options, run);
+
+    if ((double)run.patches * run.patches > options.max_pairs)
+    {
+        run.skipped = true;
+    }
+    else
+    {
+        // a resumed run continues with the hierarchy of its checkpoint
+        CheckpointOptions checkpoint_options = RunCheckpointOptions(options, run);
+        Clock::time_point start = Clock::now();
+        if (options.checkpoint && options.resume && LoadCheckpoint(checkpoint_options.path, CK_Hierarchical, run.resumed_iterations))
+        {
+            run.phases.push_back({ "load_checkpoint", SecondsSince(start) });
+        }
+        else
+        {
+            if (options.checkpoint && options.resume)
+                std::cerr << "no checkpoint " << checkpoint_options.path << " of this scene, starting over.\n";
+            RefineAll(options.refine_options);
+            run.phases.push_back({ "refine", SecondsSince(start) });
+        }
+
+        CheckpointWriter writer;
+        StartCheckpoints(writer, checkpoint_options);
+        int checkpoint_interval = options.checkpoint ? checkpoint_options.interval : 0;
+
+        // the iteration is timed as a whole and per step, the re-refinements of the
+        // links with the current brightness are timed separately. the active-set
+        // iteration runs from one re-refinement or checkpoint to the next in one call.
+        double gather = 0.0, push = 0.0, pull = 0.0, refine_links = 0.0, importance = 0.0;
+        Clock::time_point iterate_start = Clock::now();
+        for (int iteration = run.resumed_iterations; iteration < options.hierarchical_iterations;)
+        {
+            if (iteration > 0 && iteration <= options.refine_passes)
+            {
+                if (options.refine_options.oracle == RO_ImportanceBrightness)
+                {
+                    start = Clock::now();
+                    IterateImportance(options.importance_iterations);
+                    importance += SecondsSince(start);
+                }
+
+                start = Clock::now();
+                RefineLinks(options.refine_options);
+                refine_links += SecondsSince(start);
+            }
+
+            if (options.active_set)
+            {
+                int iterations = iteration < options.refine_passes ? 1 : options.hierarchical_iterations - iteration;
+                if (checkpoint_interval > 0)
+                    iterations = std::min<int>(iterations, checkpoint_interval - iteration % checkpoint_interval);
+                IterateHierarchicalActive(iterations, options.active_set_options, run.active_stats);
+                iteration += iterations;
+                if (checkpoint_interval > 0 && iteration % checkpoint_interval == 0)
+                    WriteCheckpoint(writer, CK_Hierarchical, iteration);
+                continue;
+            }
+
+            start = Clock::now();
+            GatherAll();
+            gather += SecondsSince(start);
+
+            start = Clock::now();
+            PushAll();
+            push += SecondsSince(start);
+
+            start = Clock::now();
+            PullAll();
+            pull += SecondsSince(start);
+            iteration++;
+
+            if (checkpoint_interval > 0 && iteration % checkpoint_interval == 0)
+                WriteCheckpoint(writer, CK_Hierarchical, iteration);
+        }
+        StoreCheckpointStats(writer, run);
+        run.phases.push_back({ "iterate", SecondsSince(iterate_start) });
+        if (!options.active_set)
+        {
+            run.phases.push_back({ "gather", gather });
+            run.phases.push_back({ "push", push });
+            run.phases.push_back({ "pull", pull });
+        }
+        if (options.refine_passes > 0)
+            run.phases.push_back({ "refine_links", refine_links });
+        if (options.refine_passes > 0 && options.refine_options.oracle == RO_ImportanceBrightness)
+            run.phases.push_back({ "importance", importance });
+
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            CountHierarchy(g_scene->patches[i], run.subpatches, run.links);
+        }
+        run.memory_bytes = EstimateSolverMemory();
+        run.link_store_bytes = LinkStoreBytes();
+
+        // every link is read once per gather
+        if (gather > 0.0 && !options.active_set)
+            run.gather_bytes_per_second = (double)run.links * options.hierarchical_iterations * LinkBytes() / gather;
+
+        if (options.convergence_tolerance > 0.0)
+        {
+            start = Clock::now();
+            run.sweep_iterations = IterateUntilConverged(options, false, run.sweep_gather_operations);
+            run.phases.push_back({ "converge_sweep", SecondsSince(start) });
+
+            start = Clock::now();
+            run.level_iterations = IterateUntilConverged(options, true, run.level_gather_operations);
+            run.phases.push_back({ "converge_levels", SecondsSince(start) });
+        }
+    }
+
+    StoreCounters(run, counters_start);
+    ReleaseScene();
+    return run;
+}
+
+// solves a run on options.concurrent_scenes scenes at once, each with its own Scene bound
+// to its own thread, and returns the run of the first one.
+BenchmarkRun RunConcurrently(const BenchmarkOptions& options, int requested_patches,
+    BenchmarkRun (*solve)(const BenchmarkOptions&, int))
+{
+    std::vector<BenchmarkRun> runs(options.concurrent_scenes);
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int s = 0; s < options.concurrent_scenes; s++)
+    {
+        threads.push_back(std::thread([&, s]()
+        {
+            Scene scene;
+            SceneScope scope(&scene);
+            runs[s] = solve(options, requested_patches);
+        }));
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    BenchmarkRun run = runs[0];
+    run.concurrent_scenes = options.concurrent_scenes;
+    run.concurrent_seconds = SecondsSince(start);
+    return run;
+}
+
+// writes a string as a JSON string literal.
+void WriteJSONString(std::ostream& out, const std::string& text)
+{
+    out << '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+// writes ", "name": [values]".
+template<typename T>
+void WriteJSONList(std::ostream& out, const char* name, const std::vector<T>& values)
+{
+    out << ", \"" << name << "\": [";
+    for (size_t k = 0; k < values.size(); k++)
+    {
+        out << (k == 0 ? "" : ", ") << values[k];
+    }
+    out << "]";
+}
+
+void WriteJSON(std::ostream& out, const BenchmarkOptions& options, const std::vector<BenchmarkRun>& runs)
+{
+    std::string formfactors = options.solver_options.analytic_formfactors ? "analytic" : "centroid";
+    if (options.hemicube)
+        formfactors = "hemicube " + std::to_string(options.hemicube_options.resolution);
+    if (options.monte_carlo)
+        formfactors = "monte carlo " + std::to_string(options.monte_carlo_options.relative_error);
+    if (options.stream)
+        formfactors += " streamed";
+
+    out << std::setprecision(9);
+    out << "{\n  \"benchmark\": \"radiosity\",\n";
+    out << "  \"simd\": \"" << GetSimdLevelName(GetSimdLevel()) << "\",\n";
+    out << "  \"formfactors\": \"" << formfactors << "\",\n";
+    out << "  \"precision\": { \"storage\": \"" << GetFormFactorStorageName(options.solver_options.formfactor_storage)
+        << "\", \"accumulate\": \"" << GetAccumulatePrecisionName(options.solver_options.accumulate_precision)
+        << "\", \"symmetric\": " << (options.solver_options.symmetric_formfactors ? "true" : "false") << " },\n";
+    out << "  \"refine_pairs\": \"" << (options.refine_options.unordered_pairs ? "unordered" : "ordered") << "\",\n";
+    out << "  \"sweeps\": \"" << (options.solver_options.hierarchy_level_arrays ? "levels" : "recursive") << "\",\n";
+    out << "  \"runs\": [\n";
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        const BenchmarkRun& run = runs[r];
+        out << "    {\n";
+        out << "      \"scene\": ";
+        WriteJSONString(out, run.scene);
+        out << ",\n";
+        out << "      \"mode\": \"" << run.mode << "\",\n";
+        out << "      \"requested_patches\": " << run.requested_patches << ",\n";
+        out << "      \"patches\": " << run.patches << ",\n";
+        out << "      \"occluders\": " << run.occluders << ",\n";
+        out << "      \"iterations\": " << run.iterations << ",\n";
+        out << "      \"skipped\": " << (run.skipped ? "true" : "false") << ",\n";
+        out << "      \"subpatches\": " << run.subpatches << ",\n";
+        out << "      \"links\": " << run.links << ",\n";
+        if (run.form_factor_rows_per_second > 0.0)
+            out << "      \"form_factor_rows_per_second\": " << run.form_factor_rows_per_second << ",\n";
+        if (options.spectral_bands > 0 && run.mode == "matrix" && !run.skipped && !options.stream)
+        {
+            out << "      \"spectral\": { \"bands\": " << options.spectral_bands
+                << ", \"difference\": " << run.spectral_difference << " },\n";
+        }
+        if (options.light_groups > 0 && run.mode == "matrix" && !run.skipped && !options.stream)
+        {
+            out << "      \"light_basis\": { \"groups\": " << options.light_groups
+                << ", \"half\": " << (options.light_basis_options.half_storage ? "true" : "false")
+                << ", \"bytes\": " << run.light_basis_bytes
+                << ", \"combine_seconds\": " << run.light_combine_seconds
+                << ", \"difference\": " << run.light_basis_difference << " },\n";
+        }
+        if (!run.active_stats.seconds.empty())
+        {
+            out << "      \"active_set\": { \"tolerance\": " << options.active_set_options.tolerance;
+            WriteJSONList(out, "active_sources", run.active_stats.active_sources);
+            WriteJSONList(out, "gathered_patches", run.active_stats.gathered_patches);
+            WriteJSONList(out, "iteration_seconds", run.active_stats.seconds);
+            out << " },\n";
+        }
+        if (run.concurrent_scenes > 1)
+        {
+            out << "      \"scenes\": { \"count\": " << run.concurrent_scenes
+                << ", \"seconds\": " << run.concurrent_seconds
+                << ", \"scenes_per_second\": " << run.concurrent_scenes / run.concurrent_seconds << " },\n";
+        }
+        if ((run.mode == "matrix_edit" || run.mode == "hierarchical_edit") && !run.skipped)
+        {
+            out << "      \"edit\": { \"kind\": \"" << options.edit
+                << "\", \"patch\": " << run.edit_patch
+                << ", \"difference\": " << run.edit_difference << " },\n";
+        }
+        if (run.distributed_workers > 0 && !run.skipped)
+        {
+            out << "      \"distributed\": { \"workers\": " << run.distributed_workers
+                << ", \"transport\": \"" << GetDistributedTransportName(options.distributed_options.transport)
+                << "\", \"exchanged_bytes\": " << run.distributed_stats.exchanged_bytes
+                << ", \"worker_matrix_bytes\": " << run.distributed_stats.worker_matrix_bytes << " },\n";
+        }
+        if (options.checkpoint && !run.skipped)
+        {
+            out << "      \"checkpoint\": { \"resumed_iterations\": " << run.resumed_iterations
+                << ", \"count\": " << run.checkpoints
+                << ", \"bytes\": " << run.checkpoint_bytes
+                << ", \"snapshot_seconds\": " << run.checkpoint_snapshot_seconds
+                << ", \"stall_seconds\": " << run.checkpoint_stall_seconds << " },\n";
+        }
+        if (run.memory_bytes > 0)
+            out << "      \"memory_bytes\": " << run.memory_bytes << ",\n";
+        if (run.links > 0)
+        {
+            out << "      \"link_store\": { \"bytes\": " << run.link_store_bytes
+                << ", \"bytes_per_link\": " << (double)run.link_store_bytes / run.links
+                << ", \"gather_bytes_per_second\": " << run.gather_bytes_per_second << " },\n";
+        }
+        if (run.sweep_iterations > 0)
+        {
+            out << "      \"convergence\": { \"sweep_iterations\": " << run.sweep_iterations
+                << ", \"sweep_gather_operations\": " << run.sweep_gather_operations
+                << ", \"level_iterations\": " << run.level_iterations
+                << ", \"level_gather_operations\": " << run.level_gather_operations << " },\n";
+        }
+        out << "      \"counters\": {";
+        for (int counter = 0; counter < NumProfileCounters; counter++)
+        {
+            out << (counter == 0 ? " " : ", ") << '"' << GetProfileCounterName((ProfileCounter)counter) << "\": " << run.counters[counter];
+        }
+        out << " },\n";
+        out << "      \"phases\": {";
+        for (size_t p = 0; p < run.phases.size(); p++)
+        {
+            out << (p == 0 ? " " : ", ") << '"' << run.phases[p].name << "\": " << run.phases[p].seconds;
+        }
+        out << " }\n";
+        out << "    }" << (r + 1 < runs.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// parses a comma separated list of patch or worker counts.
+std::vector<int> ParsePatchCounts(const std::string& list)
+{
+    std::vector<int> counts;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        counts.push_back(std::atoi(item.c_str()));
+    }
+    return counts;
+}
+
+void PrintUsage()
+{
+    std::cerr << "usage: RadiosityBenchmark accuracy ...\n"
+                 "       RadiosityBenchmark bake ... < jobs\n"
+                 "       RadiosityBenchmark distributed-worker --port p\n"
+                 "       RadiosityBenchmark [--patches n1,n2,...] [--occluders n] [--obj path]\n"
+                 "                          [--mode matrix|hierarchical|stochastic|both|all] [--iterations n]\n"
+                 "                          [--hierarchical-iterations n] [--max-pairs n] [--out file]\n"
+                 "                          [--trace file] [--oracle ff|bf|ibf] [--F-eps e] [--BF-eps e]\n"
+                 "                          [--min-area a] [--min-area-fraction f] [--max-depth n]\n"
+                 "                          [--max-links n] [--max-bytes n] [--refine-passes n]\n"
+                 "                          [--tolerance t] [--max-convergence-iterations n]\n"
+                 "                          [--simd scalar|sse2|avx2] [--centroid-formfactors]\n"
+                 "                          [--hemicube] [--hemicube-resolution n] [--threads n]\n"
+                 "                          [--monte-carlo] [--mc-error e] [--mc-min-samples n]\n"
+                 "                          [--mc-max-samples n] [--seed n] [--rays-per-patch n]\n"
+                 "                          [--stochastic-iterations n] [--stream file]\n"
+                 "                          [--stream-block-mb n] [--read-ahead n]\n"
+                 "                          [--storage double|float|half] [--accumulate float|double]\n"
+                 "                          [--bands 3|4|8|16] [--half-links] [--symmetric]\n"
+                 "                          [--ordered-pairs] [--IBF-eps e] [--importance-iterations n]\n"
+                 "                          [--light-groups n] [--light-batch n] [--float-light-basis]\n"
+                 "                          [--recursive-sweeps] [--active-set t] [--active-threads n]\n"
+                 "                          [--checkpoint file] [--checkpoint-interval n] [--resume]\n"
+                 "                          [--scenes n] [--edit move|add] [--distributed n1,n2,...]\n"
+                 "                          [--distributed-transport sockets|threads]\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::string(argv[1]) == "accuracy")
+        return AccuracyMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "bake")
+        return BakeMain(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "distributed-worker")
+        return DistributedWorkerMain(argc - 1, argv + 1);
+
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--patches" && has_value)
+            options.patch_counts = ParsePatchCounts(argv[++i]);
+        else if (arg == "--occluders" && has_value)
+            options.occluder_count = std::atoi(argv[++i]);
+        else if (arg == "--obj" && has_value)
+            options.obj_path = argv[++i];
+        else if (arg == "--mode" && has_value)
+        {
+            std::string mode = argv[++i];
+            options.run_matrix = mode == "matrix" || mode == "both" || mode == "all";
+            options.run_hierarchical = mode == "hierarchical" || mode == "both" || mode == "all";
+            options.run_stochastic = mode == "stochastic" || mode == "all";
+        }
+        else if (arg == "--iterations" && has_value)
+            options.matrix_iterations = std::atoi(argv[++i]);
+        else if (arg == "--hierarchical-iterations" && has_value)
+            options.hierarchical_iterations = std::atoi(argv[++i]);
+        else if (arg == "--max-pairs" && has_value)
+            options.max_pairs = std::atof(argv[++i]);
+        else if (arg == "--centroid-formfactors")
+            options.solver_options.analytic_formfactors = false;
+        else if (arg == "--hemicube")
+            options.hemicube = true;
+        else if (arg == "--hemicube-resolution" && has_value)
+            options.hemicube_options.resolution = std::atoi(argv[++i]);
+        else if (arg == "--threads" && has_value)
+        {
+            options.hemicube_options.thread_count = std::atoi(argv[i + 1]);
+            options.monte_carlo_options.thread_count = std::atoi(argv[i + 1]);
+            options.stream_options.thread_count = std::atoi(argv[i + 1]);
+            options.stochastic_options.thread_count = std::atoi(argv[++i]);
+        }
+        else if (arg == "--stream" && has_value)
+        {
+            options.stream = true;
+            options.stream_options.path = argv[++i];
+        }
+        else if (arg == "--stream-block-mb" && has_value)
+            options.stream_options.max_block_bytes = (size_t)std::atoi(argv[++i]) << 20;
+        else if (arg == "--read-ahead" && has_value)
+            options.stream_options.read_ahead = std::atoi(argv[++i]);
+        else if (arg == "--symmetric")
+            options.solver_options.symmetric_formfactors = true;
+        else if (arg == "--half-links")
+            options.solver_options.half_link_formfactors = true;
+        else if (arg == "--light-groups" && has_value)
+            options.light_groups = std::atoi(argv[++i]);
+        else if (arg == "--light-batch" && has_value)
+            options.light_basis_options.batch_size = std::atoi(argv[++i]);
+        else if (arg == "--float-light-basis")
+            options.light_basis_options.half_storage = false;
+        else if (arg == "--bands" && has_value)
+            options.spectral_bands = std::atoi(argv[++i]);
+        else if (arg == "--storage" && has_value)
+        {
+            std::string storage = argv[++i];
+            options.solver_options.formfactor_storage = storage == "half" ? FS_Half : storage == "float" ? FS_Float : FS_Double;
+        }
+        else if (arg == "--accumulate" && has_value)
+            options.solver_options.accumulate_precision = std::string(argv[++i]) == "double" ? AP_Double : AP_Float;
+        else if (arg == "--monte-carlo")
+            options.monte_carlo = true;
+        else if (arg == "--mc-error" && has_value)
+            options.monte_carlo_options.relative_error = std::atof(argv[++i]);
+        else if (arg == "--mc-min-samples" && has_value)
+            options.monte_carlo_options.min_samples = std::atoi(argv[++i]);
+        else if (arg == "--mc-max-samples" && has_value)
+            options.monte_carlo_options.max_samples = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value)
+        {
+            options.monte_carlo_options.seed = (unsigned int)std::atoi(argv[i + 1]);
+            options.stochastic_options.seed = (unsigned int)std::atoi(argv[++i]);
+        }
+        else if (arg == "--out" && has_value)
+            options.out_path = argv[++i];
+        else if (arg == "--trace" && has_value)
+            options.trace_path = argv[++i];
+        else if (arg == "--oracle" && has_value)
+        {
+            std::string oracle = argv[++i];
+            options.refine_options.oracle = oracle == "ibf" ? RO_ImportanceBrightness : oracle == "bf" ? RO_BrightnessFormFactor : RO_FormFactor;
+        }
+        else if (arg == "--F-eps" && has_value)
+            options.refine_options.F_eps = std::atof(argv[++i]);
+        else if (arg == "--BF-eps" && has_value)
+            options.refine_options.BF_eps = std::atof(argv[++i]);
+        else if (arg == "--IBF-eps" && has_value)
+            options.refine_options.IBF_eps = std::atof(argv[++i]);
+        else if (arg == "--importance-iterations" && has_value)
+            options.importance_iterations = std::atoi(argv[++i]);
+        else if (arg == "--min-area" && has_value)
+            options.refine_options.min_area = (float)std::atof(argv[++i]);
+        else if (arg == "--min-area-fraction" && has_value)
+            options.refine_options.min_area_fraction = (float)std::atof(argv[++i]);
+        else if (arg == "--max-depth" && has_value)
+            options.refine_options.max_depth = std::atoi(argv[++i]);
+        else if (arg == "--max-links" && has_value)
+            options.refine_options.max_links = std::atoi(argv[++i]);
+        else if (arg == "--max-bytes" && has_value)
+            options.refine_options.max_bytes = (size_t)std::atof(argv[++i]);
+        else if (arg == "--ordered-pairs")
+            options.refine_options.unordered_pairs = false;
+        else if (arg == "--recursive-sweeps")
+            options.solver_options.hierarchy_level_arrays = false;
+        else if (arg == "--active-set" && has_value)
+        {
+            options.active_set = true;
+            options.active_set_options.tolerance = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "--active-threads" && has_value)
+            options.active_set_options.thread_count = std::atoi(argv[++i]);
+        else if (arg == "--checkpoint" && has_value)
+        {
+            options.checkpoint = true;
+            options.checkpoint_options.path = argv[++i];
+        }
+        else if (arg == "--checkpoint-interval" && has_value)
+            options.checkpoint_options.interval = std::atoi(argv[++i]);
+        else if (arg == "--resume")
+            options.resume = true;
+        else if (arg == "--scenes" && has_value)
+            options.concurrent_scenes = std::max<int>(1, std::atoi(argv[++i]));
+        else if (arg == "--edit" && has_value)
+            options.edit = argv[++i];
+        else if (arg == "--distributed" && has_value)
+            options.distributed_workers = ParsePatchCounts(argv[++i]);
+        else if (arg == "--distributed-transport" && has_value)
+            options.distributed_options.transport = std::string(argv[++i]) == "threads" ? DT_Threads : DT_Sockets;
+        else if (arg == "--refine-passes" && has_value)
+            options.refine_passes = std::atoi(argv[++i]);
+        else if (arg == "--simd" && has_value)
+        {
+            std::string level = argv[++i];
+            SetSimdLevel(level == "scalar" ? SIMD_Scalar : level == "sse2" ? SIMD_SSE2 : SIMD_AVX2);
+        }
+        else if (arg == "--rays-per-patch" && has_value)
+            options.stochastic_options.rays_per_patch = std::atoi(argv[++i]);
+        else if (arg == "--stochastic-iterations" && has_value)
+            options.stochastic_options.max_iterations = std::atoi(argv[++i]);
+        else if (arg == "--tolerance" && has_value)
+            options.convergence_tolerance = std::atof(argv[++i]);
+        else if (arg == "--max-convergence-iterations" && has_value)
+            options.max_convergence_iterations = std::atoi(argv[++i]);
+        else
+        {
+            PrintUsage();
+            return -1;
+        }
+    }
+
+    // the edits are only updated incrementally on a matrix of unoccluded patch-pair
+    // estimates (see UpdateDirtyPatches())
+    bool edit_supported = (options.edit == "move" || options.edit == "add") &&
+        !options.hemicube && !options.monte_carlo && !options.stream;
+    if ((options.concurrent_scenes > 1 && (options.stream || options.checkpoint)) ||
+        (!options.edit.empty() && !edit_supported))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    // a loaded model has a fixed size
+    if (!options.obj_path.empty())
+        options.patch_counts = { 0 };
+
+    EnableProfiler(true);
+    ResetProfiler();
+
+    // every run is solved on the default scene, or on several scenes at once
+    auto run_solve = [&](BenchmarkRun (*solve)(const BenchmarkOptions&, int), int patch_count)
+    {
+        if (options.concurrent_scenes > 1)
+            return RunConcurrently(options, patch_count, solve);
+        return solve(options, patch_count);
+    };
+
+    std::vector<BenchmarkRun> runs;
+    for (int patch_count : options.patch_counts)
+    {
+        if (options.run_matrix)
+        {
+            runs.push_back(run_solve(RunMatrix, patch_count));
+            std::cerr << "matrix " << runs.back().patches << " patches done.\n";
+        }
+        if (options.run_hierarchical)
+        {
+            runs.push_back(run_solve(RunHierarchical, patch_count));
+            std::cerr << "hierarchical " << runs.back().patches << " patches done.\n";
+        }
+        if (options.run_stochastic)
+        {
+            runs.push_back(run_solve(RunStochastic, patch_count));
+            std::cerr << "stochastic " << runs.back().patches << " patches done.\n";
+        }
+        if (!options.edit.empty() && options.run_matrix)
+        {
+            runs.push_back(RunEdit(options, patch_count, false));
+            std::cerr << "matrix edit " << runs.back().patches << " patches done.\n";
+        }
+        if (!options.edit.empty() && options.run_hierarchical)
+        {
+            runs.push_back(RunEdit(options, patch_count, true));
+            std::cerr << "hierarchical edit " << runs.back().patches << " patches done.\n";
+        }
+        for (int workers : options.distributed_workers)
+        {
+            runs.push_back(RunDistributed(options, patch_count, workers));
+            std::cerr << "distributed " << runs.back().patches << " patches on " << workers << " workers done.\n";
+        }
+    }
+
+    if (options.out_path.empty())
+    {
+        WriteJSON(std::cout, options, runs);
+    }
+    else
+    {
+        std::ofstream out(options.out_path);
+        if (!out.is_open())
+        {
+            std::cerr << "could not open " << options.out_path << "\n";
+            return -1;
+        }
+        WriteJSON(out, options, runs);
+    }
+
+    if (!options.trace_path.empty() && !WriteChromeTrace(options.trace_path))
+    {
+        std::cerr << "could not write " << options.trace_path << "\n";
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,344 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <checkpoint.h>
+#include <profiler.h>
+#include <DirectXPackedVector.h>
+
+using namespace DirectX;
+
+CheckpointOptions DefaultCheckpointOptions()
+{
+    CheckpointOptions options;
+    options.path = "radiosity.checkpoint";
+    options.interval = 5;
+    return options;
+}
+
+// the file starts with the header. a matrix checkpoint continues with the radiosities
+// of the patches, a hierarchical one with the arrays of all patches and subpatches in
+// preorder (whether they have children, their brightness, importance and number of
+// links) and the arrays of all links (the preorder index of the source and the
+// formfactor as float or, with half_links, as half float).
+struct CheckpointHeader
+{
+    char magic[4];
+    int version;
+    int kind;
+    int patch_count;
+    int iterations;
+    int node_count;
+    int link_count;
+    int half_links;
+    // identifies the scene, see SceneFingerprint()
+    float fingerprint;
+};
+
+const char CheckpointMagic[4] = { 'R', 'C', 'K', 'P' };
+const int CheckpointVersion = 1;
+
+// a sum over the corners and the irradiance of the top-level patches, which is the same
+// for the same scene and lights.
+float SceneFingerprint()
+{
+    float sum = 0.0f;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        for (int corner = 0; corner < 4; corner++)
+        {
+            const XMFLOAT3& position = g_scene->patches[i].vertex_pos[corner];
+            sum += position.x + 2.0f * position.y + 3.0f * position.z;
+        }
+        sum += g_scene->patches[i].irradiance.x + g_scene->patches[i].irradiance.y + g_scene->patches[i].irradiance.z;
+    }
+    return sum;
+}
+
+template<typename T>
+void Append(std::vector<char>& buffer, const T* data, size_t count)
+{
+    const char* bytes = (const char*)data;
+    buffer.insert(buffer.end(), bytes, bytes + count * sizeof(T));
+}
+
+template<typename T>
+bool Read(std::ifstream& file, std::vector<T>& data, size_t count)
+{
+    data.resize(count);
+    file.read((char*)data.data(), (std::streamsize)(count * sizeof(T)));
+    return (bool)file;
+}
+
+void CollectPreorder(Patch& p, std::vector<Patch*>& nodes)
+{
+    nodes.push_back(&p);
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            CollectPreorder(*p.children[child], nodes);
+        }
+    }
+}
+
+void SnapshotMatrix(std::vector<char>& buffer)
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        Append(buffer, &g_scene->patches[i].radiosity, 1);
+    }
+}
+
+void SnapshotHierarchy(std::vector<char>& buffer, CheckpointHeader& header)
+{
+    std::vector<Patch*> nodes;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        CollectPreorder(g_scene->patches[i], nodes);
+    }
+
+    // the links refer to their sources by preorder index instead of the id, which is
+    // given anew when the hierarchy is rebuilt
+    unsigned int max_id = 0;
+    for (Patch* p : nodes)
+    {
+        max_id = std::max<unsigned int>(max_id, p->id);
+    }
+    std::vector<unsigned int> index_by_id(max_id + 1);
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        index_by_id[nodes[n]->id] = (unsigned int)n;
+    }
+
+    std::vector<unsigned char> has_children(nodes.size());
+    std::vector<XMFLOAT3> brightness(nodes.size());
+    std::vector<float> importance(nodes.size());
+    std::vector<int> link_counts(nodes.size());
+    std::vector<unsigned int> sources;
+    sources.reserve(g_scene->link_count);
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        Patch& p = *nodes[n];
+        has_children[n] = p.has_children ? 1 : 0;
+        Float4Store3(brightness[n], p.brightness);
+        importance[n] = p.importance;
+        link_counts[n] = p.influencing_partner_count;
+        for (int k = 0; k < p.influencing_partner_count; k++)
+        {
+            sources.push_back(index_by_id[p.link_sources[k]]);
+        }
+    }
+
+    header.node_count = (int)nodes.size();
+    header.link_count = (int)sources.size();
+    header.half_links = g_scene->solver_options.half_link_formfactors ? 1 : 0;
+    buffer.reserve(buffer.size() + nodes.size() * (sizeof(unsigned char) + sizeof(XMFLOAT3) + sizeof(float) + sizeof(int)) +
+        sources.size() * (sizeof(unsigned int) + (g_scene->solver_options.half_link_formfactors ? sizeof(unsigned short) : sizeof(float))));
+    Append(buffer, has_children.data(), has_children.size());
+    Append(buffer, brightness.data(), brightness.size());
+    Append(buffer, importance.data(), importance.size());
+    Append(buffer, link_counts.data(), link_counts.size());
+    Append(buffer, sources.data(), sources.size());
+    for (Patch* p : nodes)
+    {
+        if (g_scene->solver_options.half_link_formfactors)
+            Append(buffer, p->link_formfactors_half.data(), p->influencing_partner_count);
+        else
+            Append(buffer, p->link_formfactors.data(), p->influencing_partner_count);
+    }
+}
+
+void StartCheckpoints(CheckpointWriter& writer, const CheckpointOptions& options)
+{
+    writer.path = options.path;
+    writer.failed = false;
+    writer.count = 0;
+    writer.bytes = 0;
+    writer.snapshot_seconds = 0.0;
+    writer.stall_seconds = 0.0;
+}
+
+void WriteCheckpoint(CheckpointWriter& writer, CheckpointKind kind, int iterations)
+{
+    PROFILE_SCOPE("checkpoint");
+
+    // only one checkpoint is written at a time, the solver waits if the previous one
+    // isn't finished yet
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (writer.thread.joinable())
+        writer.thread.join();
+    std::chrono::steady_clock::time_point snapshot_start = std::chrono::steady_clock::now();
+    writer.stall_seconds += std::chrono::duration<double>(snapshot_start - start).count();
+
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, CheckpointMagic, sizeof(header.magic));
+    header.version = CheckpointVersion;
+    header.kind = kind;
+    header.patch_count = g_scene->patch_count;
+    header.iterations = iterations;
+    header.fingerprint = SceneFingerprint();
+
+    // the header is completed by the snapshot of the hierarchy
+    std::vector<char> buffer;
+    Append(buffer, &header, 1);
+    if (kind == CK_Matrix)
+        SnapshotMatrix(buffer);
+    else
+        SnapshotHierarchy(buffer, header);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    writer.count++;
+    writer.bytes = buffer.size();
+    writer.snapshot_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshot_start).count();
+
+    // the checkpoint is complete on disk before it replaces the previous one, so a
+    // crash while writing leaves the previous one intact
+    writer.thread = std::thread([&writer, buffer = std::move(buffer)]()
+    {
+        PROFILE_SCOPE("write_checkpoint");
+        std::string temporary_path = writer.path + ".tmp";
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(buffer.data(), (std::streamsize)buffer.size());
+        file.close();
+#ifdef _WIN32
+        bool replaced = MoveFileExA(temporary_path.c_str(), writer.path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        // rename replaces the previous checkpoint atomically on posix
+        bool replaced = std::rename(temporary_path.c_str(), writer.path.c_str()) == 0;
+#endif
+        if (file.fail() || !replaced)
+            writer.failed = true;
+    });
+}
+
+bool FinishCheckpoints(CheckpointWriter& writer)
+{
+    if (writer.thread.joinable())
+        writer.thread.join();
+    return !writer.failed;
+}
+
+// this checks that the preorder describes exactly one hierarchy per top-level patch.
+bool ValidPreorder(const std::vector<unsigned char>& has_children)
+{
+    size_t pending = (size_t)g_scene->patch_count;
+    for (unsigned char children : has_children)
+    {
+        if (pending == 0)
+            return false;
+        if (children)
+            pending += 3;
+        else
+            pending--;
+    }
+    return pending == 0;
+}
+
+// this subdivides the patches of a hierarchy in preorder as recorded in has_children.
+void RebuildPreorder(Patch& p, const std::vector<unsigned char>& has_children, std::vector<Patch*>& nodes)
+{
+    bool subdivided = has_children[nodes.size()] != 0;
+    nodes.push_back(&p);
+    if (!subdivided)
+        return;
+
+    Subdivide(p);
+    for (int child = 0; child < 4; child++)
+    {
+        RebuildPreorder(*p.children[child], has_children, nodes);
+    }
+}
+
+bool LoadHierarchy(std::ifstream& file, const CheckpointHeader& header)
+{
+    size_t node_count = (size_t)header.node_count;
+    size_t link_count = (size_t)header.link_count;
+    std::vector<unsigned char> has_children;
+    std::vector<XMFLOAT3> brightness;
+    std::vector<float> importance;
+    std::vector<int> link_counts;
+    std::vector<unsigned int> sources;
+    std::vector<float> formfactors;
+    std::vector<unsigned short> formfactors_half;
+    if (!Read(file, has_children, node_count) || !Read(file, brightness, node_count) || !Read(file, importance, node_count) ||
+        !Read(file, link_counts, node_count) || !Read(file, sources, link_count))
+        return false;
+    if (header.half_links ? !Read(file, formfactors_half, link_count) : !Read(file, formfactors, link_count))
+        return false;
+
+    size_t links = 0;
+    for (int count : link_counts)
+    {
+        links += (size_t)std::max<int>(count, 0);
+    }
+    if (links != link_count)
+        return false;
+    for (unsigned int source : sources)
+    {
+        if (source >= node_count)
+            return false;
+    }
+    if (!ValidPreorder(has_children))
+        return false;
+
+    // the hierarchies are rebuilt from the top-level patches without their links
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        Patch& p = g_scene->patches[i];
+        DeleteChildren(p);
+        g_scene->link_count -= p.influencing_partner_count;
+        p.influencing_partner_count = 0;
+        p.link_sources.clear();
+        p.link_formfactors.clear();
+        p.link_formfactors_half.clear();
+    }
+    ResetHierarchicalSolution();
+
+    std::vector<Patch*> nodes;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        RebuildPreorder(g_scene->patches[i], has_children, nodes);
+    }
+
+    size_t link = 0;
+    for (size_t n = 0; n < node_count; n++)
+    {
+        Patch& p = *nodes[n];
+        p.brightness = Float4Load3(brightness[n]);
+        p.importance = importance[n];
+        for (int k = 0; k < link_counts[n]; k++, link++)
+        {
+            float ff = header.half_links ? PackedVector::XMConvertHalfToFloat(formfactors_half[link]) : formfactors[link];
+            Link(p, *nodes[sources[link]], ff);
+        }
+    }
+    CompactLinks();
+    return true;
+}
+
+bool LoadCheckpoint(const std::string& path, CheckpointKind kind, int& iterations)
+{
+    PROFILE_SCOPE("load_checkpoint");
+
+    std::ifstream file(path, std::ios::binary);
+    CheckpointHeader header = {};
+    file.read((char*)&header, sizeof(header));
+    if (!file || std::memcmp(header.magic, CheckpointMagic, sizeof(header.magic)) || header.version != CheckpointVersion ||
+        header.kind != kind || header.patch_count != g_scene->patch_count || header.fingerprint != SceneFingerprint() ||
+        header.node_count < 0 || header.link_count < 0)
+        return false;
+
+    if (kind == CK_Matrix)
+    {
+        std::vector<XMFLOAT3> radiosity;
+        if (!Read(file, radiosity, g_scene->patch_count))
+            return false;
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            g_scene->patches[i].radiosity = radiosity[i];
+        }
+    }
+    else if (!LoadHierarchy(file, header))
+        return false;
+
+    iterations = header.iterations;
+    return true;
+}
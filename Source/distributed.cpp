@@ -0,0 +1,554 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <scene_generator.h>
+#include <simd_math.h>
+#include <profiler.h>
+#include <distributed.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <spawn.h>
+
+extern char** environ;
+#endif
+
+using namespace DirectX;
+
+#ifdef _WIN32
+typedef PROCESS_INFORMATION WorkerProcess;
+typedef int SocketLength;
+const int SendFlags = 0;
+#else
+// the winsock names of the bsd socket calls
+typedef int SOCKET;
+const SOCKET INVALID_SOCKET = -1;
+inline int closesocket(SOCKET s) { return close(s); }
+
+typedef pid_t WorkerProcess;
+typedef socklen_t SocketLength;
+// a worker that is gone fails the send instead of ending the process with SIGPIPE
+const int SendFlags = MSG_NOSIGNAL;
+#endif
+
+DistributedOptions DefaultDistributedOptions()
+{
+    DistributedOptions options;
+    options.worker_count = 2;
+    options.iterations = 20;
+    options.transport = DT_Sockets;
+    return options;
+}
+
+const char* GetDistributedTransportName(DistributedTransportKind transport)
+{
+    return transport == DT_Threads ? "threads" : "sockets";
+}
+
+// the coordinator starts a worker with the setup, followed by obj_path_length bytes of
+// the path of the model. the worker answers with ready once it has estimated its rows,
+// then every iteration is the colors of all patches as XMFLOAT3 one way and the
+// radiosity of the rows of the worker the other way.
+struct DistributedSetup
+{
+    char magic[4];
+    int requested_patches;
+    int occluder_count;
+    int first_row;
+    int last_row;
+    int analytic_formfactors;
+    int obj_path_length;
+};
+
+struct DistributedReady
+{
+    int patch_count;
+    int failed;
+    double form_factor_seconds;
+    unsigned long long matrix_bytes;
+};
+
+const char DistributedMagic[4] = { 'R', 'D', 'S', '1' };
+
+// the seconds the coordinator waits for a started worker process to connect.
+const int DistributedConnectSeconds = 30;
+
+// a tcp connection, which is closed with the transport.
+class SocketTransport : public DistributedTransport
+{
+public:
+    explicit SocketTransport(SOCKET socket) : m_socket(socket)
+    {
+        // the messages are sent whole and answered before the next one, so they
+        // shouldn't wait for more data
+        int no_delay = 1;
+        setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+    }
+
+    ~SocketTransport()
+    {
+        closesocket(m_socket);
+    }
+
+    bool Send(const void* data, size_t bytes) override
+    {
+        const char* next = (const char*)data;
+        while (bytes > 0)
+        {
+            int sent = (int)send(m_socket, next, (int)std::min<size_t>(bytes, 1 << 30), SendFlags);
+            if (sent <= 0)
+                return false;
+            next += sent;
+            bytes -= (size_t)sent;
+        }
+        return true;
+    }
+
+    bool Receive(void* data, size_t bytes) override
+    {
+        char* next = (char*)data;
+        while (bytes > 0)
+        {
+            int received = (int)recv(m_socket, next, (int)std::min<size_t>(bytes, 1 << 30), 0);
+            if (received <= 0)
+                return false;
+            next += received;
+            bytes -= (size_t)received;
+        }
+        return true;
+    }
+
+private:
+    SOCKET m_socket;
+};
+
+// one direction of a QueueTransport.
+struct ByteQueue
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<char> bytes;
+    bool closed = false;
+};
+
+// one end of a pair of in-memory queues between two threads. destroying either end
+// closes both directions, so the other end fails instead of waiting forever.
+class QueueTransport : public DistributedTransport
+{
+public:
+    QueueTransport(std::shared_ptr<ByteQueue> outgoing, std::shared_ptr<ByteQueue> incoming) :
+        m_outgoing(outgoing), m_incoming(incoming)
+    {
+    }
+
+    ~QueueTransport()
+    {
+        Close(*m_outgoing);
+        Close(*m_incoming);
+    }
+
+    bool Send(const void* data, size_t bytes) override
+    {
+        std::lock_guard<std::mutex> lock(m_outgoing->mutex);
+        if (m_outgoing->closed)
+            return false;
+        m_outgoing->bytes.insert(m_outgoing->bytes.end(), (const char*)data, (const char*)data + bytes);
+        m_outgoing->changed.notify_all();
+        return true;
+    }
+
+    bool Receive(void* data, size_t bytes) override
+    {
+        std::unique_lock<std::mutex> lock(m_incoming->mutex);
+        m_incoming->changed.wait(lock, [&]() { return m_incoming->bytes.size() >= bytes || m_incoming->closed; });
+        if (m_incoming->bytes.size() < bytes)
+            return false;
+        std::copy(m_incoming->bytes.begin(), m_incoming->bytes.begin() + bytes, (char*)data);
+        m_incoming->bytes.erase(m_incoming->bytes.begin(), m_incoming->bytes.begin() + bytes);
+        return true;
+    }
+
+private:
+    static void Close(ByteQueue& queue)
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.closed = true;
+        queue.changed.notify_all();
+    }
+
+    std::shared_ptr<ByteQueue> m_outgoing;
+    std::shared_ptr<ByteQueue> m_incoming;
+};
+
+// builds the scene of the setup into the bound scene. returns false if the model
+// can't be opened.
+bool BuildDistributedScene(const DistributedSetup& setup, const std::string& obj_path)
+{
+    int emitter_face;
+    if (!obj_path.empty())
+    {
+        if (!std::ifstream(obj_path).is_open())
+            return false;
+        LoadModel(obj_path);
+        emitter_face = 1001;
+    }
+    else
+        emitter_face = GenerateRoom(RoomForPatchCount(setup.requested_patches, setup.occluder_count));
+
+    g_scene->without_hierarch_radiosity = true;
+    CreatePatches(emitter_face);
+    return true;
+}
+
+// the worker side of the solve, on its own scene. it estimates the rows of its setup like
+// EstimateFormFactors(), keeps their sums in its scene to scale them with
+// FormFactorRowScale(), and answers the colors of every iteration with the gathered
+// radiosity of its rows until the coordinator is gone.
+void RunDistributedWorker(DistributedTransport& transport)
+{
+    DistributedSetup setup;
+    if (!transport.Receive(&setup, sizeof(setup)) || std::memcmp(setup.magic, DistributedMagic, sizeof(setup.magic)) ||
+        setup.obj_path_length < 0)
+        return;
+    std::string obj_path(setup.obj_path_length, '\0');
+    if (!transport.Receive(&obj_path[0], obj_path.size()))
+        return;
+
+    Scene scene;
+    SceneScope scope(&scene);
+
+    // the worker estimates its rows with the formfactors of the coordinator
+    g_scene->solver_options.analytic_formfactors = setup.analytic_formfactors != 0;
+
+    DistributedReady ready = {};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!BuildDistributedScene(setup, obj_path) || setup.first_row < 0 || setup.last_row > g_scene->patch_count ||
+        setup.first_row > setup.last_row)
+    {
+        ready.failed = 1;
+        transport.Send(&ready, sizeof(ready));
+        return;
+    }
+
+    int n = g_scene->patch_count;
+    int rows = setup.last_row - setup.first_row;
+    std::vector<float> formfactors((size_t)rows * n);
+    std::vector<float> row_scales(rows);
+    g_scene->formfactor_row_sums = new double[g_scene->patch_capacity]();
+    g_scene->normalise_formfactor_rows = !g_scene->solver_options.analytic_formfactors;
+    {
+        PROFILE_SCOPE("form_factors");
+        for (int r = 0; r < rows; r++)
+        {
+            int i = setup.first_row + r;
+            float* row = &formfactors[(size_t)r * n];
+            for (int j = 0; j < n; j++)
+            {
+                double ff = i != j ? EstimateFormFactor(g_scene->patches[i], g_scene->patches[j]) : 0.0;
+                row[j] = (float)ff;
+                g_scene->formfactor_row_sums[i] += ff;
+            }
+            row_scales[r] = (float)FormFactorRowScale(i);
+        }
+    }
+
+    ready.patch_count = n;
+    ready.form_factor_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ready.matrix_bytes = formfactors.size() * sizeof(float);
+    if (!transport.Send(&ready, sizeof(ready)))
+        return;
+
+    std::vector<XMFLOAT3> colors(n);
+    std::vector<float4> loaded(n);
+    std::vector<XMFLOAT3> radiosity(rows);
+    while (transport.Receive(colors.data(), colors.size() * sizeof(XMFLOAT3)))
+    {
+        PROFILE_SCOPE("iterate");
+        for (int j = 0; j < n; j++)
+        {
+            loaded[j] = Float4Load3(colors[j]);
+        }
+        for (int r = 0; r < rows; r++)
+        {
+            Float4Store3(radiosity[r], Float4Scale(WeightedSum(loaded.data(), &formfactors[(size_t)r * n], n), row_scales[r]));
+        }
+        if (!transport.Send(radiosity.data(), radiosity.size() * sizeof(XMFLOAT3)))
+            return;
+    }
+}
+
+int DistributedWorkerMain(int argc, char* argv[])
+{
+    int port = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: RadiosityBenchmark distributed-worker --port p\n";
+            return -1;
+        }
+    }
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return -1;
+#endif
+
+    int result = -1;
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s != INVALID_SOCKET)
+    {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons((unsigned short)port);
+        if (connect(s, (const sockaddr*)&address, sizeof(address)) == 0)
+        {
+            SocketTransport transport(s);
+            RunDistributedWorker(transport);
+            result = 0;
+        }
+        else
+            closesocket(s);
+    }
+    if (result != 0)
+        std::cerr << "can't connect to port " << port << ".\n";
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return result;
+}
+
+// the workers of a solve and how they are connected.
+struct DistributedWorkers
+{
+    std::vector<std::unique_ptr<DistributedTransport>> transports;
+    std::vector<std::thread> threads;
+    std::vector<WorkerProcess> processes;
+    SOCKET listener = INVALID_SOCKET;
+    bool winsock = false;
+};
+
+bool StartWorkerThreads(DistributedWorkers& workers, int count)
+{
+    for (int w = 0; w < count; w++)
+    {
+        std::shared_ptr<ByteQueue> to_worker = std::make_shared<ByteQueue>();
+        std::shared_ptr<ByteQueue> to_coordinator = std::make_shared<ByteQueue>();
+        workers.transports.push_back(std::unique_ptr<DistributedTransport>(new QueueTransport(to_worker, to_coordinator)));
+        workers.threads.push_back(std::thread([to_worker, to_coordinator]()
+        {
+            QueueTransport transport(to_coordinator, to_worker);
+            RunDistributedWorker(transport);
+        }));
+    }
+    return true;
+}
+
+// starts this executable as a worker which connects to the port.
+bool StartWorkerProcess(int port, WorkerProcess& process)
+{
+#ifdef _WIN32
+    char executable[MAX_PATH];
+    if (GetModuleFileNameA(nullptr, executable, MAX_PATH) == 0)
+        return false;
+    std::string command_line = "\"" + std::string(executable) + "\" distributed-worker --port " + std::to_string(port);
+    STARTUPINFOA startup_info = {};
+    startup_info.cb = sizeof(startup_info);
+    process = {};
+    std::vector<char> arguments(command_line.begin(), command_line.end());
+    arguments.push_back('\0');
+    return CreateProcessA(nullptr, arguments.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup_info, &process) != 0;
+#else
+    // linux names the running executable in /proc
+    char executable[4096];
+    ssize_t length = readlink("/proc/self/exe", executable, sizeof(executable) - 1);
+    if (length <= 0)
+        return false;
+    executable[length] = '\0';
+    std::string port_text = std::to_string(port);
+    char command[] = "distributed-worker";
+    char port_option[] = "--port";
+    char* arguments[] = { executable, command, port_option, &port_text[0], nullptr };
+    return posix_spawn(&process, executable, nullptr, nullptr, arguments, environ) == 0;
+#endif
+}
+
+void WaitForWorkerProcess(WorkerProcess& process)
+{
+#ifdef _WIN32
+    WaitForSingleObject(process.hProcess, INFINITE);
+    CloseHandle(process.hProcess);
+    CloseHandle(process.hThread);
+#else
+    int status;
+    waitpid(process, &status, 0);
+#endif
+}
+
+// starts the worker processes from this executable and accepts their connections on
+// a port of localhost.
+bool StartWorkerProcesses(DistributedWorkers& workers, int count)
+{
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+        return false;
+    workers.winsock = true;
+#endif
+
+    workers.listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (workers.listener == INVALID_SOCKET)
+        return false;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    SocketLength address_length = sizeof(address);
+    if (bind(workers.listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(workers.listener, count) != 0 ||
+        getsockname(workers.listener, (sockaddr*)&address, &address_length) != 0)
+        return false;
+
+    for (int w = 0; w < count; w++)
+    {
+        WorkerProcess process;
+        if (!StartWorkerProcess(ntohs(address.sin_port), process))
+            return false;
+        workers.processes.push_back(process);
+    }
+
+    for (int w = 0; w < count; w++)
+    {
+        fd_set listeners;
+        FD_ZERO(&listeners);
+        FD_SET(workers.listener, &listeners);
+        timeval timeout = { DistributedConnectSeconds, 0 };
+        if (select((int)workers.listener + 1, &listeners, nullptr, nullptr, &timeout) <= 0)
+            return false;
+        SOCKET s = accept(workers.listener, nullptr, nullptr);
+        if (s == INVALID_SOCKET)
+            return false;
+        workers.transports.push_back(std::unique_ptr<DistributedTransport>(new SocketTransport(s)));
+    }
+    return true;
+}
+
+// closes the transports, which ends the workers, and waits for them.
+void StopWorkers(DistributedWorkers& workers)
+{
+    // a process that has connected but wasn't accepted yet fails once the listener is closed
+    workers.transports.clear();
+    if (workers.listener != INVALID_SOCKET)
+        closesocket(workers.listener);
+    for (std::thread& thread : workers.threads)
+    {
+        thread.join();
+    }
+    for (WorkerProcess& process : workers.processes)
+    {
+        WaitForWorkerProcess(process);
+    }
+#ifdef _WIN32
+    if (workers.winsock)
+        WSACleanup();
+#endif
+}
+
+// sends the setups with contiguous blocks of rows and waits until all workers have
+// estimated them.
+bool SetUpWorkers(DistributedWorkers& workers, const DistributedScene& scene, DistributedStats& stats)
+{
+    int count = (int)workers.transports.size();
+    for (int w = 0; w < count; w++)
+    {
+        DistributedSetup setup = {};
+        std::memcpy(setup.magic, DistributedMagic, sizeof(setup.magic));
+        setup.requested_patches = scene.patch_count;
+        setup.occluder_count = scene.occluder_count;
+        setup.first_row = (int)((long long)g_scene->patch_count * w / count);
+        setup.last_row = (int)((long long)g_scene->patch_count * (w + 1) / count);
+        setup.analytic_formfactors = g_scene->solver_options.analytic_formfactors ? 1 : 0;
+        setup.obj_path_length = (int)scene.obj_path.size();
+        if (!workers.transports[w]->Send(&setup, sizeof(setup)) ||
+            !workers.transports[w]->Send(scene.obj_path.data(), scene.obj_path.size()))
+            return false;
+    }
+
+    stats.worker_matrix_bytes = 0;
+    for (int w = 0; w < count; w++)
+    {
+        DistributedReady ready;
+        if (!workers.transports[w]->Receive(&ready, sizeof(ready)) || ready.failed || ready.patch_count != g_scene->patch_count)
+            return false;
+        stats.worker_matrix_bytes = std::max<size_t>(stats.worker_matrix_bytes, (size_t)ready.matrix_bytes);
+    }
+    return true;
+}
+
+bool IterateRadiosityDistributed(const DistributedScene& scene, const DistributedOptions& options, DistributedStats& stats)
+{
+    PROFILE_SCOPE("distributed");
+
+    stats = {};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int count = std::max<int>(1, std::min<int>(options.worker_count, g_scene->patch_count));
+    DistributedWorkers workers;
+    bool started = options.transport == DT_Threads ? StartWorkerThreads(workers, count) : StartWorkerProcesses(workers, count);
+    std::chrono::steady_clock::time_point connected = std::chrono::steady_clock::now();
+    stats.start_seconds = std::chrono::duration<double>(connected - start).count();
+    if (!started || !SetUpWorkers(workers, scene, stats))
+    {
+        StopWorkers(workers);
+        return false;
+    }
+    std::chrono::steady_clock::time_point estimated = std::chrono::steady_clock::now();
+    stats.form_factor_seconds = std::chrono::duration<double>(estimated - connected).count();
+
+    // every worker gets all colors and answers the radiosity of its rows, which is only
+    // stored once all of them have answered, like in IterateRadiosity()
+    int n = g_scene->patch_count;
+    std::vector<XMFLOAT3> colors(n);
+    std::vector<XMFLOAT3> radiosity(n);
+    bool failed = false;
+    for (int run = 0; run < options.iterations && !failed; run++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            GetRadiosity(j, colors[j]);
+        }
+        for (int w = 0; w < count && !failed; w++)
+        {
+            failed = !workers.transports[w]->Send(colors.data(), colors.size() * sizeof(XMFLOAT3));
+        }
+        for (int w = 0; w < count && !failed; w++)
+        {
+            int first_row = (int)((long long)n * w / count);
+            int last_row = (int)((long long)n * (w + 1) / count);
+            failed = !workers.transports[w]->Receive(&radiosity[first_row], (size_t)(last_row - first_row) * sizeof(XMFLOAT3));
+        }
+        if (failed)
+            break;
+        for (int i = 0; i < n; i++)
+        {
+            g_scene->patches[i].radiosity = radiosity[i];
+        }
+        stats.exchanged_bytes += ((size_t)count + 1) * n * sizeof(XMFLOAT3);
+    }
+    stats.iterate_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - estimated).count();
+
+    StopWorkers(workers);
+    return !failed;
+}
@@ -0,0 +1,361 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <formfactor_stream.h>
+#include <profiler.h>
+#include <DirectXPackedVector.h>
+#include <condition_variable>
+#include <deque>
+
+using namespace DirectX;
+
+StreamOptions DefaultStreamOptions()
+{
+    StreamOptions options;
+    options.path = "formfactors.bin";
+    options.max_block_bytes = 64 << 20;
+    options.read_ahead = 2;
+    options.thread_count = 0;
+    return options;
+}
+
+// the file starts with the number of patches, the rows per block and the formfactor
+// storage, followed by the rows of g_scene->patch_count formfactors each, stored like
+// the matrix in memory as doubles, floats or half floats.
+struct StreamHeader
+{
+    int patch_count;
+    int block_rows;
+    int storage;
+};
+
+size_t StreamElementBytes()
+{
+    switch (g_scene->solver_options.formfactor_storage)
+    {
+    case FS_Float: return sizeof(float);
+    case FS_Half: return sizeof(unsigned short);
+    default: return sizeof(double);
+    }
+}
+
+size_t StreamRowBytes()
+{
+    return (size_t)g_scene->patch_count * StreamElementBytes();
+}
+
+int StreamBlockRows(const StreamOptions& options)
+{
+    size_t row_bytes = std::max<size_t>(1, StreamRowBytes());
+    return (int)std::max<size_t>(1, std::min<size_t>(options.max_block_bytes / row_bytes, (size_t)std::max<int>(1, g_scene->patch_count)));
+}
+
+size_t StreamResidentBytes(const StreamOptions& options)
+{
+    size_t buffers = (size_t)std::max<int>(1, options.read_ahead) + 1;
+    return buffers * StreamBlockRows(options) * StreamRowBytes();
+}
+
+// the block buffers passed between the solver and the i/o thread. the producer takes
+// free buffers, fills them and queues them as full ones, the consumer returns them
+// when it's done. both sides block while their queue is empty.
+struct BlockPipeline
+{
+    std::vector<std::vector<unsigned char>> buffers;
+    std::vector<int> buffer_rows;
+    std::deque<int> free_buffers;
+    std::deque<int> full_buffers;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // the producer has queued its last block
+    bool finished;
+    // the i/o gave up, both sides stop. the solver polls it between blocks
+    std::atomic<bool> failed;
+};
+
+void InitPipeline(BlockPipeline& pipeline, const StreamOptions& options, int block_rows)
+{
+    int buffer_count = std::max<int>(1, options.read_ahead) + 1;
+    pipeline.buffers.resize(buffer_count);
+    pipeline.buffer_rows.assign(buffer_count, 0);
+    for (int b = 0; b < buffer_count; b++)
+    {
+        pipeline.buffers[b].resize((size_t)block_rows * StreamRowBytes());
+        pipeline.free_buffers.push_back(b);
+    }
+    pipeline.finished = false;
+    pipeline.failed = false;
+}
+
+// waits for a free buffer, returns -1 if the pipeline failed.
+int TakeFreeBuffer(BlockPipeline& pipeline)
+{
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    pipeline.changed.wait(lock, [&]() { return pipeline.failed || !pipeline.free_buffers.empty(); });
+    if (pipeline.failed)
+        return -1;
+    int b = pipeline.free_buffers.front();
+    pipeline.free_buffers.pop_front();
+    return b;
+}
+
+// waits for the next full buffer, returns -1 after the last one or if the pipeline failed.
+int TakeFullBuffer(BlockPipeline& pipeline)
+{
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    pipeline.changed.wait(lock, [&]() { return pipeline.failed || pipeline.finished || !pipeline.full_buffers.empty(); });
+    if (pipeline.failed || pipeline.full_buffers.empty())
+        return -1;
+    int b = pipeline.full_buffers.front();
+    pipeline.full_buffers.pop_front();
+    return b;
+}
+
+void QueueBuffer(BlockPipeline& pipeline, std::deque<int>& queue, int b)
+{
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        queue.push_back(b);
+    }
+    pipeline.changed.notify_all();
+}
+
+void FinishPipeline(BlockPipeline& pipeline, bool failed)
+{
+    {
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.finished = true;
+        if (failed)
+            pipeline.failed = true;
+    }
+    pipeline.changed.notify_all();
+}
+
+// converts an estimated row into the formfactor storage of the scene, like PackFormFactors().
+void StoreStreamedRow(unsigned char* out, const double* row)
+{
+    int n = g_scene->patch_count;
+    if (g_scene->solver_options.formfactor_storage == FS_Float)
+    {
+        float* stored = (float*)out;
+        for (int j = 0; j < n; j++)
+        {
+            stored[j] = (float)row[j];
+        }
+    }
+    else if (g_scene->solver_options.formfactor_storage == FS_Half)
+    {
+        unsigned short* stored = (unsigned short*)out;
+        for (int j = 0; j < n; j++)
+        {
+            stored[j] = PackedVector::XMConvertFloatToHalf((float)row[j]);
+        }
+    }
+    else
+    {
+        std::copy(row, row + n, (double*)out);
+    }
+}
+
+// estimates the rows [first, first + rows) into a block, parallel over the rows. the
+// row sums are taken from the double estimates before they are stored.
+void EstimateBlock(unsigned char* block, int first, int rows, int thread_count)
+{
+    Scene* scene = g_scene;
+    std::atomic<int> next_row(0);
+    auto worker = [&]()
+    {
+        SceneScope scope(scene);
+        std::vector<double> row(g_scene->patch_count);
+        for (int r = next_row++; r < rows; r = next_row++)
+        {
+            int i = first + r;
+            double sum = 0.0;
+            for (int j = 0; j < g_scene->patch_count; j++)
+            {
+                row[j] = (i != j) ? EstimateFormFactor(g_scene->patches[i], g_scene->patches[j]) : 0.0;
+                sum += row[j];
+            }
+            g_scene->formfactor_row_sums[i] = sum;
+            StoreStreamedRow(&block[(size_t)r * StreamRowBytes()], row.data());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < std::min<int>(thread_count, rows); t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+bool EstimateFormFactorsStreamed(const StreamOptions& options)
+{
+    PROFILE_SCOPE("form_factors");
+
+    ReleaseFormFactors();
+    g_scene->formfactor_row_sums = new double[g_scene->patch_capacity];
+    g_scene->normalise_formfactor_rows = !g_scene->solver_options.analytic_formfactors;
+    g_scene->formfactor_estimator = FE_Streamed;
+
+    std::ofstream file(options.path, std::ios::binary | std::ios::trunc);
+    StreamHeader header = { g_scene->patch_count, StreamBlockRows(options), (int)g_scene->solver_options.formfactor_storage };
+    file.write((const char*)&header, sizeof(header));
+    if (!file)
+        return false;
+
+    BlockPipeline pipeline;
+    InitPipeline(pipeline, options, header.block_rows);
+
+    // the i/o thread writes the full blocks in the order they were queued
+    Scene* scene = g_scene;
+    std::thread writer([&]()
+    {
+        SceneScope scope(scene);
+        for (int b = TakeFullBuffer(pipeline); b >= 0; b = TakeFullBuffer(pipeline))
+        {
+            file.write((const char*)pipeline.buffers[b].data(), (std::streamsize)(pipeline.buffer_rows[b] * StreamRowBytes()));
+            if (!file)
+            {
+                FinishPipeline(pipeline, true);
+                return;
+            }
+            QueueBuffer(pipeline, pipeline.free_buffers, b);
+        }
+    });
+
+    int thread_count = options.thread_count > 0 ? options.thread_count : (int)std::thread::hardware_concurrency();
+    for (int first = 0; first < g_scene->patch_count; first += header.block_rows)
+    {
+        int b = TakeFreeBuffer(pipeline);
+        if (b < 0)
+            break;
+        int rows = std::min<int>(header.block_rows, g_scene->patch_count - first);
+        EstimateBlock(pipeline.buffers[b].data(), first, rows, std::max<int>(1, thread_count));
+        pipeline.buffer_rows[b] = rows;
+        QueueBuffer(pipeline, pipeline.full_buffers, b);
+    }
+    FinishPipeline(pipeline, false);
+    writer.join();
+
+    file.close();
+    return !pipeline.failed && !file.fail();
+}
+
+// multiplies the blocks of every iteration as they arrive, in the precision of
+// Accumulator like IterateRadiosity().
+template<typename Accumulator>
+void IterateStreamedIn(int iterations, BlockPipeline& pipeline, int block_rows)
+{
+    std::vector<Accumulator> red(g_scene->patch_count), green(g_scene->patch_count), blue(g_scene->patch_count);
+    std::vector<float> unpacked_row(g_scene->solver_options.formfactor_storage == FS_Half ? g_scene->patch_count : 0);
+    std::vector<XMFLOAT3> radiosity(g_scene->patch_count);
+    size_t row_bytes = StreamRowBytes();
+    for (int run = 0; run < iterations && !pipeline.failed; run++)
+    {
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            XMFLOAT3 color;
+            GetRadiosity(j, color);
+            red[j] = color.x;
+            green[j] = color.y;
+            blue[j] = color.z;
+        }
+
+        for (int first = 0; first < g_scene->patch_count; first += block_rows)
+        {
+            int b = TakeFullBuffer(pipeline);
+            if (b < 0)
+                break;
+
+            const unsigned char* block = pipeline.buffers[b].data();
+            for (int r = 0; r < pipeline.buffer_rows[b]; r++)
+            {
+                const unsigned char* row = &block[(size_t)r * row_bytes];
+                Accumulator sum[3];
+                if (g_scene->solver_options.formfactor_storage == FS_Float)
+                {
+                    MultiplyRow((const float*)row, red.data(), green.data(), blue.data(), sum);
+                }
+                else if (g_scene->solver_options.formfactor_storage == FS_Half)
+                {
+                    HalfToFloat(unpacked_row.data(), (const unsigned short*)row, g_scene->patch_count);
+                    MultiplyRow(unpacked_row.data(), red.data(), green.data(), blue.data(), sum);
+                }
+                else
+                {
+                    MultiplyRow((const double*)row, red.data(), green.data(), blue.data(), sum);
+                }
+
+                Accumulator scale = (Accumulator)FormFactorRowScale(first + r);
+                radiosity[first + r] = XMFLOAT3((float)(sum[0] * scale), (float)(sum[1] * scale), (float)(sum[2] * scale));
+            }
+            QueueBuffer(pipeline, pipeline.free_buffers, b);
+        }
+
+        if (pipeline.failed)
+            break;
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            g_scene->patches[i].radiosity = radiosity[i];
+        }
+    }
+}
+
+bool IterateRadiosityStreamed(int iterations, const StreamOptions& options)
+{
+    PROFILE_SCOPE("iterate");
+
+    std::ifstream file(options.path, std::ios::binary);
+    StreamHeader header = {};
+    file.read((char*)&header, sizeof(header));
+    if (!file || header.patch_count != g_scene->patch_count || header.block_rows < 1 ||
+        header.storage != (int)g_scene->solver_options.formfactor_storage || !g_scene->formfactor_row_sums)
+        return false;
+
+    BlockPipeline pipeline;
+    InitPipeline(pipeline, options, header.block_rows);
+
+    // the i/o thread reads the blocks of all iterations, so the read-ahead continues
+    // into the next pass over the file while the solver finishes the current one
+    Scene* scene = g_scene;
+    std::thread reader([&]()
+    {
+        SceneScope scope(scene);
+        for (int run = 0; run < iterations; run++)
+        {
+            file.clear();
+            file.seekg(sizeof(header));
+            for (int first = 0; first < g_scene->patch_count; first += header.block_rows)
+            {
+                int b = TakeFreeBuffer(pipeline);
+                if (b < 0)
+                    return;
+                int rows = std::min<int>(header.block_rows, g_scene->patch_count - first);
+                file.read((char*)pipeline.buffers[b].data(), (std::streamsize)(rows * StreamRowBytes()));
+                if (!file)
+                {
+                    FinishPipeline(pipeline, true);
+                    return;
+                }
+                pipeline.buffer_rows[b] = rows;
+                QueueBuffer(pipeline, pipeline.full_buffers, b);
+            }
+        }
+        FinishPipeline(pipeline, false);
+    });
+
+    if (g_scene->solver_options.accumulate_precision == AP_Double)
+        IterateStreamedIn<double>(iterations, pipeline, header.block_rows);
+    else
+        IterateStreamedIn<float>(iterations, pipeline, header.block_rows);
+
+    bool failed = pipeline.failed;
+    FinishPipeline(pipeline, false);
+    reader.join();
+    return !failed;
+}
@@ -0,0 +1,333 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <hemicube.h>
+#include <profiler.h>
+
+using namespace DirectX;
+
+// the five faces of the hemicube. the top face looks along the normal of the patch,
+// the side faces look along the tangents and only their upper half is used.
+enum HemicubeFace
+{
+    HF_Top,
+    HF_PositiveU,
+    HF_NegativeU,
+    HF_PositiveV,
+    HF_NegativeV,
+    NumHemicubeFaces
+};
+
+// a polygon clipped against the near plane has at most one vertex more per clipped edge.
+const int MaxPolygonVertices = 8;
+const float NearPlane = 1.0e-4f;
+
+HemicubeOptions DefaultHemicubeOptions()
+{
+    HemicubeOptions options = {};
+    options.resolution = 128;
+    options.thread_count = 0;
+    return options;
+}
+
+// the z-buffer and the item buffer of one face together with the delta formfactors of
+// its pixels. the rows are padded to a multiple of 4 pixels for the simd rasteriser,
+// the padding has a delta formfactor of 0.
+struct HemicubeFaceBuffer
+{
+    int width;
+    int height;
+    int stride;
+    std::vector<float> delta_formfactors;
+    std::vector<float> inverse_depth;
+    std::vector<int> patch_ids;
+};
+
+struct Hemicube
+{
+    int resolution;
+    HemicubeFaceBuffer faces[NumHemicubeFaces];
+};
+
+// this sets up the buffers of a hemicube and the delta formfactors of its pixels:
+// dA / (pi (x^2 + y^2 + 1)^2) on the top face and z dA / (pi (y^2 + z^2 + 1)^2)
+// on the side faces, with the face spanning [-1,1] and the sides [0,1] upwards.
+void InitHemicube(Hemicube& hemicube, int resolution)
+{
+    hemicube.resolution = resolution;
+    float pixel_size = 2.0f / resolution;
+    float pixel_area = pixel_size * pixel_size;
+
+    for (int f = 0; f < NumHemicubeFaces; f++)
+    {
+        HemicubeFaceBuffer& face = hemicube.faces[f];
+        face.width = resolution;
+        face.height = f == HF_Top ? resolution : resolution / 2;
+        face.stride = (resolution + 3) & ~3;
+        face.delta_formfactors.assign(face.stride * face.height, 0.0f);
+        face.inverse_depth.assign(face.stride * face.height, 0.0f);
+        face.patch_ids.assign(face.stride * face.height, -1);
+
+        for (int y = 0; y < face.height; y++)
+        {
+            for (int x = 0; x < face.width; x++)
+            {
+                float sx = -1.0f + (x + 0.5f) * pixel_size;
+                float sy = (f == HF_Top ? -1.0f : 0.0f) + (y + 0.5f) * pixel_size;
+                float r2 = sx * sx + sy * sy + 1.0f;
+                float ff = pixel_area / (XM_PI * r2 * r2);
+                face.delta_formfactors[y * face.stride + x] = f == HF_Top ? ff : ff * sy;
+            }
+        }
+    }
+}
+
+// maps a point given in the frame (u, v, n) of the hemicube to the camera space of a face,
+// where z looks into the face and y is up.
+XMFLOAT3 ToFaceSpace(int face, const XMFLOAT3& local)
+{
+    switch (face)
+    {
+    case HF_PositiveU: return XMFLOAT3(local.y, local.z, local.x);
+    case HF_NegativeU: return XMFLOAT3(-local.y, local.z, -local.x);
+    case HF_PositiveV: return XMFLOAT3(-local.x, local.z, local.y);
+    case HF_NegativeV: return XMFLOAT3(local.x, local.z, -local.y);
+    default: return local;
+    }
+}
+
+// clips a polygon against the near plane z = NearPlane and returns the new vertex count.
+int ClipNear(const XMFLOAT3* in, int count, XMFLOAT3* out)
+{
+    int out_count = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const XMFLOAT3& a = in[i];
+        const XMFLOAT3& b = in[(i + 1) % count];
+        bool a_inside = a.z >= NearPlane;
+        bool b_inside = b.z >= NearPlane;
+
+        if (a_inside)
+            out[out_count++] = a;
+        if (a_inside != b_inside)
+        {
+            float t = (NearPlane - a.z) / (b.z - a.z);
+            out[out_count++] = XMFLOAT3(a.x + t * (b.x - a.x), a.y + t * (b.y - a.y), NearPlane);
+        }
+    }
+    return out_count;
+}
+
+// rasterises a clipped polygon into a face with a depth test on 1/z. the edge functions
+// and the depth are evaluated for 4 pixels at a time.
+// normal and plane_distance describe the plane of the polygon in face space (normal . p = plane_distance).
+void RasterisePolygon(HemicubeFaceBuffer& face, int face_index, const XMFLOAT3* polygon, int count, const XMFLOAT3& normal, float plane_distance, int patch_id)
+{
+    // to pixel coordinates
+    float half_resolution = face.width * 0.5f;
+    float y_offset = face_index == HF_Top ? 1.0f : 0.0f;
+    float px[MaxPolygonVertices], py[MaxPolygonVertices];
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (int i = 0; i < count; i++)
+    {
+        px[i] = (polygon[i].x / polygon[i].z + 1.0f) * half_resolution;
+        py[i] = (polygon[i].y / polygon[i].z + y_offset) * half_resolution;
+        min_x = std::min<float>(min_x, px[i]);
+        max_x = std::max<float>(max_x, px[i]);
+        min_y = std::min<float>(min_y, py[i]);
+        max_y = std::max<float>(max_y, py[i]);
+    }
+
+    int x0 = std::max<int>(0, (int)std::floor(min_x - 0.5f));
+    int x1 = std::min<int>(face.width - 1, (int)std::ceil(max_x - 0.5f));
+    int y0 = std::max<int>(0, (int)std::floor(min_y - 0.5f));
+    int y1 = std::min<int>(face.height - 1, (int)std::ceil(max_y - 0.5f));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    // the edge functions a x + b y + c, oriented so that the inside is positive
+    double signed_area = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        int j = (i + 1) % count;
+        signed_area += (double)px[i] * py[j] - (double)px[j] * py[i];
+    }
+    if (signed_area == 0.0)
+        return;
+    float orientation = signed_area > 0.0 ? 1.0f : -1.0f;
+
+    float edge_a[MaxPolygonVertices], edge_b[MaxPolygonVertices], edge_c[MaxPolygonVertices];
+    for (int i = 0; i < count; i++)
+    {
+        int j = (i + 1) % count;
+        edge_a[i] = orientation * (py[i] - py[j]);
+        edge_b[i] = orientation * (px[j] - px[i]);
+        edge_c[i] = orientation * (px[i] * py[j] - px[j] * py[i]);
+    }
+
+    // 1/z is affine in screen space: 1/z = (n.x sx + n.y sy + n.z) / d
+    float depth_a = normal.x / (plane_distance * half_resolution);
+    float depth_b = normal.y / (plane_distance * half_resolution);
+    float depth_c = (normal.z - normal.x - normal.y * y_offset) / plane_distance;
+
+    float4 lane_offsets = Float4Set(0.5f, 1.5f, 2.5f, 3.5f);
+    float4 zero = Float4Zero();
+    for (int y = y0; y <= y1; y++)
+    {
+        float center_y = y + 0.5f;
+        float* depth_row = &face.inverse_depth[y * face.stride];
+        int* id_row = &face.patch_ids[y * face.stride];
+
+        for (int x = x0 & ~3; x <= x1; x += 4)
+        {
+            float4 center_x = Float4Add(Float4Replicate((float)x), lane_offsets);
+
+            int mask = 0xF;
+            for (int e = 0; e < count && mask; e++)
+            {
+                float4 edge = Float4MultiplyAdd(center_x, Float4Replicate(edge_a[e]), Float4Replicate(edge_b[e] * center_y + edge_c[e]));
+                mask &= Float4GreaterOrEqualMask(edge, zero);
+            }
+            if (!mask)
+                continue;
+
+            float4 depth = Float4MultiplyAdd(center_x, Float4Replicate(depth_a), Float4Replicate(depth_b * center_y + depth_c));
+            mask &= Float4GreaterMask(depth, Float4Load(depth_row + x));
+            if (!mask)
+                continue;
+
+            float depths[4];
+            Float4Store(depths, depth);
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (mask & (1 << lane))
+                {
+                    depth_row[x + lane] = depths[lane];
+                    id_row[x + lane] = patch_id;
+                }
+            }
+        }
+    }
+}
+
+// this renders all patches into the hemicube of patch i and sums up the delta
+// formfactors of the visible ones into row i of the formfactor matrix.
+void RenderHemicubeRow(Hemicube& hemicube, int i)
+{
+    Patch& p = g_scene->patches[i];
+
+    // the frame of the hemicube follows the first edge of the patch
+    XMVECTOR origin = XMLoadFloat3(&p.centroid);
+    XMVECTOR n = XMLoadFloat3(&p.normal);
+    XMVECTOR u = XMLoadFloat3(&p.vertex_pos[1]) - XMLoadFloat3(&p.vertex_pos[0]);
+    u = XMVector3Normalize(u - XMVector3Dot(u, n) * n);
+    XMVECTOR v = XMVector3Cross(n, u);
+
+    for (int f = 0; f < NumHemicubeFaces; f++)
+    {
+        HemicubeFaceBuffer& face = hemicube.faces[f];
+        std::fill(face.inverse_depth.begin(), face.inverse_depth.end(), 0.0f);
+        std::fill(face.patch_ids.begin(), face.patch_ids.end(), -1);
+    }
+
+    for (int j = 0; j < g_scene->patch_count; j++)
+    {
+        if (j == i)
+            continue;
+        Patch& q = g_scene->patches[j];
+
+        XMFLOAT3 local[4];
+        for (int k = 0; k < 4; k++)
+        {
+            XMVECTOR d = XMLoadFloat3(&q.vertex_pos[k]) - origin;
+            local[k] = XMFLOAT3(XMVectorGetX(XMVector3Dot(d, u)), XMVectorGetX(XMVector3Dot(d, v)), XMVectorGetX(XMVector3Dot(d, n)));
+        }
+        XMVECTOR qn = XMLoadFloat3(&q.normal);
+        XMFLOAT3 local_normal(XMVectorGetX(XMVector3Dot(qn, u)), XMVectorGetX(XMVector3Dot(qn, v)), XMVectorGetX(XMVector3Dot(qn, n)));
+
+        // patches behind the plane of p are not seen
+        if (local[0].z <= 0.0f && local[1].z <= 0.0f && local[2].z <= 0.0f && local[3].z <= 0.0f)
+            continue;
+
+        // a patch seen from behind still occludes, but sends no light to p
+        float plane_distance = local_normal.x * local[0].x + local_normal.y * local[0].y + local_normal.z * local[0].z;
+        if (plane_distance == 0.0f)
+            continue;
+        int patch_id = plane_distance < 0.0f ? j : -1;
+
+        for (int f = 0; f < NumHemicubeFaces; f++)
+        {
+            XMFLOAT3 face_polygon[4];
+            for (int k = 0; k < 4; k++)
+            {
+                face_polygon[k] = ToFaceSpace(f, local[k]);
+            }
+            XMFLOAT3 clipped[MaxPolygonVertices];
+            int count = ClipNear(face_polygon, 4, clipped);
+            if (count < 3)
+                continue;
+
+            RasterisePolygon(hemicube.faces[f], f, clipped, count, ToFaceSpace(f, local_normal), plane_distance, patch_id);
+        }
+    }
+
+    double* row = &g_scene->formfactors[(size_t)i * g_scene->patch_capacity];
+    std::fill(row, row + g_scene->patch_count, 0.0);
+    for (int f = 0; f < NumHemicubeFaces; f++)
+    {
+        HemicubeFaceBuffer& face = hemicube.faces[f];
+        for (int pixel = 0; pixel < face.stride * face.height; pixel++)
+        {
+            int id = face.patch_ids[pixel];
+            if (id >= 0)
+                row[id] += face.delta_formfactors[pixel];
+        }
+    }
+
+    g_scene->formfactor_row_sums[i] = 0.0;
+    for (int j = 0; j < g_scene->patch_count; j++)
+    {
+        g_scene->formfactor_row_sums[i] += row[j];
+    }
+}
+
+void EstimateFormFactorsHemicube(const HemicubeOptions& options)
+{
+    PROFILE_SCOPE("form_factors");
+
+    ReleaseFormFactors();
+    g_scene->formfactors = new double[(size_t)g_scene->patch_capacity * g_scene->patch_capacity];
+    g_scene->formfactor_row_sums = new double[g_scene->patch_capacity];
+    g_scene->normalise_formfactor_rows = false;
+    g_scene->formfactor_estimator = FE_Hemicube;
+
+    int thread_count = options.thread_count > 0 ? options.thread_count : (int)std::thread::hardware_concurrency();
+    thread_count = std::max<int>(1, std::min<int>(thread_count, g_scene->patch_count));
+
+    // the workers take the next row until all rows are done
+    Scene* scene = g_scene;
+    std::atomic<int> next_row(0);
+    auto worker = [&]()
+    {
+        SceneScope scope(scene);
+        Hemicube hemicube;
+        InitHemicube(hemicube, options.resolution);
+        for (int i = next_row++; i < g_scene->patch_count; i = next_row++)
+        {
+            RenderHemicubeRow(hemicube, i);
+            PROFILE_COUNT(PC_FormFactorEvaluations, g_scene->patch_count - 1);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    PackFormFactors();
+}
@@ -0,0 +1,161 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <light_basis.h>
+#include <simd_math.h>
+#include <profiler.h>
+#include <DirectXPackedVector.h>
+
+using namespace DirectX;
+
+LightBasisOptions DefaultLightBasisOptions()
+{
+    LightBasisOptions options;
+    options.iterations = 20;
+    options.batch_size = 8;
+    options.half_storage = true;
+    return options;
+}
+
+std::vector<std::vector<int>> EmitterGroups()
+{
+    std::vector<std::vector<int>> groups;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        const XMFLOAT3& irradiance = g_scene->patches[i].irradiance;
+        if (irradiance.x > 0.0f || irradiance.y > 0.0f || irradiance.z > 0.0f)
+            groups.push_back({ i });
+    }
+    return groups;
+}
+
+// solves the groups [first, first + count) together and stores their colors in the basis.
+// every patch holds 4 floats per group, rgb and a padding, so the stride is 4 * count.
+void SolveLightBasisBatch(const std::vector<std::vector<int>>& groups, int first, int count, int iterations, LightBasis& basis)
+{
+    const int stride = 4 * count;
+    std::vector<float> irradiance((size_t)g_scene->patch_count * stride, 0.0f);
+    std::vector<float> colors((size_t)g_scene->patch_count * stride);
+    std::vector<float> radiosity((size_t)g_scene->patch_count * stride, 0.0f);
+    std::vector<float> next_radiosity((size_t)g_scene->patch_count * stride);
+    std::vector<float> row_buffer(g_scene->patch_count);
+
+    for (int g = 0; g < count; g++)
+    {
+        for (int i : groups[first + g])
+        {
+            float* e = &irradiance[(size_t)i * stride + 4 * g];
+            e[0] = g_scene->patches[i].irradiance.x;
+            e[1] = g_scene->patches[i].irradiance.y;
+            e[2] = g_scene->patches[i].irradiance.z;
+        }
+    }
+
+    // the colors of all groups are gathered once per iteration, like in IterateRadiosity()
+    auto gather_colors = [&]()
+    {
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            const float reflectance[4] = { g_scene->patches[j].reflectance.x, g_scene->patches[j].reflectance.y, g_scene->patches[j].reflectance.z, 0.0f };
+            size_t offset = (size_t)j * stride;
+            for (int k = 0; k < stride; k++)
+            {
+                colors[offset + k] = irradiance[offset + k] + reflectance[k & 3] * radiosity[offset + k];
+            }
+        }
+    };
+
+    for (int run = 0; run < iterations; run++)
+    {
+        gather_colors();
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            const float* row = GetFormFactorRow(i, row_buffer.data());
+            float* sum = &next_radiosity[(size_t)i * stride];
+            WeightedSumBands(sum, colors.data(), row, g_scene->patch_count, stride);
+
+            float scale = (float)FormFactorRowScale(i);
+            for (int k = 0; k < stride; k++)
+            {
+                sum[k] *= scale;
+            }
+        }
+        radiosity.swap(next_radiosity);
+    }
+    gather_colors();
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        for (int g = 0; g < count; g++)
+        {
+            const float* color = &colors[(size_t)i * stride + 4 * g];
+            size_t index = (size_t)i * basis.group_count + first + g;
+            if (basis.half_storage)
+            {
+                basis.colors_half[3 * index] = PackedVector::XMConvertFloatToHalf(color[0]);
+                basis.colors_half[3 * index + 1] = PackedVector::XMConvertFloatToHalf(color[1]);
+                basis.colors_half[3 * index + 2] = PackedVector::XMConvertFloatToHalf(color[2]);
+            }
+            else
+                basis.colors[index] = XMFLOAT3(color[0], color[1], color[2]);
+        }
+    }
+}
+
+void SolveLightBasis(const std::vector<std::vector<int>>& groups, const LightBasisOptions& options, LightBasis& basis)
+{
+    PROFILE_SCOPE("light_basis");
+
+    basis.group_count = (int)groups.size();
+    basis.patch_count = g_scene->patch_count;
+    basis.half_storage = options.half_storage;
+    basis.colors.clear();
+    basis.colors_half.clear();
+    if (basis.half_storage)
+        basis.colors_half.resize((size_t)3 * g_scene->patch_count * basis.group_count);
+    else
+        basis.colors.resize((size_t)g_scene->patch_count * basis.group_count);
+
+    int batch_size = std::max<int>(1, options.batch_size);
+    for (int first = 0; first < basis.group_count; first += batch_size)
+    {
+        SolveLightBasisBatch(groups, first, std::min<int>(batch_size, basis.group_count - first), options.iterations, basis);
+    }
+}
+
+void CombineLightBasis(const LightBasis& basis, const std::vector<XMFLOAT3>& weights, std::vector<XMFLOAT3>& colors)
+{
+    // half floats are unpacked for blocks of patches at a time
+    const int block_patches = 64;
+    colors.resize(basis.patch_count);
+    std::vector<float> unpacked(basis.half_storage ? (size_t)3 * basis.group_count * block_patches : 0);
+    for (int first = 0; first < basis.patch_count; first += block_patches)
+    {
+        int count = std::min<int>(block_patches, basis.patch_count - first);
+        const float* block_colors;
+        if (basis.half_storage)
+        {
+            HalfToFloat(unpacked.data(), &basis.colors_half[(size_t)3 * first * basis.group_count], 3 * basis.group_count * count);
+            block_colors = unpacked.data();
+        }
+        else
+            block_colors = &basis.colors[(size_t)first * basis.group_count].x;
+
+        for (int k = 0; k < count; k++)
+        {
+            const float* group_colors = &block_colors[(size_t)3 * k * basis.group_count];
+            XMFLOAT3 color(0.0f, 0.0f, 0.0f);
+            for (int g = 0; g < basis.group_count; g++)
+            {
+                color.x += weights[g].x * group_colors[3 * g];
+                color.y += weights[g].y * group_colors[3 * g + 1];
+                color.z += weights[g].z * group_colors[3 * g + 2];
+            }
+            colors[first + k] = color;
+        }
+    }
+}
+
+size_t LightBasisBytes(const LightBasis& basis)
+{
+    return basis.colors.size() * sizeof(XMFLOAT3) + basis.colors_half.size() * sizeof(unsigned short);
+}
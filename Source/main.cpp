@@ -1,4 +1,5 @@
 #include <DirectXTemplatePCH.h>
+#include <radiosity.h>
 
 using namespace DirectX;
 
@@ -42,16 +43,6 @@ XMMATRIX g_WorldMatrix;
 XMMATRIX g_ViewMatrix;
 XMMATRIX g_ProjectionMatrix;
 
-// the room as an .obj-model
-OBJ_Model g_room_model;
-
-Patch* g_patches;
-int g_patch_count;
-
-double* g_formfactors;
-
-bool g_without_hierarch_radiosity = true;
-
 // Shader resources
 enum ConstantBuffer
 {
@@ -69,8 +60,6 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
 template<class ShaderClass>
 ShaderClass* LoadShader(const std::wstring& fileName, const std::string& entryPoint, const std::string& profile);
 
-Patch InitPatch(ID3D11Device* device, Vertex v1, Vertex v2, Vertex v3, Vertex v4, XMFLOAT3 normal, XMFLOAT3 reflectance);
-
 bool LoadContent();
 void UnloadContent();
 
@@ -78,110 +67,6 @@ void Update(float deltaTime);
 void Render();
 void Cleanup();
 
-void LoadModel(std::string path)
-{
-    std::ifstream modelFileIFStream;
-    modelFileIFStream.open(path, std::ios::in);
-    std::string line;
-    std::list<XMFLOAT3> positions;
-    std::list<XMFLOAT3> normals;
-    std::list<Face> faces;
-
-    if (modelFileIFStream.is_open())
-    {
-        std::string case_substring;
-        while (std::getline(modelFileIFStream, line))
-        {
-            case_substring = line.substr(0, 2);
-
-            // read vertices
-            if (!case_substring.compare("v "))
-            {
-                g_room_model.vertex_count++;
-
-                XMFLOAT3 position;
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the "v "
-                position.x = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
-
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the x-coord
-                position.y = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
-
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the y-coord
-                position.z = std::atof(line.c_str());
-
-                positions.push_back(position);
-            }
-            // read vertex normals
-            else if (!case_substring.compare("vn"))
-            {
-                XMFLOAT3 normal;
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the "v "
-                normal.x = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
-
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the x-coord
-                normal.y = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
-
-                line = line.substr(line.find_first_of(' ') + 1); // cut away the y-coord
-                normal.z = std::atof(line.c_str());
-
-                normals.push_back(normal);
-            }
-            // read faces
-            else if (!case_substring.compare("f "))
-            {
-                g_room_model.face_count++;
-                
-                Face face = {};
-
-                line = line.substr(2);
-                std::string number_string;
-                number_string = line.substr(0, line.find_first_of(' '));
-                face.vertex_indices[0] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
-                line = line.substr(line.find_first_of(' ') + 1);
-                number_string = line.substr(0, line.find_first_of(' '));
-                face.vertex_indices[1] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
-                line = line.substr(line.find_first_of(' ') + 1);
-                number_string = line.substr(0, line.find_first_of(' '));
-                face.vertex_indices[2] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
-                line = line.substr(line.find_first_of(' ') + 1);
-                number_string = line.substr(0, line.find_first_of(' '));
-                face.vertex_indices[3] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
-                line = line.substr(line.find_first_of('/') + 1);
-                face.normal_index = std::atoi(line.substr(line.find_first_of('/')+1).c_str()) - 1;
-
-                faces.push_back(face);
-            }
-        }
-        modelFileIFStream.close();
-    }
-
-    int vi = 0;
-    std::list<Vertex> vertices = {};
-    for (auto p_it = positions.begin(); p_it != positions.end(); p_it++)
-    {
-        int ni = -1;
-        for (auto f_it = faces.begin(); f_it != faces.end(); f_it++)
-        {
-            if (f_it->vertex_indices[0] == vi || f_it->vertex_indices[1] == vi || f_it->vertex_indices[2] == vi || f_it->vertex_indices[3] == vi)
-            {
-                ni = f_it->normal_index;
-                break;
-            }
-        }
-        assert(ni != -1);
-        auto n_it = normals.begin();
-        std::advance(n_it, ni);
-        vertices.push_back({ *p_it, *n_it, XMFLOAT3(0.0f, 0.0f, 0.0f) });
-        vi++;
-    }
-
-    g_room_model.vertices = new Vertex[g_room_model.vertex_count];
-    g_room_model.faces = new Face[g_room_model.face_count];
-
-    std::copy(vertices.begin(), vertices.end(), g_room_model.vertices);
-    std::copy(faces.begin(), faces.end(), g_room_model.faces);
-}
-
 /**
  * Initialize the application window.
  */
@@ -637,92 +522,23 @@ ShaderClass* LoadShader(const std::wstring& fileName, const std::string& entryPo
     return pShader;
 }
 
-// Creates a Patch and returns it.
-Patch InitPatch(XMFLOAT3 pos[4], XMFLOAT3 irradiance)
-{
-    Patch p = {};
-    p.vertex_pos[0] = pos[0];
-    p.vertex_pos[1] = pos[1];
-    p.vertex_pos[2] = pos[2];
-    p.vertex_pos[3] = pos[3];
-
-    XMVECTOR acc = {0.0f, 0.0f, 0.0f};
-    for (int i = 0; i < 4; i++)
-    {
-        XMVECTOR vp = XMLoadFloat3(&p.vertex_pos[i]);
-        acc = XMVectorAdd(acc, vp);
-    }
-    acc /= 4;
-    XMStoreFloat3(&p.centroid, acc);
-
-    p.radiosity = { 0.0f, 0.0f, 0.0f };
-    p.irradiance = irradiance;
-
-    XMVECTOR edge1 = XMLoadFloat3(&p.vertex_pos[0]) - XMLoadFloat3(&p.vertex_pos[1]);
-    XMVECTOR edge2 = XMLoadFloat3(&p.vertex_pos[1]) - XMLoadFloat3(&p.vertex_pos[2]);
-    XMVECTOR edge3 = XMLoadFloat3(&p.vertex_pos[2]) - XMLoadFloat3(&p.vertex_pos[3]);
-    XMVECTOR edge4 = XMLoadFloat3(&p.vertex_pos[3]) - XMLoadFloat3(&p.vertex_pos[0]);
-
-    XMVECTOR crossproduct1 = XMVector3Cross(edge1, edge2);
-    XMVECTOR crossproduct2 = XMVector3Cross(edge3, edge4);
-
-    XMStoreFloat3(&p.normal, XMVector3Normalize(crossproduct1));
-
-    if (p.normal.x == 1.0f)
-        p.reflectance = { 1.0f, 1.0f, 1.0f }; // left
-    else if (p.normal.x == -1.0f)
-        p.reflectance = { 1.0f, 1.0f, 1.0f }; // right
-    else if (p.normal.y == 1.0f)
-        p.reflectance = { 0.3f, 0.3f, 0.3f }; // bottom
-    else if (p.normal.y == -1.0f)
-        p.reflectance = { 0.3f, 0.3f, 0.3f }; // top
-    else if (p.normal.z == 1.0f)
-        p.reflectance = { 1.0f, 1.0f, 1.0f }; // back
-    else if (p.normal.z == -1.0f)
-        p.reflectance = { 1.0f, 1.0f, 1.0f }; // front
-
-    p.area = 0.5f * std::abs(XMVector3Length(crossproduct1).m128_f32[0]) + std::abs(XMVector3Length(crossproduct2).m128_f32[0]);
-
-    p.influencing_partner_count = 0;
-    p.influencing_partners = {};
-    p.influencing_partner_formfactors = {};
-    p.has_children = false;
-    p.has_parent = false;
-    p.parent = nullptr;
-    p.children = new Patch*[4];
-
-    p.gathered_brightness = { 0.0f, 0.0f, 0.0f };
-    p.brightness = { 0.0f, 0.0f, 0.0f };
-
-    return p;
-}
-
 // Builds the Vertex and Index Buffers for all patches
 void BuildPatchBuffers(ID3D11Device* device)
 {
-    for (int patch = 0; patch < g_room_model.face_count; patch++)
+    for (int patch = 0; patch < g_scene->patch_count; patch++)
     {
+        // buffers of a previous solution are replaced
+        SafeRelease(g_scene->patches[patch].vertex_buffer);
+        SafeRelease(g_scene->patches[patch].index_buffer);
+
         XMFLOAT3 color;
-        if (g_without_hierarch_radiosity)
-        {
-            float x = g_patches[patch].irradiance.x + g_patches[patch].reflectance.x * g_patches[patch].radiosity.x;
-            float y = g_patches[patch].irradiance.y + g_patches[patch].reflectance.y * g_patches[patch].radiosity.y;
-            float z = g_patches[patch].irradiance.z + g_patches[patch].reflectance.z * g_patches[patch].radiosity.z;
-            color = { x, y, z };
-        }
-        else
-        {
-            float x = g_patches[patch].irradiance.x + g_patches[patch].reflectance.x * g_patches[patch].brightness.m128_f32[0];
-            float y = g_patches[patch].irradiance.y + g_patches[patch].reflectance.y * g_patches[patch].brightness.m128_f32[1];
-            float z = g_patches[patch].irradiance.z + g_patches[patch].reflectance.z * g_patches[patch].brightness.m128_f32[2];
-            color = { x, y, z };
-        }
+        GetPatchColor(patch, color);
 
         Vertex* vertices = new Vertex[4];
-        vertices[0] = { g_patches[patch].vertex_pos[0], g_patches[patch].normal, color };
-        vertices[1] = { g_patches[patch].vertex_pos[1], g_patches[patch].normal, color };
-        vertices[2] = { g_patches[patch].vertex_pos[2], g_patches[patch].normal, color };
-        vertices[3] = { g_patches[patch].vertex_pos[3], g_patches[patch].normal, color };
+        vertices[0] = { g_scene->patches[patch].vertex_pos[0], g_scene->patches[patch].normal, color };
+        vertices[1] = { g_scene->patches[patch].vertex_pos[1], g_scene->patches[patch].normal, color };
+        vertices[2] = { g_scene->patches[patch].vertex_pos[2], g_scene->patches[patch].normal, color };
+        vertices[3] = { g_scene->patches[patch].vertex_pos[3], g_scene->patches[patch].normal, color };
 
         D3D11_BUFFER_DESC vertexBufferDesc;
         ZeroMemory(&vertexBufferDesc, sizeof(D3D11_BUFFER_DESC));
@@ -737,7 +553,7 @@ void BuildPatchBuffers(ID3D11Device* device)
 
         resourceData.pSysMem = vertices;
 
-        HRESULT hr = device->CreateBuffer(&vertexBufferDesc, &resourceData, &g_patches[patch].vertex_buffer);
+        HRESULT hr = device->CreateBuffer(&vertexBufferDesc, &resourceData, &g_scene->patches[patch].vertex_buffer);
 
         WORD* indices = new WORD[6]{ 0, 1, 2, 2, 3, 0 };
 
@@ -752,394 +568,10 @@ void BuildPatchBuffers(ID3D11Device* device)
         ZeroMemory(&resourceData, sizeof(D3D11_SUBRESOURCE_DATA));
         resourceData.pSysMem = indices;
 
-        hr = device->CreateBuffer(&indexBufferDesc, &resourceData, &g_patches[patch].index_buffer);
+        hr = device->CreateBuffer(&indexBufferDesc, &resourceData, &g_scene->patches[patch].index_buffer);
     }    
 }
 
-// Estimates all formfactors quickly and packs them into a global array g_formfactors.
-void EstimateFormFactors()
-{
-    int patch_count = g_room_model.face_count;
-    g_formfactors = new double[patch_count * patch_count];
-
-    int count = 0;
-    for (int i = 0; i < patch_count; i++)
-    {
-        for (int j = 0; j < patch_count; j++)
-        {
-            double ff = 0.0;
-            if (i != j)
-            {
-                // calculate formfactor from path i to path j:
-
-                XMVECTOR ni = XMLoadFloat3(&g_patches[i].normal);
-                XMVECTOR nj = XMLoadFloat3(&g_patches[j].normal);
-                XMVECTOR ci = XMLoadFloat3(&g_patches[i].centroid);
-                XMVECTOR cj = XMLoadFloat3(&g_patches[j].centroid);
-                double dAi = g_patches[i].area;
-                double dAj = g_patches[j].area;
-
-                XMVECTOR vecDist = cj - ci;
-                double dRadius = XMVector3Length(vecDist).m128_f32[0];
-                XMVECTOR vecDir = vecDist;
-                vecDir = XMVector3Normalize(vecDir);
-
-                double cosPhiI = XMVector3Dot(vecDir, ni).m128_f32[0];
-                double cosPhiJ = XMVector3Dot(-vecDir, nj).m128_f32[0];
-
-                if (cosPhiI < 0.0)
-                {
-                    cosPhiI = 0.0;
-                }
-                if (cosPhiJ < 0.0)
-                {
-                    cosPhiJ = 0.0;
-                }
-
-                ff = cosPhiI * cosPhiJ * dAj / dRadius / dRadius / XM_PI;
-            }
-
-            g_formfactors[count++] = ff;
-        }
-    }
-
-    count = 0;
-    double* sums = new double[patch_count];
-    for (int i = 0; i < patch_count; ++i)
-    {
-        sums[i] = 0.0;
-        for (int j = 0; j < patch_count; ++j)
-        {
-            sums[i] += g_formfactors[count++];
-        }
-    }
-
-    count = 0;
-    for (int i = 0; i < patch_count; ++i)
-    {
-        for (int j = 0; j < patch_count; ++j)
-        {
-            g_formfactors[count++] /= sums[i];
-        }
-    }
-
-    delete[] sums;
-}
-
-// returns the actual color, computed by adding the irradiance to the product of reflectance and brightness(radiosity)
-void GetRadiosity(int patch_index, XMFLOAT3& color)
-{
-    float x = g_patches[patch_index].irradiance.x + g_patches[patch_index].reflectance.x * g_patches[patch_index].radiosity.x;
-    float y = g_patches[patch_index].irradiance.y + g_patches[patch_index].reflectance.y * g_patches[patch_index].radiosity.y;
-    float z = g_patches[patch_index].irradiance.z + g_patches[patch_index].reflectance.z * g_patches[patch_index].radiosity.z;
-    color = { x, y, z };
-}
-
-// this is the normal radiosity iteration
-void IterateRadiosity()
-{
-    static int run_count = 0;
-    static XMVECTOR* radiosity = new XMVECTOR[g_room_model.face_count];
-    while (run_count < 20)
-    {
-        int i, j, count= 0;
-
-        for (i = 0; i < g_room_model.face_count; ++i)
-        {
-            radiosity[i] = XMVECTOR{ 0.0, 0.0, 0.0, 0.0 };
-
-            for (j = 0; j < g_room_model.face_count; ++j)
-            {
-                double dFormFactor = g_formfactors[count++];
-                XMFLOAT3 color;
-                GetRadiosity(j, color);
-                radiosity[i] = XMVectorAdd(radiosity[i], XMVectorScale(XMLoadFloat3(&color), dFormFactor));
-            }
-
-        }
-
-        for (i = 0; i < g_room_model.face_count; ++i)
-        {
-            XMStoreFloat3(&g_patches[i].radiosity, radiosity[i]);
-        }
-
-        run_count++;
-    }
-    delete[] radiosity;
-}
-
-// this returns a formfactor estimation between to patches
-double EstimateFormFactor(Patch &p, Patch &q)
-{
-    const XMVECTOR& ni = XMLoadFloat3(&p.normal);
-    const XMVECTOR& nj = XMLoadFloat3(&q.normal);
-    const XMVECTOR& ci = XMLoadFloat3(&p.centroid);
-    const XMVECTOR& cj = XMLoadFloat3(&q.centroid);
-    double dAi = p.area;
-    double dAj = q.area;
-
-    XMVECTOR vecDist = cj - ci;
-    double dRadius = XMVector3Length(vecDist).m128_f32[0];
-    XMVECTOR vecDir = vecDist;
-    vecDir = XMVector3Normalize(vecDir);
-
-    double cosPhiI = XMVector3Dot(vecDir, ni).m128_f32[0];
-    double cosPhiJ = XMVector3Dot(-vecDir, nj).m128_f32[0];
-
-    if (cosPhiI < 0.0)
-    {
-        cosPhiI = 0.0;
-    }
-    if (cosPhiJ < 0.0)
-    {
-        cosPhiJ = 0.0;
-    }
-
-    return cosPhiI * cosPhiJ * dAj / dRadius / dRadius / XM_PI;
-}
-
-// this function links two patches for hierarchical gathering
-void Link(Patch& p, Patch& q, double ff_ptoq, double ff_qtop)
-{
-    p.influencing_partners.push_back(&q);
-    p.influencing_partner_count++;
-    p.influencing_partner_formfactors.push_back(ff_qtop);
-}
-
-// this function checks if a patch is still divisible concerning its 
-// area threshold.
-bool SubdivPossible(Patch &p)
-{
-    return p.area > 0.3f;
-}
-
-// this function subdivides a patch.
-void Subdivide(Patch& p)
-{
-    if (p.has_children)
-        return;
-
-    Patch* nw = new Patch();
-    Patch* ne = new Patch();
-    Patch* se = new Patch();
-    Patch* sw = new Patch();
-
-    XMVECTOR v0 = XMLoadFloat3(&p.vertex_pos[0]);
-    XMVECTOR v1 = XMLoadFloat3(&p.vertex_pos[1]);
-    XMVECTOR v2 = XMLoadFloat3(&p.vertex_pos[2]);
-    XMVECTOR v3 = XMLoadFloat3(&p.vertex_pos[3]);
-
-    XMVECTOR v0v1 = XMVectorSubtract(v1, v0);
-    XMVECTOR v1v2 = XMVectorSubtract(v2, v1);
-    XMVECTOR v2v3 = XMVectorSubtract(v3, v2);
-    XMVECTOR v3v0 = XMVectorSubtract(v0, v3);
-
-    XMVECTOR v4 = XMVectorAdd(v0, XMVectorScale(v0v1, 0.5f));
-    XMVECTOR v5 = XMVectorAdd(v1, XMVectorScale(v1v2, 0.5f));
-    XMVECTOR v6 = XMVectorAdd(v2, XMVectorScale(v2v3, 0.5f));
-    XMVECTOR v7 = XMVectorAdd(v3, XMVectorScale(v3v0, 0.5f));
-
-    XMVECTOR v8 = XMVectorAdd(v4, XMVectorScale(XMVectorSubtract(v6, v4), 0.5f));// middlepoint
-
-    XMFLOAT3 v0f, v1f, v2f, v3f, v4f, v5f, v6f, v7f, v8f;
-
-    XMStoreFloat3(&v0f, v0);
-    XMStoreFloat3(&v1f, v1);
-    XMStoreFloat3(&v2f, v2);
-    XMStoreFloat3(&v3f, v3);
-    XMStoreFloat3(&v4f, v4);
-    XMStoreFloat3(&v5f, v5);
-    XMStoreFloat3(&v6f, v6);
-    XMStoreFloat3(&v7f, v7);
-    XMStoreFloat3(&v8f, v8);
-
-    XMFLOAT3 vertices1[4] = { v1f, v4f, v8f, v7f };
-    *nw = InitPatch(vertices1, p.reflectance);
-    XMFLOAT3 vertices2[4] = { v4f, v1f, v5f, v8f };
-    *ne = InitPatch(vertices2, p.reflectance);
-    XMFLOAT3 vertices3[4] = { v8f, v5f, v2f, v6f };
-    *se = InitPatch(vertices3, p.reflectance);
-    XMFLOAT3 vertices4[4] = { v7f, v8f, v6f, v3f };
-    *sw = InitPatch(vertices4, p.reflectance);
-
-    nw->has_parent = true;
-    nw->parent = &p;
-
-    p.has_children = true;
-    p.children[0] = nw;
-    p.children[1] = ne;
-    p.children[2] = se;
-    p.children[3] = sw;
-}
-
-// this is the known refine-algorithm from the 1984-paper for rapid hierarchical
-// radiosity.
-int Refine(Patch &p, Patch &q, double F_eps)
-{
-    double ff_ptoq = EstimateFormFactor(p, q);
-    double ff_qtop = EstimateFormFactor(q, p);
-
-    static int subdivisions = 0;
-
-    if (ff_ptoq < F_eps && ff_qtop < F_eps)
-    {
-        Link(p, q, ff_ptoq, ff_qtop);
-    }
-    else if (ff_ptoq >= ff_qtop && SubdivPossible(q))
-    {
-        Subdivide(q);
-        Refine(p, *q.children[0], F_eps);
-        Refine(p, *q.children[1], F_eps);
-        Refine(p, *q.children[2], F_eps);
-        Refine(p, *q.children[3], F_eps);
-        subdivisions++;
-    }
-    else if (ff_ptoq >= ff_qtop && !SubdivPossible(q))
-    {
-        Link(p, q, ff_ptoq, ff_qtop);
-    }
-    else if(ff_ptoq < ff_qtop && SubdivPossible(p))
-    {
-        Subdivide(p);
-        Refine(q, *p.children[0], F_eps);
-        Refine(q, *p.children[1], F_eps);
-        Refine(q, *p.children[2], F_eps);
-        Refine(q, *p.children[3], F_eps);
-        subdivisions++;
-    }
-    else if (ff_ptoq < ff_qtop && !SubdivPossible(p))
-    {
-        Link(p, q, ff_ptoq, ff_qtop);
-    }
-    return subdivisions;
-}
-
-// this is a helper function for vectors.
-XMVECTOR CompwiseMult(XMVECTOR& v1, XMVECTOR& v2)
-{
-    float x = v1.m128_f32[0] * v2.m128_f32[0];
-    float y = v1.m128_f32[1] * v2.m128_f32[1];
-    float z = v1.m128_f32[2] * v2.m128_f32[2];
-    return { x, y, z };
-}
-
-// this returns the actual color brightness in the hierarchical radiosity method.
-void GetBrightness(Patch& p, XMFLOAT3& color)
-{
-    float x = p.irradiance.x + p.reflectance.x * p.brightness.m128_f32[0];
-    float y = p.irradiance.y + p.reflectance.y * p.brightness.m128_f32[1];
-    float z = p.irradiance.z + p.reflectance.z * p.brightness.m128_f32[2];
-    color = { x, y, z };
-}
-
-// this returns the actual color brightness gathered in the latest iteration 
-// in the hierarchical radiosity method.
-void GetGatheredBrightness(Patch& p, XMFLOAT3& color)
-{
-    float x = p.irradiance.x + p.reflectance.x * p.gathered_brightness.m128_f32[0];
-    float y = p.irradiance.y + p.reflectance.y * p.gathered_brightness.m128_f32[1];
-    float z = p.irradiance.z + p.reflectance.z * p.gathered_brightness.m128_f32[2];
-    color = { x, y, z };
-}
-
-// this is the gather-algorithm to compute the radiosities from all linked patches of a patch
-// in one iteration. it is part of the hierarchical radiosity method.
-void Gather(Patch& p)
-{
-    p.gathered_brightness = { 0.0, 0.0, 0.0 };
-    for (int i = 0; i < p.influencing_partner_count; i++)
-    {
-        auto ff_it = p.influencing_partner_formfactors.begin();
-        std::advance(ff_it, i);
-        double ff = *ff_it;
-
-        auto partner_it = p.influencing_partners.begin();
-        std::advance(partner_it, i);
-
-        XMVECTOR color = XMLoadFloat3(&p.reflectance);
-        XMFLOAT3 partner_brightness;
-        GetBrightness(**partner_it, partner_brightness);
-        XMVECTOR partner_brightness_v = XMLoadFloat3(&partner_brightness);
-        
-        p.gathered_brightness = XMVectorAdd(p.gathered_brightness, XMVectorScale(CompwiseMult(partner_brightness_v, color), ff));
-                
-        if (p.has_children)
-        {
-            for (int child = 0; child < 4; child++)
-            {
-                Gather(*p.children[child]);
-            }
-        }
-    }
-}
-
-// this function pushes the brightness values down to its subpatches.
-void PushBrightness(Patch& p)
-{
-    if (p.has_children)
-    {
-        XMFLOAT3 patch_brightness;
-        GetGatheredBrightness(p, patch_brightness);
-        XMVECTOR patch_brightness_v = XMLoadFloat3(&patch_brightness);
-        for (int child = 0; child < 4; child++)
-        {
-            Patch& c = *p.children[child];
-            c.gathered_brightness = XMVectorAdd(c.gathered_brightness, p.gathered_brightness);
-            PushBrightness(c);
-        }
-    }
-}
-
-// this function pulls the brightness values of its subpatches and averages them out.
-XMVECTOR PullBrightness(Patch& p)
-{
-    if (p.has_children)
-    {
-        XMVECTOR accumulate_brightness = {0.0f, 0.0f, 0.0f};
-        for (int child = 0; child < 4; child++)
-        {
-            Patch& c = *p.children[child];
-            accumulate_brightness = XMVectorAdd(accumulate_brightness, PullBrightness(c));
-        }
-        return XMVectorScale(accumulate_brightness, 0.25f);
-    }
-    else
-    {
-        return p.gathered_brightness;
-    }
-}
-
-// this is the function which iterates the hierarchical radiosity method.
-// it has a intentionally small amount of iterations so that it doesn't take too long.
-void IterateHierarchicalRadiosity()
-{
-    for (int iterations = 0; iterations < 2; iterations++)
-    {
-        char buffer[256];
-        for (int i = 0; i < g_patch_count; i++)
-        {
-            Gather(g_patches[i]);
-
-            sprintf_s(buffer, "%d out of %d gathering-progression.\n", i + 1, g_patch_count);
-            OutputDebugStringA(buffer);
-        }
-        for (int i = 0; i < g_patch_count; i++)
-        {
-            PushBrightness(g_patches[i]);
-
-            sprintf_s(buffer, "%d out of %d push-progression.\n", i + 1, g_patch_count);
-            OutputDebugStringA(buffer);
-        }
-        for (int i = 0; i < g_patch_count; i++)
-        {
-            g_patches[i].brightness = PullBrightness(g_patches[i]);
-
-            sprintf_s(buffer, "%d out of %d pull-progression.\n", i + 1, g_patch_count);
-            OutputDebugStringA(buffer);
-        }
-    }
-}
-
 // this function loads all necessary content for the rendering.
 bool LoadContent()
 {
@@ -1147,47 +579,17 @@ bool LoadContent()
 
     LoadModel(R"(..\Models\radiosity_room.obj)");
 
-    // create patches
-    g_patches = new Patch[g_room_model.face_count];
-    XMFLOAT3 irradiance;
-    XMFLOAT3 v_pos[4];
-    for (int face_index = 0; face_index < g_room_model.face_count; face_index++)
-    {
-        Face& face = g_room_model.faces[face_index];
+    CreatePatches(1001);
 
-        for (int i = 0; i < 4; i++)
-        {
-            v_pos[i] = g_room_model.vertices[face.vertex_indices[i]].position;
-        }
-
-        if (face_index == 1001)
-            irradiance = { 200.0f, 170.0f, 150.0f }; // warm light
-        else
-            irradiance = { 0.0f, 0.0f, 0.0f };
-
-        g_patches[face_index] = InitPatch(v_pos, irradiance);
-        g_patch_count++;
-    }
-
-    if (g_without_hierarch_radiosity)
+    if (g_scene->without_hierarch_radiosity)
     {
         EstimateFormFactors();
-        IterateRadiosity();
+        IterateRadiosity(20);
     }
     else
     {
-        char buffer[256];
-        for (int i = 0; i < g_patch_count; i++)
-        {
-            for (int j = 0; j < g_patch_count; j++)
-            {
-                if (i != j)
-                {
-                    Refine(g_patches[i], g_patches[j], 0.1f);
-                }
-            }
-        }
-        IterateHierarchicalRadiosity();
+        RefineAll(g_scene->refine_options);
+        IterateHierarchicalRadiosity(2);
     }
 
     BuildPatchBuffers(g_d3dDevice);
@@ -1347,10 +749,10 @@ void Render()
     g_d3dDeviceContext->OMSetRenderTargets(1, &g_d3dRenderTargetView, g_d3dDepthStencilView);
     g_d3dDeviceContext->OMSetDepthStencilState(g_d3dDepthStencilState, 1);
 
-    for (int patch = 0; patch < g_room_model.face_count; patch++)
+    for (int patch = 0; patch < g_scene->patch_count; patch++)
     {
-        g_d3dDeviceContext->IASetVertexBuffers(0, 1, &(g_patches[patch].vertex_buffer), &vertexStride, &offset);
-        g_d3dDeviceContext->IASetIndexBuffer(g_patches[patch].index_buffer, DXGI_FORMAT_R16_UINT, 0);
+        g_d3dDeviceContext->IASetVertexBuffers(0, 1, &(g_scene->patches[patch].vertex_buffer), &vertexStride, &offset);
+        g_d3dDeviceContext->IASetIndexBuffer(g_scene->patches[patch].index_buffer, DXGI_FORMAT_R16_UINT, 0);
         g_d3dDeviceContext->DrawIndexed(6, 0, 0);
     }
 
@@ -0,0 +1,545 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <montecarlo.h>
+#include <profiler.h>
+#include <worker_pool.h>
+
+using namespace DirectX;
+
+MonteCarloOptions DefaultMonteCarloOptions()
+{
+    MonteCarloOptions options = {};
+    options.min_samples = 16;
+    options.max_samples = 256;
+    options.relative_error = 0.05;
+    options.seed = 1;
+    options.thread_count = 0;
+    return options;
+}
+
+// a small random number generator (splitmix64). it is cheap to seed, so every patch
+// pair and every worker can have its own stream.
+struct RandomStream
+{
+    unsigned long long state;
+
+    unsigned long long NextBits()
+    {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // a float in [0, 1)
+    float NextFloat()
+    {
+        return (NextBits() >> 40) * (1.0f / 16777216.0f);
+    }
+};
+
+RandomStream SeedStream(unsigned int seed, unsigned int a, unsigned int b)
+{
+    RandomStream stream = { ((unsigned long long)seed << 32) ^ ((unsigned long long)a * 0x100000001B3ull) ^ b };
+    // mixes the seed, so that neighbouring pairs don't start with similar states
+    stream.state = stream.NextBits();
+    return stream;
+}
+
+// the points on a patch are interpolated bilinearly between its vertices.
+void SamplePatch(const Patch& p, float s, float t, float point[3])
+{
+    const float* v0 = &p.vertex_pos[0].x;
+    const float* v1 = &p.vertex_pos[1].x;
+    const float* v2 = &p.vertex_pos[2].x;
+    const float* v3 = &p.vertex_pos[3].x;
+    for (int c = 0; c < 3; c++)
+    {
+        float bottom = v0[c] + s * (v1[c] - v0[c]);
+        float top = v3[c] + s * (v2[c] - v3[c]);
+        point[c] = bottom + t * (top - bottom);
+    }
+}
+
+// a batch of sample pairs in structure-of-arrays layout, so the kernel takes 4 at a time.
+struct SampleBatch
+{
+    std::vector<float> dx, dy, dz;
+
+    // 1 for the samples, 0 for the padding up to a multiple of 4
+    std::vector<float> weight;
+    std::vector<int> q_strata;
+};
+
+// draws one round of strata x strata jittered sample pairs. the strata on q are
+// shuffled against the ones on p, so that both sides are stratified.
+void DrawSamples(const Patch& p, const Patch& q, int strata, RandomStream& random, SampleBatch& batch)
+{
+    int count = strata * strata;
+    std::vector<int>& q_strata = batch.q_strata;
+    q_strata.resize(count);
+    for (int k = 0; k < count; k++)
+    {
+        q_strata[k] = k;
+    }
+    for (int k = count - 1; k > 0; k--)
+    {
+        std::swap(q_strata[k], q_strata[random.NextBits() % (k + 1)]);
+    }
+
+    // padded to a multiple of 4 with pairs that contribute nothing
+    int padded = (count + 3) & ~3;
+    batch.dx.assign(padded, 1.0f);
+    batch.dy.assign(padded, 0.0f);
+    batch.dz.assign(padded, 0.0f);
+    batch.weight.assign(padded, 0.0f);
+
+    float stratum_size = 1.0f / strata;
+    for (int k = 0; k < count; k++)
+    {
+        float a[3], b[3];
+        SamplePatch(p, ((k % strata) + random.NextFloat()) * stratum_size, ((k / strata) + random.NextFloat()) * stratum_size, a);
+        int l = q_strata[k];
+        SamplePatch(q, ((l % strata) + random.NextFloat()) * stratum_size, ((l / strata) + random.NextFloat()) * stratum_size, b);
+        batch.dx[k] = b[0] - a[0];
+        batch.dy[k] = b[1] - a[1];
+        batch.dz[k] = b[2] - a[2];
+        batch.weight[k] = 1.0f;
+    }
+}
+
+// evaluates the point-to-point kernel cos_p cos_q / (pi r^2) for a batch, written with the
+// unnormalised distance d as (d.n_p)(-d.n_q) / (pi r^4). adds the values and their
+// squares to the sums.
+void EvaluateSamples(const Patch& p, const Patch& q, const SampleBatch& batch, int count, double& sum, double& sum_squares)
+{
+    float4 pnx = Float4Replicate(p.normal.x), pny = Float4Replicate(p.normal.y), pnz = Float4Replicate(p.normal.z);
+    float4 qnx = Float4Replicate(-q.normal.x), qny = Float4Replicate(-q.normal.y), qnz = Float4Replicate(-q.normal.z);
+    float4 zero = Float4Zero();
+    float4 pi = Float4Replicate(XM_PI);
+
+    for (int k = 0; k < count; k += 4)
+    {
+        float4 dx = Float4Load(&batch.dx[k]);
+        float4 dy = Float4Load(&batch.dy[k]);
+        float4 dz = Float4Load(&batch.dz[k]);
+
+        float4 cos_p = Float4Max(Float4MultiplyAdd(dz, pnz, Float4MultiplyAdd(dy, pny, Float4Multiply(dx, pnx))), zero);
+        float4 cos_q = Float4Max(Float4MultiplyAdd(dz, qnz, Float4MultiplyAdd(dy, qny, Float4Multiply(dx, qnx))), zero);
+        float4 r2 = Float4MultiplyAdd(dz, dz, Float4MultiplyAdd(dy, dy, Float4Multiply(dx, dx)));
+        float4 value = Float4Divide(Float4Multiply(cos_p, cos_q), Float4Multiply(pi, Float4Multiply(r2, r2)));
+        value = Float4Multiply(value, Float4Load(&batch.weight[k]));
+
+        sum += Float4Sum(value);
+        sum_squares += Float4Sum(Float4Multiply(value, value));
+    }
+}
+
+double MonteCarloFormFactor(int i, int j, const MonteCarloOptions& options, int& samples)
+{
+    const Patch& p = g_scene->patches[i];
+    const Patch& q = g_scene->patches[j];
+    RandomStream random = SeedStream(options.seed, i, j);
+
+    int strata = std::max<int>(1, (int)std::ceil(std::sqrt((double)options.min_samples)));
+    int round_samples = strata * strata;
+
+    static thread_local SampleBatch batch;
+    double sum = 0.0, sum_squares = 0.0;
+    samples = 0;
+    while (true)
+    {
+        DrawSamples(p, q, strata, random, batch);
+        EvaluateSamples(p, q, batch, (int)batch.dx.size(), sum, sum_squares);
+        samples += round_samples;
+
+        double mean = sum / samples;
+        if (mean <= 0.0 || samples + round_samples > options.max_samples)
+            break;
+
+        // the standard error of the mean, relative to the mean
+        double variance = std::max<double>(sum_squares / samples - mean * mean, 0.0);
+        if (std::sqrt(variance / samples) <= options.relative_error * mean)
+            break;
+    }
+
+    return sum / samples * q.area;
+}
+
+void EstimateFormFactorsMonteCarlo(const MonteCarloOptions& options)
+{
+    PROFILE_SCOPE("form_factors");
+
+    ReleaseFormFactors();
+    g_scene->formfactors = new double[(size_t)g_scene->patch_capacity * g_scene->patch_capacity];
+    g_scene->formfactor_row_sums = new double[g_scene->patch_capacity];
+
+    // the estimates are unbiased, so their rows only need the clamp of FormFactorRowScale()
+    g_scene->normalise_formfactor_rows = false;
+    g_scene->formfactor_estimator = FE_MonteCarlo;
+
+    int thread_count = options.thread_count > 0 ? options.thread_count : (int)std::thread::hardware_concurrency();
+    thread_count = std::max<int>(1, std::min<int>(thread_count, g_scene->patch_count));
+
+    Scene* scene = g_scene;
+    std::atomic<int> next_row(0);
+    auto worker = [&]()
+    {
+        SceneScope scope(scene);
+        for (int i = next_row++; i < g_scene->patch_count; i = next_row++)
+        {
+            double* row = &g_scene->formfactors[(size_t)i * g_scene->patch_capacity];
+            g_scene->formfactor_row_sums[i] = 0.0;
+            long long row_samples = 0;
+            for (int j = 0; j < g_scene->patch_count; j++)
+            {
+                double ff = 0.0;
+                if (i != j)
+                {
+                    int samples;
+                    ff = MonteCarloFormFactor(i, j, options, samples);
+                    row_samples += samples;
+                }
+                row[j] = ff;
+                g_scene->formfactor_row_sums[i] += ff;
+            }
+            PROFILE_COUNT(PC_FormFactorEvaluations, g_scene->patch_count - 1);
+            PROFILE_COUNT(PC_FormFactorSamples, row_samples);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; t++)
+    {
+        threads.push_back(std::thread(worker));
+    }
+    worker();
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    PackFormFactors();
+}
+
+StochasticOptions DefaultStochasticOptions()
+{
+    StochasticOptions options = {};
+    options.rays_per_patch = 256;
+    options.max_iterations = 100;
+    options.unshot_tolerance = 1.0e-3;
+    options.seed = 1;
+    options.thread_count = 0;
+    return options;
+}
+
+// a node of the bounding volume hierarchy over the patches. inner nodes have two
+// children, the second one at second_child, leaves hold patch_count patches starting
+// at first_patch of the sorted patch indices.
+struct BVHNode
+{
+    XMFLOAT3 box_min;
+    XMFLOAT3 box_max;
+    int first_patch;
+    int patch_count;
+    int second_child;
+};
+
+struct PatchBVH
+{
+    std::vector<BVHNode> nodes;
+    std::vector<int> patch_indices;
+};
+
+const int MaxBVHLeafPatches = 4;
+
+// builds the subtree over patch_indices[first, first + count) and returns its node index.
+int BuildBVHNode(PatchBVH& bvh, int first, int count)
+{
+    int node_index = (int)bvh.nodes.size();
+    bvh.nodes.push_back(BVHNode());
+
+    XMVECTOR box_min = XMLoadFloat3(&g_scene->patches[bvh.patch_indices[first]].box_min);
+    XMVECTOR box_max = XMLoadFloat3(&g_scene->patches[bvh.patch_indices[first]].box_max);
+    for (int k = first + 1; k < first + count; k++)
+    {
+        box_min = XMVectorMin(box_min, XMLoadFloat3(&g_scene->patches[bvh.patch_indices[k]].box_min));
+        box_max = XMVectorMax(box_max, XMLoadFloat3(&g_scene->patches[bvh.patch_indices[k]].box_max));
+    }
+
+    BVHNode node = {};
+    XMStoreFloat3(&node.box_min, box_min);
+    XMStoreFloat3(&node.box_max, box_max);
+    node.first_patch = first;
+    node.patch_count = count;
+
+    if (count > MaxBVHLeafPatches)
+    {
+        // splits at the median centroid along the longest axis
+        XMFLOAT3 extent;
+        XMStoreFloat3(&extent, box_max - box_min);
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        int* begin = &bvh.patch_indices[first];
+        std::nth_element(begin, begin + count / 2, begin + count, [axis](int a, int b)
+        {
+            return (&g_scene->patches[a].centroid.x)[axis] < (&g_scene->patches[b].centroid.x)[axis];
+        });
+
+        node.patch_count = 0;
+        BuildBVHNode(bvh, first, count / 2);
+        node.second_child = BuildBVHNode(bvh, first + count / 2, count - count / 2);
+    }
+
+    bvh.nodes[node_index] = node;
+    return node_index;
+}
+
+void BuildBVH(PatchBVH& bvh)
+{
+    PROFILE_SCOPE("build_bvh");
+    bvh.nodes.clear();
+    bvh.patch_indices.resize(g_scene->patch_count);
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        bvh.patch_indices[i] = i;
+    }
+    if (g_scene->patch_count > 0)
+        BuildBVHNode(bvh, 0, g_scene->patch_count);
+}
+
+// returns the distance along the ray to a box, FLT_MAX if it is missed or farther than t_max.
+float IntersectBox(const BVHNode& node, const float origin[3], const float inverse_direction[3], float t_max)
+{
+    const float* box_min = &node.box_min.x;
+    const float* box_max = &node.box_max.x;
+    float t_near = 0.0f, t_far = t_max;
+    for (int c = 0; c < 3; c++)
+    {
+        float t0 = (box_min[c] - origin[c]) * inverse_direction[c];
+        float t1 = (box_max[c] - origin[c]) * inverse_direction[c];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        t_near = std::max<float>(t_near, t0);
+        t_far = std::min<float>(t_far, t1);
+    }
+    return t_near <= t_far ? t_near : FLT_MAX;
+}
+
+// returns the distance along the ray to a patch, FLT_MAX if it is missed. the point of
+// the plane is inside the quad if it lies on the same side of all four edges.
+float IntersectPatch(const Patch& p, const float origin[3], const float direction[3])
+{
+    const float* n = &p.normal.x;
+    float denominator = n[0] * direction[0] + n[1] * direction[1] + n[2] * direction[2];
+    if (denominator == 0.0f)
+        return FLT_MAX;
+
+    const float* v0 = &p.vertex_pos[0].x;
+    float t = (n[0] * (v0[0] - origin[0]) + n[1] * (v0[1] - origin[1]) + n[2] * (v0[2] - origin[2])) / denominator;
+    if (t <= 1.0e-5f)
+        return FLT_MAX;
+
+    float hit[3] = { origin[0] + t * direction[0], origin[1] + t * direction[1], origin[2] + t * direction[2] };
+    int positive = 0, negative = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        const float* a = &p.vertex_pos[k].x;
+        const float* b = &p.vertex_pos[(k + 1) % 4].x;
+        float edge[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float to_hit[3] = { hit[0] - a[0], hit[1] - a[1], hit[2] - a[2] };
+        float side = n[0] * (edge[1] * to_hit[2] - edge[2] * to_hit[1])
+                   + n[1] * (edge[2] * to_hit[0] - edge[0] * to_hit[2])
+                   + n[2] * (edge[0] * to_hit[1] - edge[1] * to_hit[0]);
+        positive += side >= 0.0f;
+        negative += side <= 0.0f;
+    }
+    return positive == 4 || negative == 4 ? t : FLT_MAX;
+}
+
+// returns the index of the first patch the ray hits, -1 if it leaves the scene.
+int CastRay(const PatchBVH& bvh, const float origin[3], const float direction[3], int ignored_patch)
+{
+    float inverse_direction[3];
+    for (int c = 0; c < 3; c++)
+    {
+        inverse_direction[c] = direction[c] != 0.0f ? 1.0f / direction[c] : FLT_MAX;
+    }
+
+    int hit_patch = -1;
+    float hit_t = FLT_MAX;
+    int stack[64];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const BVHNode& node = bvh.nodes[stack[--stack_size]];
+        if (IntersectBox(node, origin, inverse_direction, hit_t) == FLT_MAX)
+            continue;
+
+        if (node.patch_count > 0)
+        {
+            for (int k = node.first_patch; k < node.first_patch + node.patch_count; k++)
+            {
+                int patch = bvh.patch_indices[k];
+                if (patch == ignored_patch)
+                    continue;
+                float t = IntersectPatch(g_scene->patches[patch], origin, direction);
+                if (t < hit_t)
+                {
+                    hit_t = t;
+                    hit_patch = patch;
+                }
+            }
+        }
+        else
+        {
+            int first_child = (int)(&node - &bvh.nodes[0]) + 1;
+            stack[stack_size++] = node.second_child;
+            stack[stack_size++] = first_child;
+        }
+    }
+    return hit_patch;
+}
+
+// returns a cosine-distributed direction around the normal of a patch.
+void SampleDirection(const Patch& p, RandomStream& random, float direction[3])
+{
+    XMVECTOR n = XMLoadFloat3(&p.normal);
+    XMVECTOR u = XMLoadFloat3(&p.vertex_pos[1]) - XMLoadFloat3(&p.vertex_pos[0]);
+    u = XMVector3Normalize(u - XMVector3Dot(u, n) * n);
+    XMVECTOR v = XMVector3Cross(n, u);
+
+    float phi = 2.0f * XM_PI * random.NextFloat();
+    float r2 = random.NextFloat();
+    float sin_theta = std::sqrt(r2);
+    XMVECTOR d = u * (std::cos(phi) * sin_theta) + v * (std::sin(phi) * sin_theta) + n * std::sqrt(1.0f - r2);
+
+    XMFLOAT3 stored;
+    XMStoreFloat3(&stored, d);
+    direction[0] = stored.x;
+    direction[1] = stored.y;
+    direction[2] = stored.z;
+}
+
+int SolveStochasticRadiosity(const StochasticOptions& options)
+{
+    PROFILE_SCOPE("stochastic");
+
+    PatchBVH bvh;
+    BuildBVH(bvh);
+
+    // the unshot power of the patches per color channel, initially the emitted power.
+    // the radiosity of a patch holds the brightness it received, like in IterateRadiosity().
+    std::vector<double> unshot(3 * g_scene->patch_count);
+    double emitted = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        Patch& p = g_scene->patches[i];
+        p.radiosity = { 0.0f, 0.0f, 0.0f };
+        unshot[3 * i + 0] = p.irradiance.x * p.area;
+        unshot[3 * i + 1] = p.irradiance.y * p.area;
+        unshot[3 * i + 2] = p.irradiance.z * p.area;
+        emitted += unshot[3 * i + 0] + unshot[3 * i + 1] + unshot[3 * i + 2];
+    }
+
+    // the threads are started once and shoot the rays of every iteration
+    WorkerPool pool(options.thread_count);
+    int thread_count = pool.GetThreadCount();
+    std::vector<std::vector<double>> received(thread_count, std::vector<double>(3 * g_scene->patch_count));
+
+    long long rays = (long long)options.rays_per_patch * g_scene->patch_count;
+    std::vector<int> ray_patches;
+    std::vector<int> patch_rays(g_scene->patch_count);
+
+    int iteration;
+    for (iteration = 0; iteration < options.max_iterations; iteration++)
+    {
+        double total = 0.0;
+        for (int i = 0; i < 3 * g_scene->patch_count; i++)
+        {
+            total += unshot[i];
+        }
+        if (total <= options.unshot_tolerance * emitted)
+            break;
+
+        // the rays are spread over the patches at evenly spaced positions of the cumulated
+        // unshot power. patches which get no ray keep their power for the next iteration.
+        ray_patches.clear();
+        std::fill(patch_rays.begin(), patch_rays.end(), 0);
+        double cumulated = 0.0;
+        long long next_ray = 0;
+        for (int i = 0; i < g_scene->patch_count && next_ray < rays; i++)
+        {
+            cumulated += unshot[3 * i + 0] + unshot[3 * i + 1] + unshot[3 * i + 2];
+            while (next_ray < rays && (next_ray + 0.5) * total / rays < cumulated)
+            {
+                ray_patches.push_back(i);
+                patch_rays[i]++;
+                next_ray++;
+            }
+        }
+
+        // every worker shoots a contiguous part of the rays with its own random stream
+        pool.Run([&](int thread)
+        {
+            std::vector<double>& buffer = received[thread];
+            std::fill(buffer.begin(), buffer.end(), 0.0);
+            RandomStream random = SeedStream(options.seed, iteration, thread);
+
+            size_t first = ray_patches.size() * thread / thread_count;
+            size_t last = ray_patches.size() * (thread + 1) / thread_count;
+            for (size_t k = first; k < last; k++)
+            {
+                int i = ray_patches[k];
+                const Patch& p = g_scene->patches[i];
+
+                float origin[3], direction[3];
+                SamplePatch(p, random.NextFloat(), random.NextFloat(), origin);
+                SampleDirection(p, random, direction);
+
+                // hits on the back of a patch are absorbed
+                int j = CastRay(bvh, origin, direction, i);
+                if (j < 0)
+                    continue;
+                const float* n = &g_scene->patches[j].normal.x;
+                if (n[0] * direction[0] + n[1] * direction[1] + n[2] * direction[2] >= 0.0f)
+                    continue;
+
+                for (int c = 0; c < 3; c++)
+                {
+                    buffer[3 * j + c] += unshot[3 * i + c] / patch_rays[i];
+                }
+            }
+            PROFILE_COUNT(PC_RaysCast, last - first);
+        });
+
+        // the shot power is gone, the received power is added to the brightness and
+        // its reflected part is the unshot power of the next iteration
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            if (patch_rays[i] > 0)
+                unshot[3 * i + 0] = unshot[3 * i + 1] = unshot[3 * i + 2] = 0.0;
+        }
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            Patch& p = g_scene->patches[i];
+            double power[3] = { 0.0, 0.0, 0.0 };
+            for (int t = 0; t < thread_count; t++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    power[c] += received[t][3 * i + c];
+                }
+            }
+
+            float* radiosity = &p.radiosity.x;
+            const float* reflectance = &p.reflectance.x;
+            for (int c = 0; c < 3; c++)
+            {
+                radiosity[c] += (float)(power[c] / p.area);
+                unshot[3 * i + c] += reflectance[c] * power[c];
+            }
+        }
+    }
+    return iteration;
+}
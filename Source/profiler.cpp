@@ -0,0 +1,215 @@
+#include <DirectXTemplatePCH.h>
+#include <profiler.h>
+
+typedef std::chrono::steady_clock ProfileClock;
+
+std::atomic<bool> g_profiler_enabled(false);
+
+// events per thread, older ones are overwritten. the scopes are coarse, a few per
+// solver phase or iteration, so 4096 events (96 KB) hold the recent runs.
+const size_t g_profile_ring_size = 1 << 12;
+
+struct ProfileEvent
+{
+    const char* name;
+    ProfileClock::time_point start;
+    ProfileClock::time_point end;
+};
+
+// the counters are atomic, because GetProfileCounter(), ResetProfiler() and
+// WriteChromeTrace() read and clear them while the other threads count. relaxed
+// operations are enough, every counter is a sum of its own.
+struct ProfileThreadBuffer
+{
+    int thread_index;
+    std::vector<ProfileEvent> events;
+    unsigned long long written;
+    std::atomic<unsigned long long> counters[NumProfileCounters];
+};
+
+const char* g_profile_counter_names[NumProfileCounters] =
+{
+    "links_created",
+    "subdivisions",
+    "form_factor_evaluations",
+    "gather_operations",
+    "form_factor_samples",
+    "rays_cast",
+    "active_sources"
+};
+
+// all thread buffers, they live until the end of the process so that the events
+// of finished worker threads can still be written. a finished thread hands its
+// buffer back to the free buffers, and the next new thread records on after its
+// events, so there are only as many buffers as threads ran at the same time.
+std::mutex g_profile_mutex;
+std::vector<ProfileThreadBuffer*> g_profile_buffers;
+std::vector<ProfileThreadBuffer*> g_profile_free_buffers;
+ProfileClock::time_point g_profile_epoch = ProfileClock::now();
+
+void ClearCounters(ProfileThreadBuffer& buffer)
+{
+    for (int counter = 0; counter < NumProfileCounters; counter++)
+    {
+        buffer.counters[counter].store(0, std::memory_order_relaxed);
+    }
+}
+
+// the sum of a counter over all threads, the caller holds g_profile_mutex.
+unsigned long long SumCounter(ProfileCounter counter)
+{
+    unsigned long long sum = 0;
+    for (ProfileThreadBuffer* buffer : g_profile_buffers)
+    {
+        sum += buffer->counters[counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// the buffer of a thread, which is handed back when the thread ends.
+struct ProfileBufferOwner
+{
+    ProfileThreadBuffer* buffer = nullptr;
+
+    ~ProfileBufferOwner()
+    {
+        if (buffer)
+        {
+            std::lock_guard<std::mutex> lock(g_profile_mutex);
+            g_profile_free_buffers.push_back(buffer);
+        }
+    }
+};
+
+// returns the buffer of the calling thread and takes a free one or registers a new
+// one on first use.
+ProfileThreadBuffer& GetThreadBuffer()
+{
+    thread_local ProfileBufferOwner owner;
+    if (!owner.buffer)
+    {
+        std::lock_guard<std::mutex> lock(g_profile_mutex);
+        if (!g_profile_free_buffers.empty())
+        {
+            owner.buffer = g_profile_free_buffers.back();
+            g_profile_free_buffers.pop_back();
+        }
+        else
+        {
+            owner.buffer = new ProfileThreadBuffer();
+            owner.buffer->events.resize(g_profile_ring_size);
+            owner.buffer->written = 0;
+            ClearCounters(*owner.buffer);
+            owner.buffer->thread_index = (int)g_profile_buffers.size();
+            g_profile_buffers.push_back(owner.buffer);
+        }
+    }
+    return *owner.buffer;
+}
+
+void EnableProfiler(bool enable)
+{
+    g_profiler_enabled.store(enable, std::memory_order_relaxed);
+}
+
+void ResetProfiler()
+{
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+    for (ProfileThreadBuffer* buffer : g_profile_buffers)
+    {
+        buffer->written = 0;
+        ClearCounters(*buffer);
+    }
+    g_profile_epoch = ProfileClock::now();
+}
+
+void ProfilerCount(ProfileCounter counter, unsigned long long amount)
+{
+    GetThreadBuffer().counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void ProfilerRecord(const char* name, ProfileClock::time_point start, ProfileClock::time_point end)
+{
+    ProfileThreadBuffer& buffer = GetThreadBuffer();
+    buffer.events[buffer.written % g_profile_ring_size] = { name, start, end };
+    buffer.written++;
+}
+
+unsigned long long GetProfileCounter(ProfileCounter counter)
+{
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+    return SumCounter(counter);
+}
+
+const char* GetProfileCounterName(ProfileCounter counter)
+{
+    return g_profile_counter_names[counter];
+}
+
+double GetProfileSeconds(const char* name)
+{
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+    double seconds = 0.0;
+    for (ProfileThreadBuffer* buffer : g_profile_buffers)
+    {
+        size_t count = (size_t)std::min<unsigned long long>(buffer->written, g_profile_ring_size);
+        for (size_t e = 0; e < count; e++)
+        {
+            const ProfileEvent& event = buffer->events[e];
+            if (!std::strcmp(event.name, name))
+                seconds += std::chrono::duration<double>(event.end - event.start).count();
+        }
+    }
+    return seconds;
+}
+
+// microseconds since the last reset, as used by the trace-event format.
+double TraceTimestamp(ProfileClock::time_point time)
+{
+    return std::chrono::duration<double, std::micro>(time - g_profile_epoch).count();
+}
+
+bool WriteChromeTrace(const std::string& path)
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    std::lock_guard<std::mutex> lock(g_profile_mutex);
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    ProfileClock::time_point last = g_profile_epoch;
+    for (ProfileThreadBuffer* buffer : g_profile_buffers)
+    {
+        // the ring holds the latest g_profile_ring_size events, oldest first
+        unsigned long long count = std::min<unsigned long long>(buffer->written, g_profile_ring_size);
+        for (unsigned long long e = buffer->written - count; e < buffer->written; e++)
+        {
+            const ProfileEvent& event = buffer->events[e % g_profile_ring_size];
+            if (event.start < g_profile_epoch)
+                continue;
+
+            out << (first ? "" : ",\n");
+            out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_index
+                << ",\"ts\":" << TraceTimestamp(event.start) << ",\"dur\":" << TraceTimestamp(event.end) - TraceTimestamp(event.start) << "}";
+            first = false;
+            if (event.end > last)
+                last = event.end;
+        }
+    }
+
+    // the counters are summed over all threads and written as one sample at the end
+    for (int counter = 0; counter < NumProfileCounters; counter++)
+    {
+        unsigned long long sum = SumCounter((ProfileCounter)counter);
+        out << (first ? "" : ",\n");
+        out << "{\"name\":\"" << g_profile_counter_names[counter] << "\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << TraceTimestamp(last)
+            << ",\"args\":{\"value\":" << sum << "}}";
+        first = false;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return true;
+}
@@ -0,0 +1,2633 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <profiler.h>
+#include <worker_pool.h>
+#include <DirectXPackedVector.h>
+
+using namespace DirectX;
+
+SolverOptions DefaultSolverOptions()
+{
+    SolverOptions options = {};
+    options.formfactor_storage = FS_Double;
+    options.accumulate_precision = AP_Float;
+    options.symmetric_formfactors = false;
+    options.analytic_formfactors = true;
+    options.hierarchy_level_arrays = true;
+    options.half_link_formfactors = false;
+    return options;
+}
+
+// the index of G_ij for i < j.
+size_t UpperIndex(int i, int j)
+{
+    return (size_t)i * g_scene->patch_capacity - (size_t)i * (i + 1) / 2 + (j - i - 1);
+}
+
+size_t UpperCount(int capacity)
+{
+    return (size_t)capacity * (capacity - 1) / 2;
+}
+
+// the scene of every thread that hasn't bound another one, the only one of the demo.
+Scene g_default_scene;
+thread_local Scene* g_scene = &g_default_scene;
+
+Scene::~Scene()
+{
+    SceneScope scope(this);
+    ReleaseScene();
+}
+
+// this gives a patch placed at its final address an id.
+void RegisterPatch(Patch& p)
+{
+    g_scene->hierarchy_levels_stale = true;
+    if (g_scene->free_patch_ids.empty())
+    {
+        p.id = (unsigned int)g_scene->patches_by_id.size();
+        g_scene->patches_by_id.push_back(&p);
+    }
+    else
+    {
+        p.id = g_scene->free_patch_ids.back();
+        g_scene->free_patch_ids.pop_back();
+        g_scene->patches_by_id[p.id] = &p;
+    }
+}
+
+void UnregisterPatch(Patch& p)
+{
+    g_scene->hierarchy_levels_stale = true;
+    g_scene->patches_by_id[p.id] = nullptr;
+    g_scene->free_patch_ids.push_back(p.id);
+}
+
+Patch& PatchFromId(unsigned int id)
+{
+    return *g_scene->patches_by_id[id];
+}
+
+// this function reads a tiled .obj-model into g_scene->room_model.
+void LoadModel(std::string path)
+{
+    PROFILE_SCOPE("load_model");
+
+    std::ifstream modelFileIFStream;
+    modelFileIFStream.open(path, std::ios::in);
+    std::string line;
+    std::list<XMFLOAT3> positions;
+    std::list<XMFLOAT3> normals;
+    std::list<Face> faces;
+
+    if (modelFileIFStream.is_open())
+    {
+        std::string case_substring;
+        while (std::getline(modelFileIFStream, line))
+        {
+            case_substring = line.substr(0, 2);
+
+            // read vertices
+            if (!case_substring.compare("v "))
+            {
+                g_scene->room_model.vertex_count++;
+
+                XMFLOAT3 position;
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the "v "
+                position.x = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
+
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the x-coord
+                position.y = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
+
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the y-coord
+                position.z = std::atof(line.c_str());
+
+                positions.push_back(position);
+            }
+            // read vertex normals
+            else if (!case_substring.compare("vn"))
+            {
+                XMFLOAT3 normal;
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the "v "
+                normal.x = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
+
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the x-coord
+                normal.y = std::atof(line.substr(0, line.find_first_of(' ') + 1).c_str());
+
+                line = line.substr(line.find_first_of(' ') + 1); // cut away the y-coord
+                normal.z = std::atof(line.c_str());
+
+                normals.push_back(normal);
+            }
+            // read faces
+            else if (!case_substring.compare("f "))
+            {
+                g_scene->room_model.face_count++;
+                
+                Face face = {};
+
+                line = line.substr(2);
+                std::string number_string;
+                number_string = line.substr(0, line.find_first_of(' '));
+                face.vertex_indices[0] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
+                line = line.substr(line.find_first_of(' ') + 1);
+                number_string = line.substr(0, line.find_first_of(' '));
+                face.vertex_indices[1] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
+                line = line.substr(line.find_first_of(' ') + 1);
+                number_string = line.substr(0, line.find_first_of(' '));
+                face.vertex_indices[2] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
+                line = line.substr(line.find_first_of(' ') + 1);
+                number_string = line.substr(0, line.find_first_of(' '));
+                face.vertex_indices[3] = std::atoi(number_string.substr(0, line.find_first_of('/')).c_str()) - 1;
+                line = line.substr(line.find_first_of('/') + 1);
+                face.normal_index = std::atoi(line.substr(line.find_first_of('/')+1).c_str()) - 1;
+
+                faces.push_back(face);
+            }
+        }
+        modelFileIFStream.close();
+    }
+
+    int vi = 0;
+    std::list<Vertex> vertices = {};
+    for (auto p_it = positions.begin(); p_it != positions.end(); p_it++)
+    {
+        int ni = -1;
+        for (auto f_it = faces.begin(); f_it != faces.end(); f_it++)
+        {
+            if (f_it->vertex_indices[0] == vi || f_it->vertex_indices[1] == vi || f_it->vertex_indices[2] == vi || f_it->vertex_indices[3] == vi)
+            {
+                ni = f_it->normal_index;
+                break;
+            }
+        }
+        assert(ni != -1);
+        auto n_it = normals.begin();
+        std::advance(n_it, ni);
+        vertices.push_back({ *p_it, *n_it, XMFLOAT3(0.0f, 0.0f, 0.0f) });
+        vi++;
+    }
+
+    g_scene->room_model.vertices = new Vertex[g_scene->room_model.vertex_count];
+    g_scene->room_model.faces = new Face[g_scene->room_model.face_count];
+
+    std::copy(vertices.begin(), vertices.end(), g_scene->room_model.vertices);
+    std::copy(faces.begin(), faces.end(), g_scene->room_model.faces);
+}
+
+// this checks if a patch is a rectangle in a plane perpendicular to one of the
+// coordinate axes with edges along the other two, like all tiles of the room.
+// such patches get the closed-form formfactors of EstimateFormFactor().
+void DetectAxisAlignedRectangle(Patch& p)
+{
+    p.box_min = p.vertex_pos[0];
+    p.box_max = p.vertex_pos[0];
+    for (int i = 1; i < 4; i++)
+    {
+        XMStoreFloat3(&p.box_min, XMVectorMin(XMLoadFloat3(&p.box_min), XMLoadFloat3(&p.vertex_pos[i])));
+        XMStoreFloat3(&p.box_max, XMVectorMax(XMLoadFloat3(&p.box_max), XMLoadFloat3(&p.vertex_pos[i])));
+    }
+
+    p.normal_axis = -1;
+    const float* normal = &p.normal.x;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (std::abs(normal[axis]) > 0.99999f)
+            p.normal_axis = axis;
+    }
+    if (p.normal_axis < 0)
+        return;
+
+    // a quad fills its bounding rectangle only if it is that rectangle
+    const float* box_min = &p.box_min.x;
+    const float* box_max = &p.box_max.x;
+    float box_area = 1.0f;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (axis != p.normal_axis)
+            box_area *= box_max[axis] - box_min[axis];
+    }
+    if (box_max[p.normal_axis] - box_min[p.normal_axis] > 1.0e-5f * std::sqrt(box_area) ||
+        std::abs(box_area - p.area) > 1.0e-4f * box_area)
+    {
+        p.normal_axis = -1;
+    }
+}
+
+// Creates a Patch and returns it.
+Patch InitPatch(XMFLOAT3 pos[4], XMFLOAT3 irradiance)
+{
+    Patch p = {};
+    p.vertex_pos[0] = pos[0];
+    p.vertex_pos[1] = pos[1];
+    p.vertex_pos[2] = pos[2];
+    p.vertex_pos[3] = pos[3];
+
+    XMVECTOR acc = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 4; i++)
+    {
+        XMVECTOR vp = XMLoadFloat3(&p.vertex_pos[i]);
+        acc = XMVectorAdd(acc, vp);
+    }
+    acc /= 4;
+    XMStoreFloat3(&p.centroid, acc);
+
+    p.radiosity = { 0.0f, 0.0f, 0.0f };
+    p.irradiance = irradiance;
+
+    XMVECTOR edge1 = XMLoadFloat3(&p.vertex_pos[0]) - XMLoadFloat3(&p.vertex_pos[1]);
+    XMVECTOR edge2 = XMLoadFloat3(&p.vertex_pos[1]) - XMLoadFloat3(&p.vertex_pos[2]);
+    XMVECTOR edge3 = XMLoadFloat3(&p.vertex_pos[2]) - XMLoadFloat3(&p.vertex_pos[3]);
+    XMVECTOR edge4 = XMLoadFloat3(&p.vertex_pos[3]) - XMLoadFloat3(&p.vertex_pos[0]);
+
+    XMVECTOR crossproduct1 = XMVector3Cross(edge1, edge2);
+    XMVECTOR crossproduct2 = XMVector3Cross(edge3, edge4);
+
+    XMStoreFloat3(&p.normal, XMVector3Normalize(crossproduct1));
+
+    if (p.normal.x == 1.0f)
+        p.reflectance = { 1.0f, 1.0f, 1.0f }; // left
+    else if (p.normal.x == -1.0f)
+        p.reflectance = { 1.0f, 1.0f, 1.0f }; // right
+    else if (p.normal.y == 1.0f)
+        p.reflectance = { 0.3f, 0.3f, 0.3f }; // bottom
+    else if (p.normal.y == -1.0f)
+        p.reflectance = { 0.3f, 0.3f, 0.3f }; // top
+    else if (p.normal.z == 1.0f)
+        p.reflectance = { 1.0f, 1.0f, 1.0f }; // back
+    else if (p.normal.z == -1.0f)
+        p.reflectance = { 1.0f, 1.0f, 1.0f }; // front
+
+    p.area = 0.5f * (std::abs(XMVectorGetX(XMVector3Length(crossproduct1))) + std::abs(XMVectorGetX(XMVector3Length(crossproduct2))));
+
+    DetectAxisAlignedRectangle(p);
+
+    p.influencing_partner_count = 0;
+    p.link_sources = {};
+    p.link_formfactors = {};
+    p.link_formfactors_half = {};
+    p.id = 0;
+    p.has_children = false;
+    p.has_parent = false;
+    p.parent = nullptr;
+    p.children = nullptr;
+
+    p.gathered_brightness = Float4Zero();
+    p.brightness = Float4Zero();
+    p.link_brightness = Float4Zero();
+
+    p.dirty = false;
+
+    return p;
+}
+
+// creates a patch for every face of g_scene->room_model. the face with the index
+// emitter_face is the light source of the scene.
+void CreatePatches(int emitter_face)
+{
+    PROFILE_SCOPE("init_patches");
+
+    g_scene->patch_capacity = g_scene->room_model.face_count;
+    g_scene->patches = new Patch[g_scene->patch_capacity];
+    g_scene->patch_count = 0;
+
+    XMFLOAT3 irradiance;
+    XMFLOAT3 v_pos[4];
+    for (int face_index = 0; face_index < g_scene->room_model.face_count; face_index++)
+    {
+        Face& face = g_scene->room_model.faces[face_index];
+
+        for (int i = 0; i < 4; i++)
+        {
+            v_pos[i] = g_scene->room_model.vertices[face.vertex_indices[i]].position;
+        }
+
+        if (face_index == emitter_face)
+            irradiance = { 200.0f, 170.0f, 150.0f }; // warm light
+        else
+            irradiance = { 0.0f, 0.0f, 0.0f };
+
+        g_scene->patches[face_index] = InitPatch(v_pos, irradiance);
+        RegisterPatch(g_scene->patches[face_index]);
+        g_scene->patch_count++;
+    }
+}
+
+// this replaces every patch by factor x factor patches on a regular grid over it, which
+// emit and reflect like it, e.g. for a reference solution on a finer grid. patch i becomes the patches
+// factor * factor * i up to factor * factor * (i + 1) - 1. it must be called before any
+// formfactors or links are estimated.
+void SplitPatches(int factor)
+{
+    Patch* coarse_patches = g_scene->patches;
+    int coarse_count = g_scene->patch_count;
+    g_scene->patch_capacity = coarse_count * factor * factor;
+    g_scene->patches = new Patch[g_scene->patch_capacity];
+    g_scene->patch_count = 0;
+
+    for (int i = 0; i < coarse_count; i++)
+    {
+        Patch& coarse = coarse_patches[i];
+        UnregisterPatch(coarse);
+        XMVECTOR v0 = XMLoadFloat3(&coarse.vertex_pos[0]);
+        XMVECTOR v1 = XMLoadFloat3(&coarse.vertex_pos[1]);
+        XMVECTOR v2 = XMLoadFloat3(&coarse.vertex_pos[2]);
+        XMVECTOR v3 = XMLoadFloat3(&coarse.vertex_pos[3]);
+
+        // the grid points are interpolated bilinearly, so non-planar quads split too
+        auto grid_point = [&](int u, int v)
+        {
+            XMVECTOR near_edge = XMVectorLerp(v0, v1, (float)u / factor);
+            XMVECTOR far_edge = XMVectorLerp(v3, v2, (float)u / factor);
+            XMFLOAT3 point;
+            XMStoreFloat3(&point, XMVectorLerp(near_edge, far_edge, (float)v / factor));
+            return point;
+        };
+
+        for (int v = 0; v < factor; v++)
+        {
+            for (int u = 0; u < factor; u++)
+            {
+                XMFLOAT3 v_pos[4] = { grid_point(u, v), grid_point(u + 1, v), grid_point(u + 1, v + 1), grid_point(u, v + 1) };
+                Patch& p = g_scene->patches[g_scene->patch_count++];
+                p = InitPatch(v_pos, coarse.irradiance);
+                // the rounded grid points can tilt the normal, which the reflectance
+                // is looked up by, so both are taken from the plane of the patch
+                p.normal = coarse.normal;
+                p.reflectance = coarse.reflectance;
+                RegisterPatch(p);
+            }
+        }
+    }
+    delete[] coarse_patches;
+}
+
+// this sets the irradiance of a patch and of all its subpatches, which emit like
+// their parent. the formfactors and links stay valid.
+void SetIrradiance(Patch& p, XMFLOAT3 irradiance)
+{
+    p.irradiance = irradiance;
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            SetIrradiance(*p.children[child], irradiance);
+        }
+    }
+}
+
+// this releases the model, all patches with their hierarchies and the formfactors,
+// so that another scene can be loaded afterwards.
+void ReleaseScene()
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        DeleteChildren(g_scene->patches[i]);
+#ifdef _WIN32
+        SafeRelease(g_scene->patches[i].vertex_buffer);
+        SafeRelease(g_scene->patches[i].index_buffer);
+#endif
+    }
+    delete[] g_scene->patches;
+    g_scene->patches = nullptr;
+    g_scene->patch_count = 0;
+    g_scene->patch_capacity = 0;
+    g_scene->patches_by_id.clear();
+    g_scene->free_patch_ids.clear();
+    g_scene->hierarchy_levels.clear();
+    g_scene->hierarchy_levels_stale = true;
+    g_scene->hierarchy_node_count = 0;
+    g_scene->receiver_start.clear();
+    g_scene->receivers.clear();
+    g_scene->source_receivers_stale = true;
+
+    ReleaseFormFactors();
+
+    delete[] g_scene->room_model.vertices;
+    delete[] g_scene->room_model.faces;
+    g_scene->room_model = {};
+
+    g_scene->link_count = 0;
+    g_scene->subpatch_count = 0;
+    g_scene->refine_subdivisions = 0;
+}
+
+// the closed-form formfactors between axis-aligned rectangles from the catalog of
+// configuration factors by Howell (C-11 and C-17). the formfactor is a signed sum of a
+// term over the 16 combinations of the rectangle edges. the terms are evaluated in
+// plain loops over arrays, so that the compiler can vectorise sqrt, atan and log.
+const int CornerCombinations = 16;
+
+// sums up the terms with the sign of their corner combination and divides by 2 pi times
+// the area of the sending rectangle.
+double SumCornerTerms(const double term[CornerCombinations], double area)
+{
+    double sum = 0.0;
+    for (int c = 0; c < CornerCombinations; c++)
+    {
+        int parity = (c ^ (c >> 1) ^ (c >> 2) ^ (c >> 3)) & 1;
+        sum += parity ? -term[c] : term[c];
+    }
+    return sum / (2.0 * XM_PI * area);
+}
+
+// the rectangles [x1,x2]x[y1,y2] and [xi1,xi2]x[eta1,eta2] lie in parallel planes
+// at the distance z and face each other.
+double ParallelRectanglesFormFactor(const double x[2], const double y[2], const double xi[2], const double eta[2], double z)
+{
+    double dx[CornerCombinations], dy[CornerCombinations], term[CornerCombinations];
+    for (int c = 0; c < CornerCombinations; c++)
+    {
+        dx[c] = x[c & 1] - xi[(c >> 2) & 1];
+        dy[c] = y[(c >> 1) & 1] - eta[(c >> 3) & 1];
+    }
+
+    double z2 = z * z;
+    for (int c = 0; c < CornerCombinations; c++)
+    {
+        double a = std::sqrt(dx[c] * dx[c] + z2);
+        double b = std::sqrt(dy[c] * dy[c] + z2);
+        term[c] = dy[c] * a * std::atan(dy[c] / a) + dx[c] * b * std::atan(dx[c] / b)
+            - 0.5 * z2 * std::log(dx[c] * dx[c] + dy[c] * dy[c] + z2);
+    }
+    return SumCornerTerms(term, (x[1] - x[0]) * (y[1] - y[0]));
+}
+
+// the rectangles [x1,x2]x[y1,y2] and [xi1,xi2]x[eta1,eta2] lie in perpendicular planes,
+// x and xi run along their common axis, y and eta are the distances from the line
+// where the planes meet, and they face each other.
+double PerpendicularRectanglesFormFactor(const double x[2], const double y[2], const double xi[2], const double eta[2])
+{
+    double dx[CornerCombinations], r2[CornerCombinations], term[CornerCombinations];
+    for (int c = 0; c < CornerCombinations; c++)
+    {
+        dx[c] = x[c & 1] - xi[(c >> 2) & 1];
+        double dy = y[(c >> 1) & 1];
+        double deta = eta[(c >> 3) & 1];
+        r2[c] = dy * dy + deta * deta;
+    }
+
+    for (int c = 0; c < CornerCombinations; c++)
+    {
+        // both parts vanish where the edges meet
+        double d = std::sqrt(r2[c]);
+        double distance2 = dx[c] * dx[c] + r2[c];
+        double along = d > 0.0 ? dx[c] * d * std::atan(dx[c] / d) : 0.0;
+        double across = distance2 > 0.0 ? 0.25 * (dx[c] * dx[c] - r2[c]) * std::log(distance2) : 0.0;
+        term[c] = along + across;
+    }
+    return SumCornerTerms(term, (x[1] - x[0]) * (y[1] - y[0]));
+}
+
+// returns the signed distances of the bounding box of q along an axis from the plane of p,
+// positive in front of p.
+void DistancesFromPlane(Patch& p, Patch& q, int axis, double distances[2])
+{
+    double plane = (&p.box_min.x)[p.normal_axis];
+    double direction = (&p.normal.x)[p.normal_axis] > 0.0f ? 1.0 : -1.0;
+    double d0 = ((&q.box_min.x)[axis] - plane) * direction;
+    double d1 = ((&q.box_max.x)[axis] - plane) * direction;
+    distances[0] = std::min<double>(d0, d1);
+    distances[1] = std::max<double>(d0, d1);
+}
+
+// this computes the exact formfactor from p to q if both are axis-aligned rectangles.
+// it returns false if they are not, or if one of them reaches behind the other one.
+bool AnalyticFormFactor(Patch& p, Patch& q, double& ff)
+{
+    if (p.normal_axis < 0 || q.normal_axis < 0)
+        return false;
+
+    const float* p_min = &p.box_min.x;
+    const float* p_max = &p.box_max.x;
+    const float* q_min = &q.box_min.x;
+    const float* q_max = &q.box_max.x;
+
+    double q_in_front[2], p_in_front[2];
+    DistancesFromPlane(p, q, p.normal_axis, q_in_front);
+    DistancesFromPlane(q, p, q.normal_axis, p_in_front);
+
+    // rectangles which lie completely behind each other don't exchange light
+    const double tolerance = 1.0e-5;
+    if (q_in_front[1] <= tolerance || p_in_front[1] <= tolerance)
+    {
+        ff = 0.0;
+        return true;
+    }
+    if (q_in_front[0] < -tolerance || p_in_front[0] < -tolerance)
+        return false;
+
+    if (p.normal_axis == q.normal_axis)
+    {
+        int x_axis = (p.normal_axis + 1) % 3;
+        int y_axis = (p.normal_axis + 2) % 3;
+        double x[2] = { p_min[x_axis], p_max[x_axis] };
+        double y[2] = { p_min[y_axis], p_max[y_axis] };
+        double xi[2] = { q_min[x_axis], q_max[x_axis] };
+        double eta[2] = { q_min[y_axis], q_max[y_axis] };
+        ff = ParallelRectanglesFormFactor(x, y, xi, eta, q_in_front[0]);
+    }
+    else
+    {
+        int common_axis = 3 - p.normal_axis - q.normal_axis;
+        double x[2] = { p_min[common_axis], p_max[common_axis] };
+        double xi[2] = { q_min[common_axis], q_max[common_axis] };
+        double y[2] = { std::max<double>(p_in_front[0], 0.0), p_in_front[1] };
+        double eta[2] = { std::max<double>(q_in_front[0], 0.0), q_in_front[1] };
+        ff = PerpendicularRectanglesFormFactor(x, y, xi, eta);
+    }
+
+    // the cancellation of the terms can leave tiny negative values for far apart rectangles
+    ff = std::max<double>(ff, 0.0);
+    return true;
+}
+
+// this returns a formfactor estimation between to patches. it is exact for axis-aligned
+// rectangles and otherwise approximated from the centroids of the patches.
+double EstimateFormFactor(Patch &p, Patch &q)
+{
+    PROFILE_COUNT(PC_FormFactorEvaluations, 1);
+
+    double ff;
+    if (g_scene->solver_options.analytic_formfactors && AnalyticFormFactor(p, q, ff))
+        return ff;
+
+    const XMVECTOR& ni = XMLoadFloat3(&p.normal);
+    const XMVECTOR& nj = XMLoadFloat3(&q.normal);
+    const XMVECTOR& ci = XMLoadFloat3(&p.centroid);
+    const XMVECTOR& cj = XMLoadFloat3(&q.centroid);
+    double dAj = q.area;
+
+    XMVECTOR vecDist = cj - ci;
+    double dRadius = XMVectorGetX(XMVector3Length(vecDist));
+    XMVECTOR vecDir = vecDist;
+    vecDir = XMVector3Normalize(vecDir);
+
+    double cosPhiI = XMVectorGetX(XMVector3Dot(vecDir, ni));
+    double cosPhiJ = XMVectorGetX(XMVector3Dot(-vecDir, nj));
+
+    if (cosPhiI < 0.0)
+    {
+        cosPhiI = 0.0;
+    }
+    if (cosPhiJ < 0.0)
+    {
+        cosPhiJ = 0.0;
+    }
+
+    return cosPhiI * cosPhiJ * dAj / dRadius / dRadius / XM_PI;
+}
+
+// this estimates every unordered pair once. the formfactor from j to i follows from
+// the reciprocity A_i F_ij = A_j F_ji, which the centroid and the exact formfactors obey.
+void EstimateSymmetricFormFactors()
+{
+    if (g_scene->solver_options.formfactor_storage == FS_Double)
+        g_scene->upper_formfactors = new double[UpperCount(g_scene->patch_capacity)];
+    else
+        g_scene->upper_formfactors_float = new float[UpperCount(g_scene->patch_capacity)];
+
+    std::fill(g_scene->formfactor_row_sums, g_scene->formfactor_row_sums + g_scene->patch_count, 0.0);
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        for (int j = i + 1; j < g_scene->patch_count; j++)
+        {
+            double ff = EstimateFormFactor(g_scene->patches[i], g_scene->patches[j]);
+            double g = ff * g_scene->patches[i].area;
+            if (g_scene->upper_formfactors)
+                g_scene->upper_formfactors[UpperIndex(i, j)] = g;
+            else
+                g_scene->upper_formfactors_float[UpperIndex(i, j)] = (float)g;
+
+            g_scene->formfactor_row_sums[i] += ff;
+            g_scene->formfactor_row_sums[j] += g / g_scene->patches[j].area;
+        }
+    }
+}
+
+// Estimates all formfactors quickly and packs them into the array g_scene->formfactors.
+// The rows are not normalised here, their sums are kept in g_scene->formfactor_row_sums instead
+// so that single rows and columns can be re-estimated later on (see UpdateDirtyFormFactors).
+// The iteration divides by these sums (see FormFactorRowScale).
+void EstimateFormFactors()
+{
+    PROFILE_SCOPE("form_factors");
+
+    ReleaseFormFactors();
+    g_scene->formfactor_row_sums = new double[g_scene->patch_capacity];
+    g_scene->normalise_formfactor_rows = !g_scene->solver_options.analytic_formfactors;
+    g_scene->formfactor_estimator = FE_PatchPairs;
+    if (g_scene->solver_options.symmetric_formfactors)
+    {
+        EstimateSymmetricFormFactors();
+        return;
+    }
+    g_scene->formfactors = new double[(size_t)g_scene->patch_capacity * g_scene->patch_capacity];
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        double* row = &g_scene->formfactors[(size_t)i * g_scene->patch_capacity];
+        g_scene->formfactor_row_sums[i] = 0.0;
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            double ff = 0.0;
+            if (i != j)
+            {
+                // calculate formfactor from path i to path j:
+                ff = EstimateFormFactor(g_scene->patches[i], g_scene->patches[j]);
+            }
+
+            row[j] = ff;
+            g_scene->formfactor_row_sums[i] += ff;
+        }
+    }
+
+    PackFormFactors();
+}
+
+void ReleaseFormFactors()
+{
+    delete[] g_scene->formfactors;
+    delete[] g_scene->formfactors_float;
+    delete[] g_scene->formfactors_half;
+    delete[] g_scene->formfactor_row_sums;
+    delete[] g_scene->upper_formfactors;
+    delete[] g_scene->upper_formfactors_float;
+    g_scene->formfactors = nullptr;
+    g_scene->formfactors_float = nullptr;
+    g_scene->formfactors_half = nullptr;
+    g_scene->formfactor_row_sums = nullptr;
+    g_scene->upper_formfactors = nullptr;
+    g_scene->upper_formfactors_float = nullptr;
+}
+
+bool HasFormFactors()
+{
+    return g_scene->formfactors || g_scene->formfactors_float || g_scene->formfactors_half || g_scene->upper_formfactors || g_scene->upper_formfactors_float;
+}
+
+// this converts the estimated double matrix into the formfactor storage of the scene and frees it.
+// the row sums stay in double, so the normalisation doesn't lose precision.
+void PackFormFactors()
+{
+    if (!g_scene->formfactors || g_scene->solver_options.formfactor_storage == FS_Double)
+        return;
+
+    size_t count = (size_t)g_scene->patch_capacity * g_scene->patch_capacity;
+    if (g_scene->solver_options.formfactor_storage == FS_Float)
+    {
+        g_scene->formfactors_float = new float[count];
+        for (size_t k = 0; k < count; k++)
+        {
+            g_scene->formfactors_float[k] = (float)g_scene->formfactors[k];
+        }
+    }
+    else
+    {
+        g_scene->formfactors_half = new unsigned short[count];
+        for (size_t k = 0; k < count; k++)
+        {
+            g_scene->formfactors_half[k] = PackedVector::XMConvertFloatToHalf((float)g_scene->formfactors[k]);
+        }
+    }
+    delete[] g_scene->formfactors;
+    g_scene->formfactors = nullptr;
+}
+
+double GetFormFactor(int i, int j)
+{
+    if (g_scene->upper_formfactors || g_scene->upper_formfactors_float)
+    {
+        if (i == j)
+            return 0.0;
+        size_t upper = UpperIndex(std::min<int>(i, j), std::max<int>(i, j));
+        double g = g_scene->upper_formfactors ? g_scene->upper_formfactors[upper] : g_scene->upper_formfactors_float[upper];
+        return g / g_scene->patches[i].area;
+    }
+
+    size_t k = (size_t)i * g_scene->patch_capacity + j;
+    if (g_scene->formfactors_float)
+        return g_scene->formfactors_float[k];
+    if (g_scene->formfactors_half)
+        return PackedVector::XMConvertHalfToFloat(g_scene->formfactors_half[k]);
+    return g_scene->formfactors[k];
+}
+
+// in the symmetric mode this sets the formfactor from j to i as well.
+void SetFormFactor(int i, int j, double ff)
+{
+    if (g_scene->upper_formfactors || g_scene->upper_formfactors_float)
+    {
+        if (i == j)
+            return;
+        size_t upper = UpperIndex(std::min<int>(i, j), std::max<int>(i, j));
+        double g = ff * g_scene->patches[i].area;
+        if (g_scene->upper_formfactors)
+            g_scene->upper_formfactors[upper] = g;
+        else
+            g_scene->upper_formfactors_float[upper] = (float)g;
+        return;
+    }
+
+    size_t k = (size_t)i * g_scene->patch_capacity + j;
+    if (g_scene->formfactors_float)
+        g_scene->formfactors_float[k] = (float)ff;
+    else if (g_scene->formfactors_half)
+        g_scene->formfactors_half[k] = PackedVector::XMConvertFloatToHalf((float)ff);
+    else
+        g_scene->formfactors[k] = ff;
+}
+
+// returns row i as floats, straight from the float storage or converted into buffer,
+// which has room for g_scene->patch_count floats.
+const float* GetFormFactorRow(int i, float* buffer)
+{
+    if (g_scene->upper_formfactors || g_scene->upper_formfactors_float)
+    {
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            buffer[j] = (float)GetFormFactor(i, j);
+        }
+        return buffer;
+    }
+
+    size_t offset = (size_t)i * g_scene->patch_capacity;
+    if (g_scene->formfactors_float)
+        return &g_scene->formfactors_float[offset];
+    if (g_scene->formfactors_half)
+    {
+        HalfToFloat(buffer, &g_scene->formfactors_half[offset], g_scene->patch_count);
+        return buffer;
+    }
+    for (int j = 0; j < g_scene->patch_count; j++)
+    {
+        buffer[j] = (float)g_scene->formfactors[offset + j];
+    }
+    return buffer;
+}
+
+const char* GetFormFactorStorageName(FormFactorStorage storage)
+{
+    switch (storage)
+    {
+    case FS_Float: return "float";
+    case FS_Half: return "half";
+    default: return "double";
+    }
+}
+
+const char* GetAccumulatePrecisionName(AccumulatePrecision precision)
+{
+    return precision == AP_Double ? "double" : "float";
+}
+
+// returns the actual color, computed by adding the irradiance to the product of reflectance and brightness(radiosity)
+void GetRadiosity(int patch_index, XMFLOAT3& color)
+{
+    float x = g_scene->patches[patch_index].irradiance.x + g_scene->patches[patch_index].reflectance.x * g_scene->patches[patch_index].radiosity.x;
+    float y = g_scene->patches[patch_index].irradiance.y + g_scene->patches[patch_index].reflectance.y * g_scene->patches[patch_index].radiosity.y;
+    float z = g_scene->patches[patch_index].irradiance.z + g_scene->patches[patch_index].reflectance.z * g_scene->patches[patch_index].radiosity.z;
+    color = { x, y, z };
+}
+
+// returns the factor the gathered radiosity of a row is scaled with. the centroid
+// estimates can add up to far more than 1 for neighbouring patches, so their rows are
+// normalised. exact and hemicube formfactors only add up to more than 1 where patches
+// see each other through occluders or by rounding, which is clamped.
+double FormFactorRowScale(int i)
+{
+    double sum = g_scene->formfactor_row_sums[i];
+    if (g_scene->normalise_formfactor_rows)
+        return sum > 0.0 ? 1.0 / sum : 1.0;
+    return sum > 1.0 ? 1.0 / sum : 1.0;
+}
+
+// this adds G_ij times the colors of j to the sums of i and G_ij times the colors of i
+// to the sums of every j > i, so every stored entry is read once for both directions.
+template<typename Stored, typename Accumulator>
+void MultiplyUpperRow(int i, const Stored* row, const Accumulator* red, const Accumulator* green, const Accumulator* blue,
+    Accumulator* red_sums, Accumulator* green_sums, Accumulator* blue_sums)
+{
+    Accumulator r = 0, g = 0, b = 0;
+    Accumulator red_i = red[i], green_i = green[i], blue_i = blue[i];
+    for (int j = i + 1; j < g_scene->patch_count; j++)
+    {
+        Accumulator gij = (Accumulator)row[j - i - 1];
+        r += gij * red[j];
+        g += gij * green[j];
+        b += gij * blue[j];
+        red_sums[j] += gij * red_i;
+        green_sums[j] += gij * green_i;
+        blue_sums[j] += gij * blue_i;
+    }
+    red_sums[i] += r;
+    green_sums[i] += g;
+    blue_sums[i] += b;
+}
+
+template<typename Accumulator>
+void IterateSymmetricRadiosity(int iterations)
+{
+    std::vector<Accumulator> red(g_scene->patch_count), green(g_scene->patch_count), blue(g_scene->patch_count);
+    std::vector<Accumulator> red_sums(g_scene->patch_count), green_sums(g_scene->patch_count), blue_sums(g_scene->patch_count);
+
+    for (int run = 0; run < iterations; run++)
+    {
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            XMFLOAT3 color;
+            GetRadiosity(j, color);
+            red[j] = color.x;
+            green[j] = color.y;
+            blue[j] = color.z;
+        }
+        std::fill(red_sums.begin(), red_sums.end(), (Accumulator)0);
+        std::fill(green_sums.begin(), green_sums.end(), (Accumulator)0);
+        std::fill(blue_sums.begin(), blue_sums.end(), (Accumulator)0);
+
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            size_t offset = UpperIndex(i, i + 1);
+            if (g_scene->upper_formfactors)
+                MultiplyUpperRow(i, &g_scene->upper_formfactors[offset], red.data(), green.data(), blue.data(), red_sums.data(), green_sums.data(), blue_sums.data());
+            else
+                MultiplyUpperRow(i, &g_scene->upper_formfactors_float[offset], red.data(), green.data(), blue.data(), red_sums.data(), green_sums.data(), blue_sums.data());
+        }
+
+        // the sums are A_i times the gathered radiosity
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            Accumulator scale = (Accumulator)(FormFactorRowScale(i) / g_scene->patches[i].area);
+            g_scene->patches[i].radiosity = XMFLOAT3((float)(red_sums[i] * scale), (float)(green_sums[i] * scale), (float)(blue_sums[i] * scale));
+        }
+    }
+}
+
+template<typename Accumulator>
+void IterateRadiosityIn(int iterations)
+{
+    if (g_scene->upper_formfactors || g_scene->upper_formfactors_float)
+    {
+        IterateSymmetricRadiosity<Accumulator>(iterations);
+        return;
+    }
+
+    // the colors are gathered once per iteration in structure-of-arrays layout, so that
+    // the inner loop only streams through the matrix row
+    std::vector<Accumulator> red(g_scene->patch_count), green(g_scene->patch_count), blue(g_scene->patch_count);
+    std::vector<float> unpacked_row(g_scene->formfactors_half ? g_scene->patch_count : 0);
+    std::vector<XMFLOAT3> radiosity(g_scene->patch_count);
+
+    for (int run = 0; run < iterations; run++)
+    {
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            XMFLOAT3 color;
+            GetRadiosity(j, color);
+            red[j] = color.x;
+            green[j] = color.y;
+            blue[j] = color.z;
+        }
+
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            size_t offset = (size_t)i * g_scene->patch_capacity;
+            Accumulator sum[3];
+            if (g_scene->formfactors_float)
+            {
+                MultiplyRow(&g_scene->formfactors_float[offset], red.data(), green.data(), blue.data(), sum);
+            }
+            else if (g_scene->formfactors_half)
+            {
+                HalfToFloat(unpacked_row.data(), &g_scene->formfactors_half[offset], g_scene->patch_count);
+                MultiplyRow(unpacked_row.data(), red.data(), green.data(), blue.data(), sum);
+            }
+            else
+            {
+                MultiplyRow(&g_scene->formfactors[offset], red.data(), green.data(), blue.data(), sum);
+            }
+
+            Accumulator scale = (Accumulator)FormFactorRowScale(i);
+            radiosity[i] = XMFLOAT3((float)(sum[0] * scale), (float)(sum[1] * scale), (float)(sum[2] * scale));
+        }
+
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            g_scene->patches[i].radiosity = radiosity[i];
+        }
+    }
+}
+
+// this is the normal radiosity iteration. it starts from the radiosities currently
+// stored in the patches, so it can continue a previous solution.
+void IterateRadiosity(int iterations)
+{
+    PROFILE_SCOPE("iterate");
+
+    if (g_scene->solver_options.accumulate_precision == AP_Double)
+        IterateRadiosityIn<double>(iterations);
+    else
+        IterateRadiosityIn<float>(iterations);
+}
+
+ActiveSetOptions DefaultActiveSetOptions()
+{
+    ActiveSetOptions options;
+    options.tolerance = 1.0e-4f;
+    options.thread_count = 0;
+    return options;
+}
+
+// the largest change of the first three components.
+float MaxChange(float4 a, float4 b)
+{
+    float4 difference = Float4Subtract(a, b);
+    return Float4MaxComponent3(Float4Max(difference, Float4Subtract(Float4Zero(), difference)));
+}
+
+// runs work(first, last) over [0, count) on the threads of the pool. the threads take
+// chunks of the range from an atomic counter, so no thread waits for another one.
+template<typename Work>
+void RunChunks(WorkerPool& pool, int count, int chunk_size, Work work)
+{
+    std::atomic<int> next_chunk(0);
+    pool.Run([&](int)
+    {
+        for (int first = chunk_size * next_chunk++; first < count; first = chunk_size * next_chunk++)
+        {
+            work(first, std::min<int>(first + chunk_size, count));
+        }
+    });
+}
+
+// this iterates the normal radiosity method like IterateRadiosity(), but after the
+// first iteration the radiosities are only corrected by the sources whose color has
+// changed noticeably: every patch remembers the color it was last propagated with, and
+// once its color has moved away from it by more than the tolerance times the brightest
+// patch, the change times the formfactor column of the patch is added to all rows. the
+// rows are corrected in parallel. while more than half of the patches are active a full
+// iteration is cheaper, which also propagates the small changes of all other patches.
+void IterateRadiosityActive(int iterations, const ActiveSetOptions& options, ActiveSetStats& stats)
+{
+    PROFILE_SCOPE("iterate_active");
+
+    stats.active_sources.clear();
+    stats.gathered_patches.clear();
+    stats.seconds.clear();
+
+    // the threads are started once and correct the rows of every iteration
+    WorkerPool pool(options.thread_count);
+    std::vector<float4> propagated(g_scene->patch_count);
+    std::vector<float4> colors(g_scene->patch_count);
+    std::vector<float4> changes;
+    std::vector<int> active;
+    active.reserve(g_scene->patch_count);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        float brightest = 0.0f;
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            XMFLOAT3 color;
+            GetRadiosity(j, color);
+            colors[j] = Float4Load3(color);
+            brightest = std::max<float>(brightest, Float4MaxComponent3(colors[j]));
+        }
+
+        active.clear();
+        float threshold = options.tolerance * brightest;
+        for (int j = 0; j < g_scene->patch_count && iteration > 0; j++)
+        {
+            if (MaxChange(colors[j], propagated[j]) > threshold)
+                active.push_back(j);
+        }
+
+        int active_sources = (int)active.size();
+        if (iteration == 0 || 2 * active_sources > g_scene->patch_count)
+        {
+            if (g_scene->solver_options.accumulate_precision == AP_Double)
+                IterateRadiosityIn<double>(1);
+            else
+                IterateRadiosityIn<float>(1);
+            propagated = colors;
+            active_sources = g_scene->patch_count;
+        }
+        else if (active_sources > 0)
+        {
+            changes.resize(active.size());
+            for (size_t a = 0; a < active.size(); a++)
+            {
+                changes[a] = Float4Subtract(colors[active[a]], propagated[active[a]]);
+                propagated[active[a]] = colors[active[a]];
+            }
+
+            RunChunks(pool, g_scene->patch_count, 64, [&](int first, int last)
+            {
+                for (int i = first; i < last; i++)
+                {
+                    float4 sum = Float4Zero();
+                    for (size_t a = 0; a < active.size(); a++)
+                    {
+                        sum = Float4MultiplyAdd(changes[a], Float4Replicate((float)GetFormFactor(i, active[a])), sum);
+                    }
+                    float4 radiosity = Float4MultiplyAdd(sum, Float4Replicate((float)FormFactorRowScale(i)), Float4Load3(g_scene->patches[i].radiosity));
+                    Float4Store3(g_scene->patches[i].radiosity, radiosity);
+                }
+            });
+        }
+
+        PROFILE_COUNT(PC_ActiveSources, active_sources);
+        stats.active_sources.push_back(active_sources);
+        stats.gathered_patches.push_back(active_sources > 0 ? g_scene->patch_count : 0);
+        stats.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+// this function links two patches for hierarchical gathering: p gathers the brightness
+// of q weighted with the formfactor from p to q, like a row of the formfactor matrix.
+void Link(Patch& p, Patch& q, double ff_ptoq)
+{
+    PROFILE_COUNT(PC_LinksCreated, 1);
+    g_scene->source_receivers_stale = true;
+
+    p.link_sources.push_back(q.id);
+    if (g_scene->solver_options.half_link_formfactors)
+        p.link_formfactors_half.push_back(PackedVector::XMConvertFloatToHalf((float)ff_ptoq));
+    else
+        p.link_formfactors.push_back((float)ff_ptoq);
+    p.influencing_partner_count++;
+    g_scene->link_count++;
+}
+
+// this removes the links of a patch for which remove(source) is true and keeps the
+// order of the others.
+template<typename Predicate>
+void RemoveLinks(Patch& p, Predicate remove)
+{
+    g_scene->source_receivers_stale = true;
+    int kept = 0;
+    for (int k = 0; k < p.influencing_partner_count; k++)
+    {
+        if (remove(PatchFromId(p.link_sources[k])))
+            continue;
+
+        p.link_sources[kept] = p.link_sources[k];
+        if (g_scene->solver_options.half_link_formfactors)
+            p.link_formfactors_half[kept] = p.link_formfactors_half[k];
+        else
+            p.link_formfactors[kept] = p.link_formfactors[k];
+        kept++;
+    }
+
+    g_scene->link_count -= p.influencing_partner_count - kept;
+    p.influencing_partner_count = kept;
+    p.link_sources.resize(kept);
+    if (g_scene->solver_options.half_link_formfactors)
+        p.link_formfactors_half.resize(kept);
+    else
+        p.link_formfactors.resize(kept);
+}
+
+// this releases the spare capacity of the link arrays of a hierarchy.
+void CompactHierarchyLinks(Patch& p)
+{
+    p.link_sources.shrink_to_fit();
+    p.link_formfactors.shrink_to_fit();
+    p.link_formfactors_half.shrink_to_fit();
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            CompactHierarchyLinks(*p.children[child]);
+        }
+    }
+}
+
+void CompactLinks()
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        CompactHierarchyLinks(g_scene->patches[i]);
+    }
+}
+
+// the bytes a single link takes in the arrays of its receiver.
+size_t LinkBytes()
+{
+    return sizeof(unsigned int) + (g_scene->solver_options.half_link_formfactors ? sizeof(unsigned short) : sizeof(float));
+}
+
+RefineOptions DefaultRefineOptions()
+{
+    RefineOptions options = {};
+    options.oracle = RO_FormFactor;
+    options.F_eps = 0.1;
+    options.BF_eps = 0.5;
+    options.IBF_eps = 0.001;
+    options.view = DefaultImportanceView();
+    options.min_area = 0.3f;
+    options.min_area_fraction = 0.0f;
+    options.max_depth = 16;
+    options.max_links = 0;
+    options.max_bytes = 0;
+    options.unordered_pairs = true;
+    return options;
+}
+
+// this sets the options of the following refinements and derives the area limit
+// from the summed area of the top-level patches.
+void SetRefineOptions(const RefineOptions& options)
+{
+    g_scene->refine_options = options;
+
+    double scene_area = 0.0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        scene_area += g_scene->patches[i].area;
+    }
+    g_scene->min_subdiv_area = std::max<float>(options.min_area, (float)(options.min_area_fraction * scene_area));
+}
+
+// returns the bytes a hierarchy of the given size needs on top of the top-level patches:
+// the subpatches with their children arrays and id table entries, and the links.
+size_t HierarchyBytes(int subpatches, int links)
+{
+    size_t bytes = (size_t)subpatches * (sizeof(Patch) + 4 * sizeof(Patch*) + sizeof(Patch*));
+    bytes += (size_t)links * LinkBytes();
+    return bytes;
+}
+
+// this checks if the link or memory budget of the refinement is used up.
+bool RefineBudgetReached()
+{
+    if (g_scene->refine_options.max_links > 0 && g_scene->link_count >= g_scene->refine_options.max_links)
+        return true;
+    if (g_scene->refine_options.max_bytes > 0 && HierarchyBytes(g_scene->subpatch_count, g_scene->link_count) >= g_scene->refine_options.max_bytes)
+        return true;
+    return false;
+}
+
+// returns the subdivision level of a patch, top-level patches have level 0.
+int PatchDepth(Patch& p)
+{
+    int depth = 0;
+    for (Patch* parent = &p; parent->has_parent; parent = parent->parent)
+    {
+        depth++;
+    }
+    return depth;
+}
+
+// this function checks if a patch is still divisible concerning its 
+// area threshold, its depth and the budget of the refinement.
+bool SubdivPossible(Patch &p)
+{
+    if (p.has_children)
+        return true;
+    return p.area > g_scene->min_subdiv_area && PatchDepth(p) < g_scene->refine_options.max_depth && !RefineBudgetReached();
+}
+
+// returns the brightness a patch sends out in the current solution as a single value:
+// its own irradiance plus its reflected brightness.
+float SourceBrightness(Patch& p)
+{
+    return Float4MaxComponent3(GetBrightness(p));
+}
+
+// returns the share of the image a change of the brightness of a patch affects: its
+// importance from the latest IterateImportance() or, before the first solve, the share
+// it covers directly.
+float ReceiverImportance(Patch& p)
+{
+    if (p.importance > 0.0f)
+        return p.importance * p.area;
+    return DirectImportance(p, g_scene->refine_options.view);
+}
+
+// this estimates the error of linking p and q at their current level in both directions,
+// depending on the oracle either the formfactor alone, weighted with the source brightness
+// or weighted with the source brightness and the importance of the receiver.
+// it returns the threshold the errors are compared against.
+double RefineErrors(Patch& p, Patch& q, double ff_ptoq, double ff_qtop, double& error_ptoq, double& error_qtop)
+{
+    if (g_scene->refine_options.oracle == RO_ImportanceBrightness)
+    {
+        error_ptoq = ff_ptoq * SourceBrightness(q) * ReceiverImportance(p);
+        error_qtop = ff_qtop * SourceBrightness(p) * ReceiverImportance(q);
+        return g_scene->refine_options.IBF_eps;
+    }
+    if (g_scene->refine_options.oracle == RO_BrightnessFormFactor)
+    {
+        error_ptoq = ff_ptoq * SourceBrightness(q);
+        error_qtop = ff_qtop * SourceBrightness(p);
+        return g_scene->refine_options.BF_eps;
+    }
+
+    error_ptoq = ff_ptoq;
+    error_qtop = ff_qtop;
+    return g_scene->refine_options.F_eps;
+}
+
+// this function subdivides a patch.
+void Subdivide(Patch& p)
+{
+    if (p.has_children)
+        return;
+
+    PROFILE_COUNT(PC_Subdivisions, 1);
+    g_scene->subpatch_count += 4;
+
+    Patch* nw = new Patch();
+    Patch* ne = new Patch();
+    Patch* se = new Patch();
+    Patch* sw = new Patch();
+
+    XMVECTOR v0 = XMLoadFloat3(&p.vertex_pos[0]);
+    XMVECTOR v1 = XMLoadFloat3(&p.vertex_pos[1]);
+    XMVECTOR v2 = XMLoadFloat3(&p.vertex_pos[2]);
+    XMVECTOR v3 = XMLoadFloat3(&p.vertex_pos[3]);
+
+    XMVECTOR v0v1 = XMVectorSubtract(v1, v0);
+    XMVECTOR v1v2 = XMVectorSubtract(v2, v1);
+    XMVECTOR v2v3 = XMVectorSubtract(v3, v2);
+    XMVECTOR v3v0 = XMVectorSubtract(v0, v3);
+
+    XMVECTOR v4 = XMVectorAdd(v0, XMVectorScale(v0v1, 0.5f));
+    XMVECTOR v5 = XMVectorAdd(v1, XMVectorScale(v1v2, 0.5f));
+    XMVECTOR v6 = XMVectorAdd(v2, XMVectorScale(v2v3, 0.5f));
+    XMVECTOR v7 = XMVectorAdd(v3, XMVectorScale(v3v0, 0.5f));
+
+    XMVECTOR v8 = XMVectorAdd(v4, XMVectorScale(XMVectorSubtract(v6, v4), 0.5f));// middlepoint
+
+    XMFLOAT3 v0f, v1f, v2f, v3f, v4f, v5f, v6f, v7f, v8f;
+
+    XMStoreFloat3(&v0f, v0);
+    XMStoreFloat3(&v1f, v1);
+    XMStoreFloat3(&v2f, v2);
+    XMStoreFloat3(&v3f, v3);
+    XMStoreFloat3(&v4f, v4);
+    XMStoreFloat3(&v5f, v5);
+    XMStoreFloat3(&v6f, v6);
+    XMStoreFloat3(&v7f, v7);
+    XMStoreFloat3(&v8f, v8);
+
+    // the subpatches emit like their parent, the reflectance follows from the normal
+    XMFLOAT3 vertices1[4] = { v0f, v4f, v8f, v7f };
+    *nw = InitPatch(vertices1, p.irradiance);
+    XMFLOAT3 vertices2[4] = { v4f, v1f, v5f, v8f };
+    *ne = InitPatch(vertices2, p.irradiance);
+    XMFLOAT3 vertices3[4] = { v8f, v5f, v2f, v6f };
+    *se = InitPatch(vertices3, p.irradiance);
+    XMFLOAT3 vertices4[4] = { v7f, v8f, v6f, v3f };
+    *sw = InitPatch(vertices4, p.irradiance);
+    RegisterPatch(*nw);
+    RegisterPatch(*ne);
+    RegisterPatch(*se);
+    RegisterPatch(*sw);
+
+    // the importance per area is a good guess for the subpatches until the next solve
+    nw->importance = p.importance;
+    ne->importance = p.importance;
+    se->importance = p.importance;
+    sw->importance = p.importance;
+
+    nw->has_parent = true;
+    nw->parent = &p;
+    ne->has_parent = true;
+    ne->parent = &p;
+    se->has_parent = true;
+    se->parent = &p;
+    sw->has_parent = true;
+    sw->parent = &p;
+
+    p.has_children = true;
+    p.children = new Patch*[4];
+    p.children[0] = nw;
+    p.children[1] = ne;
+    p.children[2] = se;
+    p.children[3] = sw;
+}
+
+// this is the known refine-algorithm from the 1984-paper for rapid hierarchical
+// radiosity. the oracle and the limits are taken from g_scene->refine_options.
+int Refine(Patch &p, Patch &q)
+{
+    double ff_ptoq = EstimateFormFactor(p, q);
+    double ff_qtop = EstimateFormFactor(q, p);
+
+    double error_ptoq, error_qtop;
+    double eps = RefineErrors(p, q, ff_ptoq, ff_qtop, error_ptoq, error_qtop);
+
+    if (error_ptoq < eps && error_qtop < eps)
+    {
+        Link(p, q, ff_ptoq);
+    }
+    else if (error_ptoq >= error_qtop && SubdivPossible(q))
+    {
+        Subdivide(q);
+        Refine(p, *q.children[0]);
+        Refine(p, *q.children[1]);
+        Refine(p, *q.children[2]);
+        Refine(p, *q.children[3]);
+        g_scene->refine_subdivisions++;
+    }
+    else if (error_ptoq >= error_qtop && !SubdivPossible(q))
+    {
+        Link(p, q, ff_ptoq);
+    }
+    else if(error_ptoq < error_qtop && SubdivPossible(p))
+    {
+        Subdivide(p);
+        Refine(q, *p.children[0]);
+        Refine(q, *p.children[1]);
+        Refine(q, *p.children[2]);
+        Refine(q, *p.children[3]);
+        g_scene->refine_subdivisions++;
+    }
+    else if (error_ptoq < error_qtop && !SubdivPossible(p))
+    {
+        Link(p, q, ff_ptoq);
+    }
+    return g_scene->refine_subdivisions;
+}
+
+// this refines both directions of a patch pair at once. the formfactor is estimated
+// once and the other direction follows from reciprocity, F_qp = F_pq * A_p / A_q.
+// the decision is the one Refine() takes for (p, q), but a linked pair gets both of its
+// links and a subdivided patch is refined against its partner only once.
+int RefinePair(Patch& p, Patch& q)
+{
+    double ff_ptoq = EstimateFormFactor(p, q);
+    double ff_qtop = q.area > 0.0f ? ff_ptoq * p.area / q.area : EstimateFormFactor(q, p);
+
+    double error_ptoq, error_qtop;
+    double eps = RefineErrors(p, q, ff_ptoq, ff_qtop, error_ptoq, error_qtop);
+
+    Patch& subdivided = error_ptoq >= error_qtop ? q : p;
+    Patch& partner = error_ptoq >= error_qtop ? p : q;
+    if ((error_ptoq < eps && error_qtop < eps) || !SubdivPossible(subdivided))
+    {
+        Link(p, q, ff_ptoq);
+        Link(q, p, ff_qtop);
+    }
+    else
+    {
+        Subdivide(subdivided);
+        RefinePair(partner, *subdivided.children[0]);
+        RefinePair(partner, *subdivided.children[1]);
+        RefinePair(partner, *subdivided.children[2]);
+        RefinePair(partner, *subdivided.children[3]);
+        g_scene->refine_subdivisions++;
+    }
+    return g_scene->refine_subdivisions;
+}
+
+// this collects the links of a patch hierarchy which the oracle would refine with the
+// current brightness and removes them.
+void UnlinkRefinable(Patch& p, std::list<std::pair<Patch*, Patch*>>& pairs)
+{
+    RemoveLinks(p, [&](Patch& q)
+    {
+        double error_ptoq, error_qtop;
+        double eps = RefineErrors(p, q, EstimateFormFactor(p, q), EstimateFormFactor(q, p), error_ptoq, error_qtop);
+        Patch& subdivided = error_ptoq >= error_qtop ? q : p;
+
+        if ((error_ptoq >= eps || error_qtop >= eps) && !subdivided.has_children && SubdivPossible(subdivided))
+        {
+            pairs.push_back({ &p, &q });
+            return true;
+        }
+        return false;
+    });
+
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            UnlinkRefinable(*p.children[child], pairs);
+        }
+    }
+}
+
+// this re-examines all links with the brightness of the current solution and refines
+// the ones which are not accurate enough anymore. the brightness-weighted oracle can
+// only judge the reflected light this way, so it alternates with the iteration.
+// it returns the number of refined links.
+int RefineLinks(const RefineOptions& options)
+{
+    PROFILE_SCOPE("refine_links");
+    SetRefineOptions(options);
+
+    std::list<std::pair<Patch*, Patch*>> pairs;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        UnlinkRefinable(g_scene->patches[i], pairs);
+    }
+    if (options.unordered_pairs)
+    {
+        // both directions of a pair are usually collected, each pair is refined once and
+        // loses the link in the other direction as well
+        std::vector<std::pair<unsigned int, unsigned int>> unordered;
+        for (auto pair_it = pairs.begin(); pair_it != pairs.end(); pair_it++)
+        {
+            unsigned int p = pair_it->first->id, q = pair_it->second->id;
+            unordered.push_back({ std::min<unsigned int>(p, q), std::max<unsigned int>(p, q) });
+        }
+        std::sort(unordered.begin(), unordered.end());
+        unordered.erase(std::unique(unordered.begin(), unordered.end()), unordered.end());
+
+        for (auto pair_it = unordered.begin(); pair_it != unordered.end(); pair_it++)
+        {
+            Patch& p = PatchFromId(pair_it->first);
+            Patch& q = PatchFromId(pair_it->second);
+            RemoveLinks(p, [&](Patch& source) { return &source == &q; });
+            RemoveLinks(q, [&](Patch& source) { return &source == &p; });
+            RefinePair(p, q);
+        }
+    }
+    else
+    {
+        for (auto pair_it = pairs.begin(); pair_it != pairs.end(); pair_it++)
+        {
+            Refine(*pair_it->first, *pair_it->second);
+        }
+    }
+    CompactLinks();
+    return (int)pairs.size();
+}
+
+// this returns the actual color brightness in the hierarchical radiosity method.
+float4 GetBrightness(Patch& p)
+{
+    return Float4MultiplyAdd(Float4Load3(p.reflectance), p.brightness, Float4Load3(p.irradiance));
+}
+
+void GetBrightness(Patch& p, XMFLOAT3& color)
+{
+    Float4Store3(color, GetBrightness(p));
+}
+
+// this returns the actual color brightness gathered in the latest iteration 
+// in the hierarchical radiosity method.
+float4 GetGatheredBrightness(Patch& p)
+{
+    return Float4MultiplyAdd(Float4Load3(p.reflectance), p.gathered_brightness, Float4Load3(p.irradiance));
+}
+
+void GetGatheredBrightness(Patch& p, XMFLOAT3& color)
+{
+    Float4Store3(color, GetGatheredBrightness(p));
+}
+
+// this sums up the brightness of all linked patches of a patch weighted with their
+// formfactors. like the radiosity of the matrix method it is the incident brightness,
+// GetBrightness() applies the reflectance. the brightness of the partners is
+// copied into a buffer first, so that the sum runs through the dispatched simd kernel
+// straight over the formfactors of the links.
+float4 GatherLinkedBrightness(Patch& p)
+{
+    static thread_local std::vector<float4> partner_brightness;
+    static thread_local std::vector<float> unpacked_formfactors;
+    int count = p.influencing_partner_count;
+    partner_brightness.resize(count);
+    for (int k = 0; k < count; k++)
+    {
+        partner_brightness[k] = GetBrightness(PatchFromId(p.link_sources[k]));
+    }
+
+    const float* formfactors = p.link_formfactors.data();
+    if (g_scene->solver_options.half_link_formfactors)
+    {
+        unpacked_formfactors.resize(count);
+        HalfToFloat(unpacked_formfactors.data(), p.link_formfactors_half.data(), count);
+        formfactors = unpacked_formfactors.data();
+    }
+
+    return WeightedSum(partner_brightness.data(), formfactors, count);
+}
+
+// this is the gather-algorithm to compute the radiosities from all linked patches of a patch
+// in one iteration. it is part of the hierarchical radiosity method.
+void Gather(Patch& p)
+{
+    PROFILE_COUNT(PC_GatherOperations, p.influencing_partner_count);
+    p.gathered_brightness = GatherLinkedBrightness(p);
+
+    // the subpatches are gathered once, also if the patch itself has no links
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            Gather(*p.children[child]);
+        }
+    }
+}
+
+// this function pushes the brightness values down to its subpatches.
+void PushBrightness(Patch& p)
+{
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            Patch& c = *p.children[child];
+            c.gathered_brightness = Float4Add(c.gathered_brightness, p.gathered_brightness);
+            PushBrightness(c);
+        }
+    }
+}
+
+// this function pulls the brightness values of its subpatches and averages them out.
+// the brightness is stored on every level, so links to subpatches see it as well.
+float4 PullBrightness(Patch& p)
+{
+    if (p.has_children)
+    {
+        float4 accumulate_brightness = Float4Zero();
+        for (int child = 0; child < 4; child++)
+        {
+            Patch& c = *p.children[child];
+            accumulate_brightness = Float4Add(accumulate_brightness, PullBrightness(c));
+        }
+        p.brightness = Float4Scale(accumulate_brightness, 0.25f);
+    }
+    else
+    {
+        p.brightness = p.gathered_brightness;
+    }
+    return p.brightness;
+}
+
+// this rebuilds the level arrays from the patch hierarchies. the brightness in the
+// arrays follows from the next GatherAll().
+void BuildHierarchyLevels()
+{
+    PROFILE_SCOPE("build_levels");
+
+    g_scene->hierarchy_levels.clear();
+    g_scene->hierarchy_levels.emplace_back();
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->hierarchy_levels[0].patches.push_back(&g_scene->patches[i]);
+        g_scene->hierarchy_levels[0].tree_start.push_back(i);
+    }
+    g_scene->hierarchy_levels[0].tree_start.push_back(g_scene->patch_count);
+
+    // the next level is filled tree by tree, so the subpatches of every tree stay
+    // together on each level. the levels are referenced by index, adding one moves them
+    for (size_t level = 0; !g_scene->hierarchy_levels[level].patches.empty(); level++)
+    {
+        g_scene->hierarchy_levels.emplace_back();
+        HierarchyLevel& current = g_scene->hierarchy_levels[level];
+        HierarchyLevel& next = g_scene->hierarchy_levels[level + 1];
+        current.first_child.assign(current.patches.size(), -1);
+        for (int tree = 0; tree < g_scene->patch_count; tree++)
+        {
+            next.tree_start.push_back((int)next.patches.size());
+            for (int k = current.tree_start[tree]; k < current.tree_start[tree + 1]; k++)
+            {
+                Patch& p = *current.patches[k];
+                if (!p.has_children)
+                    continue;
+
+                current.first_child[k] = (int)next.patches.size();
+                for (int child = 0; child < 4; child++)
+                {
+                    next.patches.push_back(p.children[child]);
+                }
+            }
+        }
+        next.tree_start.push_back((int)next.patches.size());
+    }
+    g_scene->hierarchy_levels.pop_back();
+
+    g_scene->hierarchy_node_count = 0;
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        level.offset = g_scene->hierarchy_node_count;
+        g_scene->hierarchy_node_count += (int)level.patches.size();
+        level.link_brightness.assign(level.patches.size(), Float4Zero());
+        level.gathered_brightness.assign(level.patches.size(), Float4Zero());
+        level.brightness.assign(level.patches.size(), Float4Zero());
+    }
+    g_scene->hierarchy_levels_stale = false;
+    g_scene->source_receivers_stale = true;
+}
+
+size_t HierarchyLevelBytes()
+{
+    size_t bytes = 0;
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        bytes += level.patches.capacity() * sizeof(Patch*);
+        bytes += (level.first_child.capacity() + level.tree_start.capacity()) * sizeof(int);
+        bytes += (level.link_brightness.capacity() + level.gathered_brightness.capacity() + level.brightness.capacity()) * sizeof(float4);
+    }
+    return bytes;
+}
+
+// this gathers all patches like Gather(). it runs tree by tree, because the subpatches of
+// a tree mostly link to the same partners, whose brightness then stays in the cache.
+void GatherLevels()
+{
+    for (int tree = 0; tree < g_scene->patch_count; tree++)
+    {
+        for (HierarchyLevel& level : g_scene->hierarchy_levels)
+        {
+            for (int k = level.tree_start[tree]; k < level.tree_start[tree + 1]; k++)
+            {
+                Patch& p = *level.patches[k];
+                PROFILE_COUNT(PC_GatherOperations, p.influencing_partner_count);
+                level.link_brightness[k] = GatherLinkedBrightness(p);
+            }
+        }
+    }
+}
+
+// this pushes the gathered brightness down level by level, like PushBrightness(). the
+// subpatches add the brightness of their parent to the one over their own links, which
+// is kept, so patches that aren't gathered again keep their share.
+void PushLevels()
+{
+    if (g_scene->hierarchy_levels.empty())
+        return;
+
+    g_scene->hierarchy_levels[0].gathered_brightness = g_scene->hierarchy_levels[0].link_brightness;
+    for (size_t l = 0; l + 1 < g_scene->hierarchy_levels.size(); l++)
+    {
+        const HierarchyLevel& level = g_scene->hierarchy_levels[l];
+        const float4* links = g_scene->hierarchy_levels[l + 1].link_brightness.data();
+        float4* children = g_scene->hierarchy_levels[l + 1].gathered_brightness.data();
+        for (size_t k = 0; k < level.patches.size(); k++)
+        {
+            int first = level.first_child[k];
+            if (first < 0)
+                continue;
+
+            float4 gathered = level.gathered_brightness[k];
+            children[first] = Float4Add(links[first], gathered);
+            children[first + 1] = Float4Add(links[first + 1], gathered);
+            children[first + 2] = Float4Add(links[first + 2], gathered);
+            children[first + 3] = Float4Add(links[first + 3], gathered);
+        }
+    }
+}
+
+// this pulls the brightness up from the finest level, like PullBrightness(), and stores
+// the brightness of every level in its patches, where the gathers read it. the
+// gathered brightness stays in the arrays. if displayed isn't null, it receives the
+// GetBrightness() of every patch at its index in the row of all levels.
+void PullLevels(float4* displayed)
+{
+    for (size_t l = g_scene->hierarchy_levels.size(); l-- > 0;)
+    {
+        HierarchyLevel& level = g_scene->hierarchy_levels[l];
+        const float4* children = l + 1 < g_scene->hierarchy_levels.size() ? g_scene->hierarchy_levels[l + 1].brightness.data() : nullptr;
+        for (size_t k = 0; k < level.patches.size(); k++)
+        {
+            int first = level.first_child[k];
+            if (first < 0)
+            {
+                level.brightness[k] = level.gathered_brightness[k];
+            }
+            else
+            {
+                const float4* c = &children[first];
+                float4 accumulate_brightness = Float4Add(Float4Add(Float4Add(c[0], c[1]), c[2]), c[3]);
+                level.brightness[k] = Float4Scale(accumulate_brightness, 0.25f);
+            }
+            Patch& p = *level.patches[k];
+            p.brightness = level.brightness[k];
+            if (displayed)
+                displayed[level.offset + k] = GetBrightness(p);
+        }
+    }
+}
+
+// this gathers the brightness of all patch hierarchies.
+void GatherAll()
+{
+    PROFILE_SCOPE("gather");
+    if (g_scene->solver_options.hierarchy_level_arrays)
+    {
+        if (g_scene->hierarchy_levels_stale)
+            BuildHierarchyLevels();
+        GatherLevels();
+        return;
+    }
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        Gather(g_scene->patches[i]);
+    }
+}
+
+// this pushes the gathered brightness of all patch hierarchies down to the leaves.
+// with the level arrays it continues from the brightness of the last GatherAll().
+void PushAll()
+{
+    PROFILE_SCOPE("push");
+    if (g_scene->solver_options.hierarchy_level_arrays)
+    {
+        if (g_scene->hierarchy_levels_stale)
+            BuildHierarchyLevels();
+        PushLevels();
+        return;
+    }
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        PushBrightness(g_scene->patches[i]);
+    }
+}
+
+// this pulls the brightness of all patch hierarchies up to the top-level patches.
+void PullAll()
+{
+    PROFILE_SCOPE("pull");
+    if (g_scene->solver_options.hierarchy_level_arrays)
+    {
+        if (g_scene->hierarchy_levels_stale)
+            BuildHierarchyLevels();
+        PullLevels(nullptr);
+        return;
+    }
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches[i].brightness = PullBrightness(g_scene->patches[i]);
+    }
+}
+
+// this indexes the receivers of every source in the level arrays: the patches with the
+// indices [receiver_start[s], receiver_start[s + 1]) of receivers gather from the patch
+// with the index s, all indices in the row of all levels.
+void BuildSourceReceivers()
+{
+    PROFILE_SCOPE("build_receivers");
+
+    std::vector<int> index_by_id(g_scene->patches_by_id.size(), -1);
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        for (size_t k = 0; k < level.patches.size(); k++)
+        {
+            index_by_id[level.patches[k]->id] = level.offset + (int)k;
+        }
+    }
+
+    g_scene->receiver_start.assign(g_scene->hierarchy_node_count + 1, 0);
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        for (Patch* p : level.patches)
+        {
+            for (int k = 0; k < p->influencing_partner_count; k++)
+            {
+                g_scene->receiver_start[index_by_id[p->link_sources[k]] + 1]++;
+            }
+        }
+    }
+    for (int s = 0; s < g_scene->hierarchy_node_count; s++)
+    {
+        g_scene->receiver_start[s + 1] += g_scene->receiver_start[s];
+    }
+
+    std::vector<int> fill(g_scene->receiver_start.begin(), g_scene->receiver_start.end() - 1);
+    g_scene->receivers.resize(g_scene->receiver_start.back());
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        for (size_t r = 0; r < level.patches.size(); r++)
+        {
+            Patch* p = level.patches[r];
+            for (int k = 0; k < p->influencing_partner_count; k++)
+            {
+                g_scene->receivers[fill[index_by_id[p->link_sources[k]]]++] = level.offset + (int)r;
+            }
+        }
+    }
+    g_scene->source_receivers_stale = false;
+}
+
+// this iterates the hierarchical radiosity method like IterateHierarchicalRadiosity(),
+// but after the first iteration only the patches linked to a source whose brightness
+// has changed noticeably gather again. every patch remembers the brightness it was last
+// propagated with, and once its brightness has moved away from it by more than the
+// tolerance times the brightest patch, all its receivers are queued. so the sources
+// that have converged stop costing anything, and the error stays below the tolerance
+// per source however small the single steps are. the queued receivers are gathered in
+// parallel, the push and pull run over all levels. the first iteration of every call
+// gathers all patches, so it continues from any brightness the patches hold.
+void IterateHierarchicalActive(int iterations, const ActiveSetOptions& options, ActiveSetStats& stats)
+{
+    PROFILE_SCOPE("iterate_active");
+
+    stats.active_sources.clear();
+    stats.gathered_patches.clear();
+    stats.seconds.clear();
+    if (g_scene->hierarchy_levels_stale)
+        BuildHierarchyLevels();
+    if (g_scene->source_receivers_stale)
+        BuildSourceReceivers();
+
+    // the brightness every patch was last propagated with, by the index in the row of all levels
+    std::vector<float4> propagated(g_scene->hierarchy_node_count);
+    std::vector<float4> displayed(g_scene->hierarchy_node_count);
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        for (size_t k = 0; k < level.patches.size(); k++)
+        {
+            propagated[level.offset + k] = GetBrightness(*level.patches[k]);
+        }
+    }
+
+    WorkerPool pool(options.thread_count);
+    std::vector<unsigned char> queued(g_scene->hierarchy_node_count, 1);
+    std::vector<std::pair<int, int>> queue;
+    int active_sources = g_scene->hierarchy_node_count;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        // the queue runs tree by tree over the levels like GatherLevels()
+        queue.clear();
+        for (int tree = 0; tree < g_scene->patch_count; tree++)
+        {
+            for (int l = 0; l < (int)g_scene->hierarchy_levels.size(); l++)
+            {
+                HierarchyLevel& level = g_scene->hierarchy_levels[l];
+                for (int k = level.tree_start[tree]; k < level.tree_start[tree + 1]; k++)
+                {
+                    if (queued[level.offset + k])
+                    {
+                        queued[level.offset + k] = 0;
+                        queue.push_back({ l, k });
+                    }
+                }
+            }
+        }
+
+        RunChunks(pool, (int)queue.size(), 64, [&](int first, int last)
+        {
+            for (int q = first; q < last; q++)
+            {
+                HierarchyLevel& level = g_scene->hierarchy_levels[queue[q].first];
+                Patch& p = *level.patches[queue[q].second];
+                PROFILE_COUNT(PC_GatherOperations, p.influencing_partner_count);
+                level.link_brightness[queue[q].second] = GatherLinkedBrightness(p);
+            }
+        });
+        PushLevels();
+        PullLevels(displayed.data());
+
+        float brightest = 0.0f;
+        for (int n = 0; n < g_scene->hierarchy_node_count; n++)
+        {
+            brightest = std::max<float>(brightest, Float4MaxComponent3(displayed[n]));
+        }
+
+        PROFILE_COUNT(PC_ActiveSources, active_sources);
+        stats.active_sources.push_back(active_sources);
+        stats.gathered_patches.push_back((int)queue.size());
+        active_sources = 0;
+        float threshold = options.tolerance * brightest;
+        for (int n = 0; n < g_scene->hierarchy_node_count; n++)
+        {
+            if (MaxChange(displayed[n], propagated[n]) <= threshold)
+                continue;
+
+            propagated[n] = displayed[n];
+            active_sources++;
+            for (int r = g_scene->receiver_start[n]; r < g_scene->receiver_start[n + 1]; r++)
+            {
+                queued[g_scene->receivers[r]] = 1;
+            }
+        }
+        stats.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+// this is the function which iterates the hierarchical radiosity method.
+// it is called with a intentionally small amount of iterations so that it doesn't take too long.
+// like IterateRadiosity() it continues from the brightness currently stored in the patches.
+void IterateHierarchicalRadiosity(int iterations)
+{
+    PROFILE_SCOPE("iterate");
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        GatherAll();
+        PushAll();
+        PullAll();
+    }
+}
+
+// this sorts the patches of a hierarchy into the lists of their subdivision levels.
+void CollectLevels(Patch& p, int level, std::vector<std::vector<Patch*>>& levels)
+{
+    if ((int)levels.size() <= level)
+        levels.resize(level + 1);
+    levels[level].push_back(&p);
+
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            CollectLevels(*p.children[child], level + 1, levels);
+        }
+    }
+}
+
+// this gathers the brightness over the own links of a patch, like Gather() but
+// without descending into the subpatches.
+void GatherLinks(Patch& p)
+{
+    PROFILE_COUNT(PC_GatherOperations, p.influencing_partner_count);
+    p.link_brightness = GatherLinkedBrightness(p);
+}
+
+// this recomputes the brightness of a hierarchy from the brightness gathered on every
+// level: the leaves sum up the gathered brightness of all their parents, the
+// other patches average their subpatches.
+float4 UpdateHierarchyBrightness(Patch& p, float4 parents_brightness)
+{
+    float4 received = Float4Add(parents_brightness, p.link_brightness);
+    if (p.has_children)
+    {
+        float4 accumulate_brightness = Float4Zero();
+        for (int child = 0; child < 4; child++)
+        {
+            accumulate_brightness = Float4Add(accumulate_brightness, UpdateHierarchyBrightness(*p.children[child], received));
+        }
+        p.brightness = Float4Scale(accumulate_brightness, 0.25f);
+    }
+    else
+    {
+        p.brightness = received;
+    }
+    return p.brightness;
+}
+
+// this copies the brightness gathered over the own links between the level arrays and
+// the patches. GatherLevels() only writes the arrays, the level-ordered iteration works
+// on the patches.
+void CopyLevelLinkBrightness(bool to_patches)
+{
+    if (!g_scene->solver_options.hierarchy_level_arrays || g_scene->hierarchy_levels_stale)
+        return;
+
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        for (size_t k = 0; k < level.patches.size(); k++)
+        {
+            if (to_patches)
+                level.patches[k]->link_brightness = level.link_brightness[k];
+            else
+                level.link_brightness[k] = level.patches[k]->link_brightness;
+        }
+    }
+}
+
+void UpdateAllBrightness()
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        UpdateHierarchyBrightness(g_scene->patches[i], Float4Zero());
+    }
+}
+
+// the brightness a patch receives over the links of all its parents, summed from the
+// top-level patch down like in UpdateHierarchyBrightness().
+float4 ParentsBrightness(Patch& p)
+{
+    if (!p.has_parent)
+        return Float4Zero();
+    return Float4Add(ParentsBrightness(*p.parent), p.parent->link_brightness);
+}
+
+// this gathers all patches of one level and passes the correction on to the other levels.
+// only the subtrees below the level receive it, the coarser levels average it again and
+// the brightness of all other patches stays the same.
+void RelaxLevel(std::vector<std::vector<Patch*>>& levels, int level)
+{
+    for (Patch* p : levels[level])
+    {
+        GatherLinks(*p);
+    }
+    for (Patch* p : levels[level])
+    {
+        UpdateHierarchyBrightness(*p, ParentsBrightness(*p));
+    }
+    for (int coarser = level - 1; coarser >= 0; coarser--)
+    {
+        for (Patch* p : levels[coarser])
+        {
+            if (!p->has_children)
+                continue;
+
+            float4 accumulate_brightness = Float4Zero();
+            for (int child = 0; child < 4; child++)
+            {
+                accumulate_brightness = Float4Add(accumulate_brightness, p->children[child]->brightness);
+            }
+            p->brightness = Float4Scale(accumulate_brightness, 0.25f);
+        }
+    }
+}
+
+// this iterates the hierarchical radiosity method level by level, a block Gauss-Seidel
+// relaxation over the subdivision levels of the patch quadtrees. the links of the
+// top-level patches are gathered first and their correction is pushed down before the
+// next finer level is gathered, then the levels are gathered again from the finest back
+// to the coarsest. so the light travels over the coarse links, which carry most of the
+// energy across the room, several times per cycle. it is no multigrid: no residual is
+// restricted to a coarser level and there is no coarse-grid correction, every level is
+// relaxed on the full problem. it continues from the brightness of the previous
+// iterations, also from the ones of GatherAll(), PushAll() and PullAll().
+void IterateLevelOrderedRadiosity(int cycles)
+{
+    PROFILE_SCOPE("iterate_level_ordered");
+
+    std::vector<std::vector<Patch*>> levels;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        CollectLevels(g_scene->patches[i], 0, levels);
+    }
+    CopyLevelLinkBrightness(true);
+    UpdateAllBrightness();
+
+    for (int cycle = 0; cycle < cycles; cycle++)
+    {
+        for (int level = 0; level < (int)levels.size(); level++)
+        {
+            RelaxLevel(levels, level);
+        }
+        for (int level = (int)levels.size() - 2; level >= 0; level--)
+        {
+            RelaxLevel(levels, level);
+        }
+    }
+    CopyLevelLinkBrightness(false);
+}
+
+// this sets the brightness of all patch hierarchies back to zero, so that the next
+// iteration starts from the emitted light only.
+void ResetHierarchyBrightness(Patch& p)
+{
+    p.gathered_brightness = Float4Zero();
+    p.brightness = Float4Zero();
+    p.link_brightness = Float4Zero();
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            ResetHierarchyBrightness(*p.children[child]);
+        }
+    }
+}
+
+void ResetHierarchicalSolution()
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        ResetHierarchyBrightness(g_scene->patches[i]);
+    }
+    for (HierarchyLevel& level : g_scene->hierarchy_levels)
+    {
+        level.link_brightness.assign(level.patches.size(), Float4Zero());
+        level.gathered_brightness.assign(level.patches.size(), Float4Zero());
+        level.brightness.assign(level.patches.size(), Float4Zero());
+    }
+}
+
+// the camera of Update() in main.cpp.
+ImportanceView DefaultImportanceView()
+{
+    ImportanceView view;
+    view.eye = { 0.1f, 3.0f, -12.0f };
+    view.focus = { 0.0f, 3.0f, 0.0f };
+    view.up = { 0.0f, 1.0f, 0.0f };
+    view.fov_y = XMConvertToRadians(45.0f);
+    view.aspect = 1920.0f / 1080.0f;
+    return view;
+}
+
+// returns the share of the image a patch covers, without occlusion. the projected area
+// is averaged over the centroid and the corners, so patches on the border of the view
+// count partially. only the front side of a patch is visible.
+float DirectImportance(Patch& p, const ImportanceView& view)
+{
+    XMVECTOR eye = XMLoadFloat3(&view.eye);
+    XMVECTOR forward = XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&view.focus), eye));
+    XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMLoadFloat3(&view.up), forward));
+    XMVECTOR up = XMVector3Cross(forward, right);
+    XMVECTOR normal = XMLoadFloat3(&p.normal);
+    float tan_y = std::tan(0.5f * view.fov_y);
+    float tan_x = tan_y * view.aspect;
+
+    const XMFLOAT3* points[5] = { &p.centroid, &p.vertex_pos[0], &p.vertex_pos[1], &p.vertex_pos[2], &p.vertex_pos[3] };
+    float density = 0.0f;
+    for (int k = 0; k < 5; k++)
+    {
+        XMVECTOR to_point = XMVectorSubtract(XMLoadFloat3(points[k]), eye);
+        float z = XMVectorGetX(XMVector3Dot(to_point, forward));
+        if (z <= 0.0f)
+            continue;
+
+        float x = XMVectorGetX(XMVector3Dot(to_point, right)) / z;
+        float y = XMVectorGetX(XMVector3Dot(to_point, up)) / z;
+        float distance = XMVectorGetX(XMVector3Length(to_point));
+        float cos_patch = -XMVectorGetX(XMVector3Dot(to_point, normal)) / distance;
+        if (std::abs(x) > tan_x || std::abs(y) > tan_y || cos_patch <= 0.0f)
+            continue;
+
+        // the area on the image plane at distance 1 per area of the patch
+        float cos_view = z / distance;
+        density += cos_patch / (distance * distance * cos_view * cos_view * cos_view);
+    }
+    return p.area * density / 5.0f / (4.0f * tan_x * tan_y);
+}
+
+void ClearGatheredImportance(Patch& p)
+{
+    p.gathered_importance = 0.0f;
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            ClearGatheredImportance(*p.children[child]);
+        }
+    }
+}
+
+// importance flows against the light: the sources of the links of a patch get the
+// importance of the patch, weighted with the formfactor and the reflectance of the patch.
+void ScatterImportance(Patch& p)
+{
+    float reflected = p.importance * p.area * std::max<float>(p.reflectance.x, std::max<float>(p.reflectance.y, p.reflectance.z));
+    if (reflected > 0.0f)
+    {
+        bool half_links = g_scene->solver_options.half_link_formfactors;
+        for (int k = 0; k < p.influencing_partner_count; k++)
+        {
+            Patch& q = PatchFromId(p.link_sources[k]);
+            float ff = half_links ? PackedVector::XMConvertHalfToFloat(p.link_formfactors_half[k]) : p.link_formfactors[k];
+            if (q.area > 0.0f)
+                q.gathered_importance += ff * reflected / q.area;
+        }
+    }
+
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            ScatterImportance(*p.children[child]);
+        }
+    }
+}
+
+// this pushes the gathered importance down to the leaves, adds their direct importance
+// there and pulls the average up again, like push and pull do with the brightness.
+float PushPullImportance(Patch& p, float pushed, const ImportanceView& view)
+{
+    float gathered = pushed + p.gathered_importance;
+    if (p.has_children)
+    {
+        float sum = 0.0f;
+        for (int child = 0; child < 4; child++)
+        {
+            sum += PushPullImportance(*p.children[child], gathered, view);
+        }
+        p.importance = 0.25f * sum;
+    }
+    else
+    {
+        p.importance = gathered + (p.area > 0.0f ? DirectImportance(p, view) / p.area : 0.0f);
+    }
+    return p.importance;
+}
+
+// this solves the adjoint of the hierarchical radiosity system over the current links
+// for the camera of g_scene->refine_options: the importance of a patch is the share of the
+// image it covers plus the importance it reflects onto the patches it sees.
+void IterateImportance(int iterations)
+{
+    PROFILE_SCOPE("importance");
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            ClearGatheredImportance(g_scene->patches[i]);
+        }
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            ScatterImportance(g_scene->patches[i]);
+        }
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            PushPullImportance(g_scene->patches[i], 0.0f, g_scene->refine_options.view);
+        }
+    }
+}
+
+// this refines every pair of top-level patches and returns the number of subdivisions.
+// unordered pairs are refined once for both directions.
+int RefineAll(const RefineOptions& options)
+{
+    PROFILE_SCOPE("refine");
+    SetRefineOptions(options);
+
+    g_scene->refine_subdivisions = 0;
+    int subdivisions = 0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        for (int j = options.unordered_pairs ? i + 1 : 0; j < g_scene->patch_count; j++)
+        {
+            if (i == j)
+                continue;
+
+            if (options.unordered_pairs)
+                subdivisions = RefinePair(g_scene->patches[i], g_scene->patches[j]);
+            else
+                subdivisions = Refine(g_scene->patches[i], g_scene->patches[j]);
+        }
+    }
+    CompactLinks();
+    return subdivisions;
+}
+
+// returns the color a patch is displayed with in the current method.
+void GetPatchColor(int patch_index, XMFLOAT3& color)
+{
+    if (g_scene->without_hierarch_radiosity)
+        GetRadiosity(patch_index, color);
+    else
+        GetBrightness(g_scene->patches[patch_index], color);
+}
+
+// counts the subpatches and links of a patch hierarchy.
+void CountHierarchy(Patch& p, int& subpatches, int& links)
+{
+    links += p.influencing_partner_count;
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            subpatches++;
+            CountHierarchy(*p.children[child], subpatches, links);
+        }
+    }
+}
+
+// returns the bytes the link arrays of all hierarchies have allocated.
+size_t HierarchyLinkStoreBytes(Patch& p)
+{
+    size_t bytes = p.link_sources.capacity() * sizeof(unsigned int) + p.link_formfactors.capacity() * sizeof(float) +
+        p.link_formfactors_half.capacity() * sizeof(unsigned short);
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            bytes += HierarchyLinkStoreBytes(*p.children[child]);
+        }
+    }
+    return bytes;
+}
+
+size_t LinkStoreBytes()
+{
+    size_t bytes = 0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        bytes += HierarchyLinkStoreBytes(g_scene->patches[i]);
+    }
+    return bytes;
+}
+
+// estimates the memory held by the solver: the patches with their hierarchies and
+// links and the formfactor matrix.
+size_t EstimateSolverMemory()
+{
+    int subpatches = 0;
+    int links = 0;
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        CountHierarchy(g_scene->patches[i], subpatches, links);
+    }
+
+    size_t bytes = (size_t)g_scene->patch_capacity * (sizeof(Patch) + 4 * sizeof(Patch*));
+    bytes += HierarchyBytes(subpatches, links);
+    size_t matrix = (size_t)g_scene->patch_capacity * g_scene->patch_capacity;
+    if (g_scene->formfactors)
+        bytes += matrix * sizeof(double);
+    if (g_scene->formfactors_float)
+        bytes += matrix * sizeof(float);
+    if (g_scene->formfactors_half)
+        bytes += matrix * sizeof(unsigned short);
+    if (g_scene->upper_formfactors)
+        bytes += UpperCount(g_scene->patch_capacity) * sizeof(double);
+    if (g_scene->upper_formfactors_float)
+        bytes += UpperCount(g_scene->patch_capacity) * sizeof(float);
+    if (g_scene->formfactor_row_sums)
+        bytes += (size_t)g_scene->patch_capacity * sizeof(double);
+    bytes += HierarchyLevelBytes();
+    return bytes;
+}
+
+// this checks if a patch belongs to the hierarchy of a dirty patch.
+bool IsInDirtyHierarchy(Patch& p)
+{
+    Patch* root = &p;
+    while (root->has_parent)
+        root = root->parent;
+    return root->dirty;
+}
+
+// this function removes all links of a patch hierarchy which gather from a dirty hierarchy.
+void UnlinkDirty(Patch& p)
+{
+    RemoveLinks(p, IsInDirtyHierarchy);
+
+    if (p.has_children)
+    {
+        for (int child = 0; child < 4; child++)
+        {
+            UnlinkDirty(*p.children[child]);
+        }
+    }
+}
+
+// this function deletes all subpatches of a patch.
+void DeleteChildren(Patch& p)
+{
+    if (!p.has_children)
+        return;
+
+    for (int child = 0; child < 4; child++)
+    {
+        DeleteChildren(*p.children[child]);
+        g_scene->link_count -= p.children[child]->influencing_partner_count;
+        UnregisterPatch(*p.children[child]);
+        delete p.children[child];
+    }
+    delete[] p.children;
+    p.children = nullptr;
+    g_scene->subpatch_count -= 4;
+    p.has_children = false;
+}
+
+// this marks a patch, so that the next call of UpdateDirtyPatches() recomputes
+// everything which depends on it.
+void MarkPatchDirty(int patch_index)
+{
+    g_scene->patches[patch_index].dirty = true;
+}
+
+// this moves a patch to a new position. the subpatches are kept until
+// UpdateDirtyPatches() has removed all links to them.
+void MovePatch(int patch_index, XMFLOAT3 pos[4])
+{
+    Patch& p = g_scene->patches[patch_index];
+    Patch moved = InitPatch(pos, p.irradiance);
+
+    for (int i = 0; i < 4; i++)
+    {
+        p.vertex_pos[i] = moved.vertex_pos[i];
+    }
+    p.centroid = moved.centroid;
+    p.normal = moved.normal;
+    p.reflectance = moved.reflectance;
+    p.area = moved.area;
+    // the closed-form formfactors and the ray casting read the box of the patch
+    p.normal_axis = moved.normal_axis;
+    p.box_min = moved.box_min;
+    p.box_max = moved.box_max;
+
+    MarkPatchDirty(patch_index);
+}
+
+// this copies the rows of a formfactor matrix into one with a larger row length.
+template<typename T>
+void GrowMatrix(T*& matrix, int capacity)
+{
+    if (!matrix)
+        return;
+
+    T* old_matrix = matrix;
+    matrix = new T[(size_t)capacity * capacity];
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        std::copy(&old_matrix[(size_t)i * g_scene->patch_capacity], &old_matrix[(size_t)i * g_scene->patch_capacity + g_scene->patch_count], &matrix[(size_t)i * capacity]);
+    }
+    delete[] old_matrix;
+}
+
+// this copies the upper triangle into one for a larger capacity.
+template<typename T>
+void GrowUpperTriangle(T*& upper, int capacity)
+{
+    if (!upper)
+        return;
+
+    T* old_upper = upper;
+    upper = new T[UpperCount(capacity)];
+    for (int i = 0; i + 1 < g_scene->patch_count; i++)
+    {
+        // UpperIndex() uses g_scene->patch_capacity, which is still the old capacity here
+        size_t old_offset = UpperIndex(i, i + 1);
+        size_t offset = (size_t)i * capacity - (size_t)i * (i + 1) / 2;
+        std::copy(&old_upper[old_offset], &old_upper[old_offset + (g_scene->patch_count - 1 - i)], &upper[offset]);
+    }
+    delete[] old_upper;
+}
+
+// this function makes room for more patches. the parent pointers into the old array
+// are moved along with the patches, the links refer to the patches by their ids.
+void GrowPatches(int capacity)
+{
+    Patch* old_patches = g_scene->patches;
+    g_scene->patches = new Patch[capacity];
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches[i] = std::move(old_patches[i]);
+    }
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches_by_id[g_scene->patches[i].id] = &g_scene->patches[i];
+        if (g_scene->patches[i].has_children)
+        {
+            for (int child = 0; child < 4; child++)
+            {
+                g_scene->patches[i].children[child]->parent = &g_scene->patches[i];
+            }
+        }
+    }
+    delete[] old_patches;
+
+    if (HasFormFactors())
+    {
+        GrowMatrix(g_scene->formfactors, capacity);
+        GrowMatrix(g_scene->formfactors_float, capacity);
+        GrowMatrix(g_scene->formfactors_half, capacity);
+        GrowUpperTriangle(g_scene->upper_formfactors, capacity);
+        GrowUpperTriangle(g_scene->upper_formfactors_float, capacity);
+
+        double* old_row_sums = g_scene->formfactor_row_sums;
+        g_scene->formfactor_row_sums = new double[capacity];
+        std::copy(old_row_sums, old_row_sums + g_scene->patch_count, g_scene->formfactor_row_sums);
+        delete[] old_row_sums;
+    }
+
+    g_scene->patch_capacity = capacity;
+}
+
+// this adds a new patch to the scene and returns its index. it is marked dirty,
+// so the next call of UpdateDirtyPatches() links it with all other patches.
+int AddPatch(XMFLOAT3 pos[4], XMFLOAT3 irradiance)
+{
+    if (g_scene->patch_count == g_scene->patch_capacity)
+        GrowPatches(std::max<int>(2 * g_scene->patch_capacity, 16));
+
+    int patch_index = g_scene->patch_count++;
+    g_scene->patches[patch_index] = InitPatch(pos, irradiance);
+    RegisterPatch(g_scene->patches[patch_index]);
+
+    if (HasFormFactors())
+    {
+        // the new row and column start out empty
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            SetFormFactor(i, patch_index, 0.0);
+            SetFormFactor(patch_index, i, 0.0);
+        }
+        g_scene->formfactor_row_sums[patch_index] = 0.0;
+    }
+
+    MarkPatchDirty(patch_index);
+    return patch_index;
+}
+
+// this re-estimates only the rows and columns of the dirty patches and corrects the
+// row sums, so it costs O(n) per dirty patch instead of O(n^2) for the whole matrix.
+void UpdateDirtyFormFactors()
+{
+    // the columns come first: in the symmetric mode they share their entries with the
+    // rows of the dirty patches, and the row sums need the old formfactors
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        if (g_scene->patches[i].dirty)
+            continue;
+
+        for (int d = 0; d < g_scene->patch_count; d++)
+        {
+            if (!g_scene->patches[d].dirty)
+                continue;
+
+            double ff = EstimateFormFactor(g_scene->patches[i], g_scene->patches[d]);
+            g_scene->formfactor_row_sums[i] += ff - GetFormFactor(i, d);
+            SetFormFactor(i, d, ff);
+        }
+    }
+
+    for (int d = 0; d < g_scene->patch_count; d++)
+    {
+        if (!g_scene->patches[d].dirty)
+            continue;
+
+        g_scene->formfactor_row_sums[d] = 0.0;
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            double ff = (d != j) ? EstimateFormFactor(g_scene->patches[d], g_scene->patches[j]) : 0.0;
+            SetFormFactor(d, j, ff);
+            g_scene->formfactor_row_sums[d] += ff;
+        }
+    }
+}
+
+// this removes every link into the dirty hierarchies, rebuilds them and refines
+// only the pairs which contain a dirty patch.
+void UpdateDirtyLinks()
+{
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        if (!g_scene->patches[i].dirty)
+            UnlinkDirty(g_scene->patches[i]);
+    }
+
+    for (int d = 0; d < g_scene->patch_count; d++)
+    {
+        Patch& p = g_scene->patches[d];
+        if (!p.dirty)
+            continue;
+
+        DeleteChildren(p);
+        g_scene->link_count -= p.influencing_partner_count;
+        p.link_sources.clear();
+        p.link_formfactors.clear();
+        p.link_formfactors_half.clear();
+        p.influencing_partner_count = 0;
+    }
+
+    for (int d = 0; d < g_scene->patch_count; d++)
+    {
+        if (!g_scene->patches[d].dirty)
+            continue;
+
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            if (j == d)
+                continue;
+
+            if (g_scene->refine_options.unordered_pairs)
+            {
+                // a pair of two dirty patches is refined once, from its lower index
+                if (!g_scene->patches[j].dirty || j > d)
+                    RefinePair(g_scene->patches[d], g_scene->patches[j]);
+                continue;
+            }
+
+            Refine(g_scene->patches[d], g_scene->patches[j]);
+            // pairs of two dirty patches are refined from both sides within this loop
+            if (!g_scene->patches[j].dirty)
+                Refine(g_scene->patches[j], g_scene->patches[d]);
+        }
+    }
+    CompactLinks();
+}
+
+// this recomputes everything which depends on the dirty patches and clears their flags.
+// the solution is not reset, so the following iterations restart from the previous one.
+// it returns false and changes nothing if the formfactor matrix can't be updated row by
+// row (see FormFactorEstimator), then the matrix has to be estimated again.
+bool UpdateDirtyPatches()
+{
+    PROFILE_SCOPE("update_dirty_patches");
+
+    if (g_scene->without_hierarch_radiosity && (!HasFormFactors() || g_scene->formfactor_estimator != FE_PatchPairs))
+        return false;
+
+    if (g_scene->without_hierarch_radiosity)
+        UpdateDirtyFormFactors();
+    else
+        UpdateDirtyLinks();
+
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        g_scene->patches[i].dirty = false;
+    }
+    return true;
+}
+
+// this updates the dirty patches and continues the current solution for some iterations.
+bool ResolveDirtyPatches(int iterations)
+{
+    if (!UpdateDirtyPatches())
+        return false;
+
+    if (g_scene->without_hierarch_radiosity)
+        IterateRadiosity(iterations);
+    else
+        IterateHierarchicalRadiosity(iterations);
+    return true;
+}
@@ -0,0 +1,113 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <scene_generator.h>
+#include <profiler.h>
+
+using namespace DirectX;
+
+// this splits the rectangle origin, origin + u, origin + u + v, origin + v into
+// tiles x tiles faces. the winding is chosen so that InitPatch() computes the given normal.
+void AddTiledRectangle(std::vector<Vertex>& vertices, std::vector<Face>& faces, XMFLOAT3 origin, XMFLOAT3 u, XMFLOAT3 v, XMFLOAT3 normal, int tiles)
+{
+    XMVECTOR o = XMLoadFloat3(&origin);
+    XMVECTOR du = XMVectorScale(XMLoadFloat3(&u), 1.0f / tiles);
+    XMVECTOR dv = XMVectorScale(XMLoadFloat3(&v), 1.0f / tiles);
+    XMVECTOR n = XMLoadFloat3(&normal);
+
+    if (XMVectorGetX(XMVector3Dot(XMVector3Cross(du, dv), n)) < 0.0f)
+    {
+        std::swap(du, dv);
+    }
+
+    for (int a = 0; a < tiles; a++)
+    {
+        for (int b = 0; b < tiles; b++)
+        {
+            XMVECTOR corner = XMVectorAdd(o, XMVectorAdd(XMVectorScale(du, (float)a), XMVectorScale(dv, (float)b)));
+            XMVECTOR corners[4] = { corner, XMVectorAdd(corner, du), XMVectorAdd(XMVectorAdd(corner, du), dv), XMVectorAdd(corner, dv) };
+
+            Face face = {};
+            face.normal_index = -1;
+            for (int i = 0; i < 4; i++)
+            {
+                Vertex vertex = {};
+                XMStoreFloat3(&vertex.position, corners[i]);
+                vertex.normal = normal;
+                face.vertex_indices[i] = (int)vertices.size();
+                vertices.push_back(vertex);
+            }
+            faces.push_back(face);
+        }
+    }
+}
+
+RoomDescription RoomForPatchCount(int patch_count, int occluder_count)
+{
+    // a box side has a quarter of the tiles of a wall per edge and boxes have 5 visible sides
+    double faces_per_tile = 6.0 + occluder_count * 5.0 / 16.0;
+
+    RoomDescription room = {};
+    room.width = 10.0f;
+    room.height = 6.0f;
+    room.depth = 10.0f;
+    room.tiles = std::max<int>(1, (int)std::lround(std::sqrt(patch_count / faces_per_tile)));
+    room.occluder_count = occluder_count;
+    room.occluder_tiles = std::max<int>(1, room.tiles / 4);
+    room.seed = 1;
+    return room;
+}
+
+int GenerateRoom(const RoomDescription& room)
+{
+    PROFILE_SCOPE("generate_room");
+
+    std::vector<Vertex> vertices;
+    std::vector<Face> faces;
+
+    float w = room.width;
+    float h = room.height;
+    float d = room.depth;
+    float x0 = -0.5f * w;
+    float z0 = -0.5f * d;
+    int t = room.tiles;
+
+    // the walls, all facing into the room
+    AddTiledRectangle(vertices, faces, { x0, 0.0f, z0 }, { w, 0.0f, 0.0f }, { 0.0f, 0.0f, d }, { 0.0f, 1.0f, 0.0f }, t); // bottom
+    AddTiledRectangle(vertices, faces, { x0, 0.0f, z0 }, { 0.0f, h, 0.0f }, { 0.0f, 0.0f, d }, { 1.0f, 0.0f, 0.0f }, t); // left
+    AddTiledRectangle(vertices, faces, { x0 + w, 0.0f, z0 }, { 0.0f, h, 0.0f }, { 0.0f, 0.0f, d }, { -1.0f, 0.0f, 0.0f }, t); // right
+    AddTiledRectangle(vertices, faces, { x0, 0.0f, z0 }, { w, 0.0f, 0.0f }, { 0.0f, h, 0.0f }, { 0.0f, 0.0f, 1.0f }, t); // front
+    AddTiledRectangle(vertices, faces, { x0, 0.0f, z0 + d }, { w, 0.0f, 0.0f }, { 0.0f, h, 0.0f }, { 0.0f, 0.0f, -1.0f }, t); // back
+
+    int ceiling_first_face = (int)faces.size();
+    AddTiledRectangle(vertices, faces, { x0, h, z0 }, { w, 0.0f, 0.0f }, { 0.0f, 0.0f, d }, { 0.0f, -1.0f, 0.0f }, t); // top
+    int emitter_face = ceiling_first_face + (t / 2) * t + t / 2;
+
+    // the boxes, standing on the floor and facing outwards
+    std::mt19937 random(room.seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int ot = room.occluder_tiles;
+    for (int box = 0; box < room.occluder_count; box++)
+    {
+        float bw = w * (0.1f + 0.1f * unit(random));
+        float bh = h * (0.2f + 0.3f * unit(random));
+        float bd = d * (0.1f + 0.1f * unit(random));
+        float bx = x0 + (w - bw) * unit(random);
+        float bz = z0 + (d - bd) * unit(random);
+
+        AddTiledRectangle(vertices, faces, { bx, bh, bz }, { bw, 0.0f, 0.0f }, { 0.0f, 0.0f, bd }, { 0.0f, 1.0f, 0.0f }, ot); // top
+        AddTiledRectangle(vertices, faces, { bx, 0.0f, bz }, { 0.0f, bh, 0.0f }, { 0.0f, 0.0f, bd }, { -1.0f, 0.0f, 0.0f }, ot); // left
+        AddTiledRectangle(vertices, faces, { bx + bw, 0.0f, bz }, { 0.0f, bh, 0.0f }, { 0.0f, 0.0f, bd }, { 1.0f, 0.0f, 0.0f }, ot); // right
+        AddTiledRectangle(vertices, faces, { bx, 0.0f, bz }, { bw, 0.0f, 0.0f }, { 0.0f, bh, 0.0f }, { 0.0f, 0.0f, -1.0f }, ot); // front
+        AddTiledRectangle(vertices, faces, { bx, 0.0f, bz + bd }, { bw, 0.0f, 0.0f }, { 0.0f, bh, 0.0f }, { 0.0f, 0.0f, 1.0f }, ot); // back
+    }
+
+    g_scene->room_model.vertex_count = (int)vertices.size();
+    g_scene->room_model.face_count = (int)faces.size();
+    g_scene->room_model.vertices = new Vertex[g_scene->room_model.vertex_count];
+    g_scene->room_model.faces = new Face[g_scene->room_model.face_count];
+
+    std::copy(vertices.begin(), vertices.end(), g_scene->room_model.vertices);
+    std::copy(faces.begin(), faces.end(), g_scene->room_model.faces);
+
+    return emitter_face;
+}
@@ -0,0 +1,356 @@
+#include <DirectXTemplatePCH.h>
+#include <simd_math.h>
+#include <DirectXPackedVector.h>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RADIOSITY_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// msvc allows avx intrinsics in every function
+#define TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#endif
+#endif
+
+// the kernels which go through plain floats, sse2 and avx2 registers.
+
+float4 WeightedSumScalar(const float4* colors, const float* weights, int count)
+{
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < count; i++)
+    {
+        float color[4];
+        Float4Store(color, colors[i]);
+        for (int c = 0; c < 4; c++)
+        {
+            sum[c] += weights[i] * color[c];
+        }
+    }
+    return Float4Set(sum[0], sum[1], sum[2], sum[3]);
+}
+
+float4 WeightedSumSSE2(const float4* colors, const float* weights, int count)
+{
+    float4 sum = Float4Zero();
+    for (int i = 0; i < count; i++)
+    {
+        sum = Float4MultiplyAdd(colors[i], Float4Replicate(weights[i]), sum);
+    }
+    return sum;
+}
+
+void WeightedSumBandsScalar(float* sum, const float* spectra, const float* weights, int count, int stride)
+{
+    std::fill(sum, sum + stride, 0.0f);
+    for (int i = 0; i < count; i++)
+    {
+        const float* spectrum = spectra + (size_t)i * stride;
+        for (int b = 0; b < stride; b++)
+        {
+            sum[b] += weights[i] * spectrum[b];
+        }
+    }
+}
+
+// the number of 4-wide chunks is a template parameter, so the accumulators stay in registers.
+template<int Chunks>
+void WeightedSumChunksSSE2(float* sum, const float* spectra, const float* weights, int count)
+{
+    const int chunks = Chunks;
+    const int stride = 4 * Chunks;
+    float4 accumulators[Chunks];
+    for (int k = 0; k < chunks; k++)
+    {
+        accumulators[k] = Float4Zero();
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const float* spectrum = spectra + (size_t)i * stride;
+        float4 weight = Float4Replicate(weights[i]);
+        for (int k = 0; k < chunks; k++)
+        {
+            accumulators[k] = Float4MultiplyAdd(Float4Load(spectrum + 4 * k), weight, accumulators[k]);
+        }
+    }
+    for (int k = 0; k < chunks; k++)
+    {
+        Float4Store(sum + 4 * k, accumulators[k]);
+    }
+}
+
+void WeightedSumBandsSSE2(float* sum, const float* spectra, const float* weights, int count, int stride)
+{
+    switch (stride / 4)
+    {
+    case 1: Float4Store(sum, WeightedSumSSE2((const float4*)spectra, weights, count)); break;
+    case 2: WeightedSumChunksSSE2<2>(sum, spectra, weights, count); break;
+    case 3: WeightedSumChunksSSE2<3>(sum, spectra, weights, count); break;
+    case 4: WeightedSumChunksSSE2<4>(sum, spectra, weights, count); break;
+    case 5: WeightedSumChunksSSE2<5>(sum, spectra, weights, count); break;
+    case 6: WeightedSumChunksSSE2<6>(sum, spectra, weights, count); break;
+    case 7: WeightedSumChunksSSE2<7>(sum, spectra, weights, count); break;
+    case 8: WeightedSumChunksSSE2<8>(sum, spectra, weights, count); break;
+    default: WeightedSumBandsScalar(sum, spectra, weights, count, stride); break;
+    }
+}
+
+#ifdef RADIOSITY_AVX2
+// two colors in one avx register.
+struct float8
+{
+    __m256 v;
+};
+
+TARGET_AVX2 inline float8 Float8Load(const float4* colors)
+{
+    float8 r;
+    r.v = _mm256_loadu_ps((const float*)colors);
+    return r;
+}
+
+// the weights of two colors, each replicated into its half of the register.
+TARGET_AVX2 inline float8 Float8LoadWeights(const float* weights)
+{
+    float8 r;
+    r.v = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[0])), _mm_set1_ps(weights[1]), 1);
+    return r;
+}
+
+TARGET_AVX2 float4 WeightedSumAVX2(const float4* colors, const float* weights, int count)
+{
+    // two independent accumulators hide the latency of the fused multiply-adds
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        sum0 = _mm256_fmadd_ps(Float8Load(colors + i).v, Float8LoadWeights(weights + i).v, sum0);
+        sum1 = _mm256_fmadd_ps(Float8Load(colors + i + 2).v, Float8LoadWeights(weights + i + 2).v, sum1);
+    }
+    for (; i + 2 <= count; i += 2)
+    {
+        sum0 = _mm256_fmadd_ps(Float8Load(colors + i).v, Float8LoadWeights(weights + i).v, sum0);
+    }
+    sum0 = _mm256_add_ps(sum0, sum1);
+
+    __m128 halves = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+    float components[4];
+    _mm_storeu_ps(components, halves);
+    float4 sum = Float4Set(components[0], components[1], components[2], components[3]);
+    for (; i < count; i++)
+    {
+        sum = Float4MultiplyAdd(colors[i], Float4Replicate(weights[i]), sum);
+    }
+    return sum;
+}
+
+// 8 bands fill an avx register, 4 bands go two spectra at a time through WeightedSumAVX2().
+// with Tail the last 4 bands of a stride of 12, 20 or 28 go through an sse register.
+template<int Chunks, bool Tail>
+TARGET_AVX2 void WeightedSumChunksAVX2(float* sum, const float* spectra, const float* weights, int count)
+{
+    const int chunks = Chunks;
+    const int stride = 8 * Chunks + (Tail ? 4 : 0);
+
+    // even and odd spectra go into separate accumulators, which hides the latency of the
+    // fused multiply-adds when a spectrum fills only one or two registers
+    __m256 even[Chunks];
+    __m256 odd[Chunks];
+    __m128 even_tail = _mm_setzero_ps();
+    __m128 odd_tail = _mm_setzero_ps();
+    for (int k = 0; k < chunks; k++)
+    {
+        even[k] = _mm256_setzero_ps();
+        odd[k] = _mm256_setzero_ps();
+    }
+    int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        const float* spectrum = spectra + (size_t)i * stride;
+        __m256 even_weight = _mm256_set1_ps(weights[i]);
+        __m256 odd_weight = _mm256_set1_ps(weights[i + 1]);
+        for (int k = 0; k < chunks; k++)
+        {
+            even[k] = _mm256_fmadd_ps(_mm256_loadu_ps(spectrum + 8 * k), even_weight, even[k]);
+            odd[k] = _mm256_fmadd_ps(_mm256_loadu_ps(spectrum + stride + 8 * k), odd_weight, odd[k]);
+        }
+        if (Tail)
+        {
+            even_tail = _mm_fmadd_ps(_mm_loadu_ps(spectrum + 8 * chunks), _mm256_castps256_ps128(even_weight), even_tail);
+            odd_tail = _mm_fmadd_ps(_mm_loadu_ps(spectrum + stride + 8 * chunks), _mm256_castps256_ps128(odd_weight), odd_tail);
+        }
+    }
+    if (i < count)
+    {
+        const float* spectrum = spectra + (size_t)i * stride;
+        __m256 even_weight = _mm256_set1_ps(weights[i]);
+        for (int k = 0; k < chunks; k++)
+        {
+            even[k] = _mm256_fmadd_ps(_mm256_loadu_ps(spectrum + 8 * k), even_weight, even[k]);
+        }
+        if (Tail)
+        {
+            even_tail = _mm_fmadd_ps(_mm_loadu_ps(spectrum + 8 * chunks), _mm256_castps256_ps128(even_weight), even_tail);
+        }
+    }
+    for (int k = 0; k < chunks; k++)
+    {
+        _mm256_storeu_ps(sum + 8 * k, _mm256_add_ps(even[k], odd[k]));
+    }
+    if (Tail)
+    {
+        _mm_storeu_ps(sum + 8 * chunks, _mm_add_ps(even_tail, odd_tail));
+    }
+}
+
+TARGET_AVX2 void WeightedSumBandsAVX2(float* sum, const float* spectra, const float* weights, int count, int stride)
+{
+    switch (stride)
+    {
+    case 4: Float4Store(sum, WeightedSumAVX2((const float4*)spectra, weights, count)); break;
+    case 8: WeightedSumChunksAVX2<1, false>(sum, spectra, weights, count); break;
+    case 12: WeightedSumChunksAVX2<1, true>(sum, spectra, weights, count); break;
+    case 16: WeightedSumChunksAVX2<2, false>(sum, spectra, weights, count); break;
+    case 20: WeightedSumChunksAVX2<2, true>(sum, spectra, weights, count); break;
+    case 24: WeightedSumChunksAVX2<3, false>(sum, spectra, weights, count); break;
+    case 28: WeightedSumChunksAVX2<3, true>(sum, spectra, weights, count); break;
+    case 32: WeightedSumChunksAVX2<4, false>(sum, spectra, weights, count); break;
+    default: WeightedSumBandsSSE2(sum, spectra, weights, count, stride); break;
+    }
+}
+#endif
+
+void HalfToFloatScalar(float* out, const unsigned short* in, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = DirectX::PackedVector::XMConvertHalfToFloat(in[i]);
+    }
+}
+
+#ifdef RADIOSITY_AVX2
+TARGET_AVX2 void HalfToFloatAVX2(float* out, const unsigned short* in, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i halves = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(halves));
+    }
+    HalfToFloatScalar(out + i, in + i, count - i);
+}
+#endif
+
+// this checks if the cpu and the operating system support avx2 and fma, and the
+// f16c conversions, which the avx2 kernel of HalfToFloat() uses.
+bool CpuSupportsAVX2()
+{
+#if defined(RADIOSITY_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool f16c = (info[2] & (1 << 29)) != 0;
+    if (!fma || !osxsave || !avx || !f16c)
+        return false;
+
+    // the operating system has to save the ymm registers
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif defined(RADIOSITY_AVX2)
+    // __builtin_cpu_supports() doesn't know f16c on every compiler
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || (ecx & (1 << 29)) == 0)
+        return false;
+
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+typedef float4 (*WeightedSumKernel)(const float4* colors, const float* weights, int count);
+typedef void (*WeightedSumBandsKernel)(float* sum, const float* spectra, const float* weights, int count, int stride);
+typedef void (*HalfToFloatKernel)(float* out, const unsigned short* in, int count);
+
+SimdLevel g_simd_level = SetSimdLevel(SIMD_AVX2);
+WeightedSumKernel g_weighted_sum_kernel;
+WeightedSumBandsKernel g_weighted_sum_bands_kernel;
+HalfToFloatKernel g_half_to_float_kernel;
+
+SimdLevel GetSupportedSimdLevel()
+{
+    static SimdLevel supported = CpuSupportsAVX2() ? SIMD_AVX2 :
+#ifdef RADIOSITY_SSE2
+        SIMD_SSE2;
+#else
+        SIMD_Scalar;
+#endif
+    return supported;
+}
+
+SimdLevel GetSimdLevel()
+{
+    return g_simd_level;
+}
+
+SimdLevel SetSimdLevel(SimdLevel level)
+{
+    if (level > GetSupportedSimdLevel())
+        level = GetSupportedSimdLevel();
+
+    g_simd_level = level;
+    g_weighted_sum_kernel = WeightedSumScalar;
+    g_weighted_sum_bands_kernel = WeightedSumBandsScalar;
+    g_half_to_float_kernel = HalfToFloatScalar;
+    if (level == SIMD_SSE2)
+    {
+        g_weighted_sum_kernel = WeightedSumSSE2;
+        g_weighted_sum_bands_kernel = WeightedSumBandsSSE2;
+    }
+#ifdef RADIOSITY_AVX2
+    if (level == SIMD_AVX2)
+    {
+        g_weighted_sum_kernel = WeightedSumAVX2;
+        g_weighted_sum_bands_kernel = WeightedSumBandsAVX2;
+        g_half_to_float_kernel = HalfToFloatAVX2;
+    }
+#endif
+    return level;
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+float4 WeightedSum(const float4* colors, const float* weights, int count)
+{
+    return g_weighted_sum_kernel(colors, weights, count);
+}
+
+void WeightedSumBands(float* sum, const float* spectra, const float* weights, int count, int stride)
+{
+    g_weighted_sum_bands_kernel(sum, spectra, weights, count, stride);
+}
+
+void HalfToFloat(float* out, const unsigned short* in, int count)
+{
+    g_half_to_float_kernel(out, in, count);
+}
@@ -0,0 +1,102 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <spectral.h>
+#include <profiler.h>
+
+using namespace DirectX;
+
+int BandChannel(int band, int bands)
+{
+    float center = 400.0f + 300.0f * (band + 0.5f) / bands;
+    if (center >= 600.0f)
+        return 0;
+    if (center >= 500.0f)
+        return 1;
+    return 2;
+}
+
+// sets every band of a spectrum to the channel of an rgb color it belongs to.
+template<int Bands>
+Spectrum<Bands> SpectrumFromColor(const XMFLOAT3& color)
+{
+    const float* channels = &color.x;
+    Spectrum<Bands> spectrum = {};
+    for (int b = 0; b < Bands; b++)
+    {
+        spectrum.band[b] = channels[BandChannel(b, Bands)];
+    }
+    return spectrum;
+}
+
+template<int Bands>
+void InitSpectralScene(SpectralScene<Bands>& scene)
+{
+    scene.irradiance.resize(g_scene->patch_count);
+    scene.reflectance.resize(g_scene->patch_count);
+    scene.radiosity.assign(g_scene->patch_count, Spectrum<Bands>());
+    for (int i = 0; i < g_scene->patch_count; i++)
+    {
+        scene.irradiance[i] = SpectrumFromColor<Bands>(g_scene->patches[i].irradiance);
+        scene.reflectance[i] = SpectrumFromColor<Bands>(g_scene->patches[i].reflectance);
+    }
+}
+
+template<int Bands>
+void IterateSpectralRadiosity(SpectralScene<Bands>& scene, int iterations)
+{
+    PROFILE_SCOPE("iterate_spectral");
+
+    const int stride = Spectrum<Bands>::Stride;
+    std::vector<Spectrum<Bands>> colors(g_scene->patch_count);
+    std::vector<Spectrum<Bands>> radiosity(g_scene->patch_count);
+    std::vector<float> row_buffer(g_scene->patch_count);
+
+    for (int run = 0; run < iterations; run++)
+    {
+        // the outgoing spectra are gathered once per iteration, like the colors of IterateRadiosity()
+        for (int j = 0; j < g_scene->patch_count; j++)
+        {
+            for (int b = 0; b < stride; b++)
+            {
+                colors[j].band[b] = scene.irradiance[j].band[b] + scene.reflectance[j].band[b] * scene.radiosity[j].band[b];
+            }
+        }
+
+        for (int i = 0; i < g_scene->patch_count; i++)
+        {
+            const float* row = GetFormFactorRow(i, row_buffer.data());
+            WeightedSumBands(radiosity[i].band, colors[0].band, row, g_scene->patch_count, stride);
+
+            float scale = (float)FormFactorRowScale(i);
+            for (int b = 0; b < stride; b++)
+            {
+                radiosity[i].band[b] *= scale;
+            }
+        }
+        scene.radiosity.swap(radiosity);
+    }
+}
+
+template<int Bands>
+void GetSpectralColor(const SpectralScene<Bands>& scene, int patch_index, XMFLOAT3& color)
+{
+    float sums[3] = { 0.0f, 0.0f, 0.0f };
+    int counts[3] = { 0, 0, 0 };
+    for (int b = 0; b < Bands; b++)
+    {
+        int channel = BandChannel(b, Bands);
+        sums[channel] += scene.irradiance[patch_index].band[b] + scene.reflectance[patch_index].band[b] * scene.radiosity[patch_index].band[b];
+        counts[channel]++;
+    }
+    color = { sums[0] / std::max<int>(counts[0], 1), sums[1] / std::max<int>(counts[1], 1), sums[2] / std::max<int>(counts[2], 1) };
+}
+
+#define INSTANTIATE_SPECTRAL_BANDS(Bands) \
+    template void InitSpectralScene<Bands>(SpectralScene<Bands>& scene); \
+    template void IterateSpectralRadiosity<Bands>(SpectralScene<Bands>& scene, int iterations); \
+    template void GetSpectralColor<Bands>(const SpectralScene<Bands>& scene, int patch_index, XMFLOAT3& color);
+
+INSTANTIATE_SPECTRAL_BANDS(3)
+INSTANTIATE_SPECTRAL_BANDS(4)
+INSTANTIATE_SPECTRAL_BANDS(8)
+INSTANTIATE_SPECTRAL_BANDS(16)
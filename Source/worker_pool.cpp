@@ -0,0 +1,70 @@
+#include <DirectXTemplatePCH.h>
+#include <radiosity.h>
+#include <worker_pool.h>
+
+WorkerPool::WorkerPool(int thread_count)
+    : m_work(nullptr), m_scene(nullptr), m_generation(0), m_running(0), m_closed(false)
+{
+    m_thread_count = thread_count > 0 ? thread_count : (int)std::thread::hardware_concurrency();
+    m_thread_count = std::max<int>(1, m_thread_count);
+    for (int t = 1; t < m_thread_count; t++)
+    {
+        m_threads.push_back(std::thread(&WorkerPool::WorkerLoop, this, t));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_changed.notify_all();
+    for (std::thread& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkerPool::Run(const std::function<void(int)>& work)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_work = &work;
+        m_scene = g_scene;
+        m_generation++;
+        m_running = m_thread_count - 1;
+    }
+    m_changed.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [&]() { return m_running == 0; });
+}
+
+// waits for the next run, takes part in it and reports back.
+void WorkerPool::WorkerLoop(int thread)
+{
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_changed.wait(lock, [&]() { return m_closed || m_generation != seen; });
+        if (m_closed)
+            return;
+        seen = m_generation;
+        const std::function<void(int)>& work = *m_work;
+        Scene* scene = m_scene;
+
+        lock.unlock();
+        {
+            SceneScope scope(scene);
+            work(thread);
+        }
+        lock.lock();
+
+        if (--m_running == 0)
+            m_changed.notify_all();
+    }
+}